@@ -1,21 +1,57 @@
 #pragma once
 
+#include <cstdint>
+#include <climits>
 #include <cstdlib>
 #include <string>
 #include <iostream>
 #include <vector>
 #include <cassert>
 #include <map>
-#include <variant>
+#include <set>
 #include <sstream>
+#include <functional>
+#include <memory>
+#include "KIR.h"
 using namespace std;
 
-static int symbol_num = 0;
-static vector<map<string, variant<int, string> > > symbol_tables;
+// 符号表的一项. 常量标量直接存值, 变量存地址: 局部变量是 alloc, 全局变量是 KV_GLOBAL.
+// 数组另外记各维长度; 数组形参是指针 (is_ptr), 第一维长度不知道, dims 里只有后面几维.
+// 常量数组留着展开后的初值, 下标是常量时直接折叠; 局部常量数组要按地址访问时才放进 .rodata
+struct Symbol
+{
+    bool is_const = false;
+    int value = 0;
+    KValue addr = {KV_NONE, 0};
+    vector<int> dims;
+    bool is_ptr = false;
+    shared_ptr<const vector<int> > values;
+    string rodata_name; // 局部常量数组放进 .rodata 时用的全局名
+};
+
+// 作用域从外到内, [0] 是全局作用域
+static vector<map<string, Symbol> > symbol_tables;
 static map<string, int> var_names;
+// 还没交出去的全局变量: 全局声明定义的, 以及局部常量数组和数组初值模板放进 .rodata 的
+static vector<KGlobalVar> ir_globals;
+// 全局声明定义的符号 (带 '@') 和签名, 增量编译按签名判断用到它们的函数能否复用
+static vector<pair<string, string> > ir_global_sigs;
+// 当前函数用到的全局符号 (带 '@')
+static set<string> ir_global_refs;
 
 static int if_else_num = 0;
 static int other_num = 0;
+static int while_num = 0;
+// 外层到内层的循环, 每项是 (continue 目标, break 目标)
+static vector<pair<int, int> > loop_labels;
+// 和 loop_labels 一一对应: 循环体里有没有跳到 continue 目标的 continue
+static vector<char> loop_continued;
+// 函数名 -> 是否返回 int, 库函数和已经定义过的函数都在里面
+static map<string, bool> func_ret_int;
+// IR 直接生成成 KIR (KIR.h), 值用 KValue 表示, 文本只在最后输出时才拼
+static KFunc *ir_func = nullptr;
+static int ir_block = -1;           // 当前往里加指令的块
+static vector<int> ir_label_order;  // 块在文本里出现的顺序
 
 class BaseAST 
 {
@@ -29,12 +65,39 @@ class ExpAst
     virtual ~ExpAst() = default;
 };
 
+// 流式编译时 parser 每归约出一个 FuncDef 或全局 Decl 就交给它, 不再攒进 CompUnit
+typedef function<void(unique_ptr<BaseAST>)> FuncDefSink;
+
+// parser 的位置类型不记行列, 记的是这段 token 流的哈希: 每个 token 由 yylex 算好,
+// 归约时按顺序把右部的哈希混起来. token 流一样, 哈希就一样 (增量编译用它当函数的指纹)
+struct TokenHash
+{
+    uint64_t value;
+};
+
+static inline uint64_t HashMix(uint64_t h, uint64_t x)
+{
+    h ^= x + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static inline uint64_t HashString(const string &s)
+{
+    uint64_t h = 0xcbf29ce484222325ULL; // FNV-1a
+    for (unsigned char c : s)
+        h = (h ^ c) * 0x100000001b3ULL;
+    return h;
+}
+
 // CompUnit 是 BaseAST
 class CompUnitAST : public BaseAST 
 {
  public:
   // 用智能指针管理对象
-    unique_ptr<BaseAST> func_def;
+    vector<unique_ptr<BaseAST> > item_list; // FuncDefAST 和 DeclAST, 按出现的顺序
 };
 
 // FuncDef 也是 BaseAST
@@ -43,7 +106,18 @@ class FuncDefAST : public BaseAST
  public:
     unique_ptr<BaseAST> func_type;
     string ident;
+    vector<unique_ptr<BaseAST> > func_f_param_list;
     unique_ptr<BaseAST> block;
+    uint64_t fingerprint = 0; // 整个定义的 token 流的哈希
+};
+
+class FuncFParamAST : public BaseAST
+{
+ public:
+    string b_type;
+    string ident;
+    bool is_array = false;             // int a[] 或 int a[][N]...
+    vector<unique_ptr<BaseAST> > dims; // 数组形参第一维之后各维的长度 (ConstExpAST)
 };
 
 class FuncTypeAST : public BaseAST
@@ -61,90 +135,98 @@ class BlockAST : public BaseAST
 class StmtAST : public BaseAST
 {
 public:
-    string type; // "if", "ifelse" or "simple"
+    string type; // "if", "ifelse", "while" or "simple"
     unique_ptr<BaseAST> exp_simple;
     unique_ptr<BaseAST> if_stmt;
     unique_ptr<BaseAST> else_stmt;
+    unique_ptr<BaseAST> while_stmt;
 };
 
 class SimpleStmtAST : public BaseAST
 {
 public:
-    string type; // "lval", "exp", "block" or "ret"
-    string l_val;
+    string type; // "lval", "exp", "block", "break", "continue" or "ret"
+    unique_ptr<BaseAST> l_val; // "lval": 被赋值的 LValAST
     unique_ptr<BaseAST> block_exp;
 };
 
-class ExpAST : public BaseAST
+// 表达式只有一种二元运算结点, 运算符是枚举. 数字, 变量和调用直接挂在运算符下面,
+// 括号和一元 '+' 不产生结点, 不再有 Exp -> LOrExp -> ... -> PrimaryExp 的包装链
+enum ExpOp
 {
-public:
-    unique_ptr<BaseAST> lor_exp;
+    EXP_NUMBER, EXP_LVAL, EXP_CALL,  // 叶子
+    EXP_NEG, EXP_NOT,                // UnaryExpAST
+    EXP_MUL, EXP_DIV, EXP_MOD, EXP_ADD, EXP_SUB,
+    EXP_LT, EXP_GT, EXP_LE, EXP_GE, EXP_EQ, EXP_NE,
+    EXP_AND, EXP_OR,
 };
 
-class PrimaryExpAST : public BaseAST
+class ExpAST : public BaseAST
 {
 public:
-    string type; // "exp", "number" or "lval"
-    unique_ptr<BaseAST> exp;
-    string l_val;
-    int number;
+    ExpOp op;
 };
 
-class UnaryExpAST : public BaseAST
+class BinaryExpAST : public ExpAST
 {
 public:
-    string type; // "primary" or "unary"
-    unique_ptr<BaseAST> exp;
-    string op;
+    unique_ptr<ExpAST> lhs;
+    unique_ptr<ExpAST> rhs;
 };
 
-class MulExpAST : public BaseAST
+class UnaryExpAST : public ExpAST
 {
 public:
-    string op; // "*", "/", "%" or ""
-    unique_ptr<BaseAST> unary_exp;
-    unique_ptr<BaseAST> mul_exp;
+    unique_ptr<ExpAST> exp;
 };
 
-class AddExpAST : public BaseAST
+class NumberAST : public ExpAST
 {
 public:
-    string op; // "+", "-" or ""
-    unique_ptr<BaseAST> add_exp;
-    unique_ptr<BaseAST> mul_exp;
+    int number;
 };
 
-class RelExpAST : public BaseAST
+class LValAST : public ExpAST
 {
 public:
-    string op; // "<", ">", "<=", ">=" or ""
-    unique_ptr<BaseAST> add_exp;
-    unique_ptr<BaseAST> rel_exp;
+    string l_val;
+    vector<unique_ptr<ExpAST> > indices; // 数组下标, 可以比维数少 (子数组当实参)
 };
 
-class EqExpAST : public BaseAST
+class CallExpAST : public ExpAST
 {
 public:
-    string op; // "==", "!=" or ""
-    unique_ptr<BaseAST> eq_exp;
-    unique_ptr<BaseAST> rel_exp;
+    string ident;
+    vector<unique_ptr<BaseAST> > func_r_param_list;
 };
 
-class LAndExpAST : public BaseAST
+// parser 用: RELOP / EQOP token 带的是运算符文本
+static ExpOp ExpOpFromString(const string &op)
 {
-public:
-    string op; // "&&" or ""
-    unique_ptr<BaseAST> eq_exp;
-    unique_ptr<BaseAST> land_exp;
-};
+    if (op == "<")
+        return EXP_LT;
+    else if (op == ">")
+        return EXP_GT;
+    else if (op == "<=")
+        return EXP_LE;
+    else if (op == ">=")
+        return EXP_GE;
+    else if (op == "==")
+        return EXP_EQ;
+    else if (op == "!=")
+        return EXP_NE;
+    cerr << "error: unknown operator " << op << endl;
+    exit(1);
+}
 
-class LOrExpAST : public BaseAST
+static ExpAST *NewBinaryExp(ExpOp op, ExpAST *lhs, ExpAST *rhs)
 {
-public:
-    string op; // "||" or ""
-    unique_ptr<BaseAST> land_exp;
-    unique_ptr<BaseAST> lor_exp;
-};
+    auto exp = new BinaryExpAST();
+    exp->op = op;
+    exp->lhs = unique_ptr<ExpAST>(lhs);
+    exp->rhs = unique_ptr<ExpAST>(rhs);
+    return exp;
+}
 
 class DeclAST : public BaseAST
 {
@@ -164,6 +246,7 @@ class ConstDefAST : public BaseAST
 {
 public:
     string ident;
+    vector<unique_ptr<BaseAST> > dims; // 数组各维的长度 (ConstExpAST), 标量为空
     unique_ptr<BaseAST> const_init_val;
 };
 
@@ -171,6 +254,8 @@ class ConstInitValAST : public BaseAST
 {
 public:
     unique_ptr<BaseAST> const_exp;
+    bool is_list = false;              // {...}, 元素在 list 里
+    vector<unique_ptr<BaseAST> > list;
 };
 
 class BlockItemAST : public BaseAST
@@ -197,6 +282,7 @@ class VarDefAST : public BaseAST
 {
 public:
     string ident;
+    vector<unique_ptr<BaseAST> > dims; // 数组各维的长度 (ConstExpAST), 标量为空
     bool has_init_val;
     unique_ptr<BaseAST> init_val;
 };
@@ -205,11 +291,14 @@ class InitValAST : public BaseAST
 {
 public:
     unique_ptr<BaseAST> exp;
+    bool is_list = false;              // {...}, 元素在 list 里
+    vector<unique_ptr<BaseAST> > list;
 };
 
 
-static void DumpIR(const CompUnitAST *comp_unit);
-static void DumpIR(const FuncDefAST *func_def);
+static vector<string> DumpLibDecls();
+static KProgram DumpIR(const CompUnitAST *comp_unit);
+static KFunc DumpIR(const FuncDefAST *func_def);
 static void DumpIR(const BlockAST *block);
 static void DumpIR(const StmtAST *stmt);
 static void DumpIR(const SimpleStmtAST *stmt);
@@ -219,76 +308,243 @@ static void DumpIR(const ConstDeclAST *const_decl);
 static void DumpIR(const ConstDefAST *const_def);
 static void DumpIR(const VarDeclAST *var_decl);
 static void DumpIR(const VarDefAST *var_def);
-static string DumpIR(const ExpAST *exp);
-static string DumpIR(const UnaryExpAST *unary_exp);
-static string DumpIR(const PrimaryExpAST *primary_exp);
-static string DumpIR(const MulExpAST *mul_exp);
-static string DumpIR(const AddExpAST *add_exp);
-static string DumpIR(const RelExpAST *rel_exp);
-static string DumpIR(const EqExpAST *eq_exp);
-static string DumpIR(const LAndExpAST *land_exp);
-static string DumpIR(const LOrExpAST *lor_exp);
-static string DumpIR(const InitValAST *init_val);
-static int DumpIR(const ConstInitValAST *const_init_val);
+static KValue DumpIR(const ExpAST *exp);
+static KValue DumpIR(const CallExpAST *call_exp);
+static KValue DumpIR(const BinaryExpAST *binary_exp);
 static int DumpEXP(const ConstExpAST *const_exp);
 static int DumpEXP(const ExpAST *exp);
-static int DumpEXP(const UnaryExpAST *unary_exp);
-static int DumpEXP(const PrimaryExpAST *primary_exp);
-static int DumpEXP(const MulExpAST *mul_exp);
-static int DumpEXP(const AddExpAST *add_exp);
-static int DumpEXP(const RelExpAST *rel_exp);
-static int DumpEXP(const EqExpAST *eq_exp);
-static int DumpEXP(const LAndExpAST *land_exp);
-static int DumpEXP(const LOrExpAST *lor_exp);
-static variant<int, string> look_up_symbol_tables(string l_val);
-
-static variant<int, string> look_up_symbol_tables(string l_val)
+static bool IsConstExp(const ExpAST *exp);
+static KValue DumpAddr(const LValAST *l_val, Symbol &symbol, size_t &rest);
+static Symbol &look_up_symbol_tables(const string &l_val);
+
+static Symbol &look_up_symbol_tables(const string &l_val)
 {
     int size = symbol_tables.size();
     for (int i = size - 1; i >= 0; --i)
 {
-        if (symbol_tables[i].count(l_val))
-            return symbol_tables[i][l_val];
+        auto it = symbol_tables[i].find(l_val);
+        if (it != symbol_tables[i].end())
+        {
+            if (i == 0 && ir_func != nullptr)
+                ir_global_refs.insert("@" + l_val);
+            return it->second;
+        }
     }
 
-    assert(false);
-    return -1;
+    cerr << "error: undefined symbol " << l_val << endl;
+    exit(1);
+}
+
+// 往当前函数里加指令. 块先按第一次被引用的顺序编号, 函数生成完后再按
+// IR_SetBlock 的顺序排好, 和以前输出的文本顺序一致
+static int IR_NewBlock(const string &name)
+{
+    ir_func->bbs.push_back(KBlock());
+    ir_func->bbs.back().name = name;
+    return ir_func->bbs.size() - 1;
+}
+
+static void IR_SetBlock(int bb)
+{
+    ir_block = bb;
+    ir_label_order.push_back(bb);
+}
+
+static KInst &IR_Append(int kind)
+{
+    KInst inst;
+    inst.kind = kind;
+    ir_func->bbs[ir_block].insts.push_back(inst);
+    return ir_func->bbs[ir_block].insts.back();
+}
+
+static KValue IR_Binary(int op, KValue lhs, KValue rhs)
+{
+    KInst &inst = IR_Append(KI_BINARY);
+    inst.op = op;
+    inst.dest = KIR_NewTemp(*ir_func);
+    inst.lhs = lhs;
+    inst.rhs = rhs;
+    return KTemp(inst.dest);
 }
 
-static void DumpIR(const CompUnitAST *comp_unit)
+static KValue IR_Alloc(const string &name = "", const KType &type = KType())
 {
-    DumpIR((FuncDefAST *)(comp_unit->func_def.get()));
+    KInst &inst = IR_Append(KI_ALLOC);
+    inst.dest = KIR_NewTemp(*ir_func, name);
+    inst.type = type;
+    return KTemp(inst.dest);
 }
 
-static void DumpIR(const FuncDefAST *func_def)
+// getelemptr (kind == KI_GETELEMPTR) 或 getptr, stride 是下标每加一地址加的字节数
+static KValue IR_Ptr(int kind, KValue src, KValue index, int stride)
 {
-    //改变输出流到缓冲区，再存到字符串里
-    stringstream ss;
-    streambuf *cout_buf = cout.rdbuf();
-    cout.rdbuf(ss.rdbuf());
+    KInst &inst = IR_Append(kind);
+    inst.dest = KIR_NewTemp(*ir_func);
+    inst.lhs = src;
+    inst.rhs = index;
+    inst.stride = stride;
+    return KTemp(inst.dest);
+}
+
+static KValue IR_Load(KValue src)
+{
+    KInst &inst = IR_Append(KI_LOAD);
+    inst.dest = KIR_NewTemp(*ir_func);
+    inst.lhs = src;
+    return KTemp(inst.dest);
+}
+
+static void IR_Store(KValue value, KValue dest)
+{
+    KInst &inst = IR_Append(KI_STORE);
+    inst.lhs = value;
+    inst.rhs = dest;
+}
+
+static void IR_Branch(KValue cond, int true_bb, int false_bb)
+{
+    KInst &inst = IR_Append(KI_BRANCH);
+    inst.lhs = cond;
+    inst.true_bb = true_bb;
+    inst.false_bb = false_bb;
+}
+
+static void IR_Jump(int target)
+{
+    IR_Append(KI_JUMP).true_bb = target;
+}
+
+// ret / break / continue 之后的代码放进一个没有前驱的块里
+static void IR_OpenDeadBlock()
+{
+    IR_SetBlock(IR_NewBlock("%other_" + to_string(other_num++)));
+}
+
+// SysY 运行时库
+static vector<string> DumpLibDecls()
+{
+    func_ret_int["getint"] = func_ret_int["getch"] = func_ret_int["getarray"] = true;
+    func_ret_int["putint"] = func_ret_int["putch"] = func_ret_int["putarray"] = false;
+    func_ret_int["starttime"] = func_ret_int["stoptime"] = false;
+    return {"decl @getint(): i32", "decl @getch(): i32", "decl @getarray(*i32): i32", "decl @putint(i32)",
+            "decl @putch(i32)", "decl @putarray(i32, *i32)", "decl @starttime()", "decl @stoptime()"};
+}
+
+static KProgram DumpIR(const CompUnitAST *comp_unit)
+{
+    KProgram program;
+    program.decls = DumpLibDecls();
+    symbol_tables.push_back(map<string, Symbol>()); // 全局作用域
+    int size = comp_unit->item_list.size();
+    for (int i = 0; i < size; ++i)
+    {
+        BaseAST *item = comp_unit->item_list[i].get();
+        if (auto func_def = dynamic_cast<FuncDefAST *>(item))
+            program.funcs.push_back(DumpIR(func_def));
+        else
+            DumpIR((DeclAST *)item);
+        program.globals.insert(program.globals.end(), ir_globals.begin(), ir_globals.end());
+        ir_globals.clear();
+    }
+    symbol_tables.pop_back();
+    ir_global_sigs.clear();
+    return program;
+}
+
+static vector<int> DumpDims(const vector<unique_ptr<BaseAST> > &dims)
+{
+    vector<int> result;
+    for (auto &dim : dims)
+    {
+        result.push_back(DumpEXP((ConstExpAST *)dim.get()));
+        if (result.back() <= 0)
+        {
+            cerr << "error: array dimension must be positive" << endl;
+            exit(1);
+        }
+    }
+    return result;
+}
+
+static KFunc DumpIR(const FuncDefAST *func_def)
+{
+    KFunc func;
+    ir_func = &func;
+    ir_label_order.clear();
+    // 块名和变量名的编号每个函数从头开始, 一个函数的 IR 只取决于它自己 (和它调用的函数的类型),
+    // 增量编译才能复用
+    var_names.clear();
+    if_else_num = other_num = while_num = 0;
 
-    cout << "fun @" << func_def->ident << "(): ";
     string type = ((FuncTypeAST *)(func_def->func_type.get()))->functype;
-    assert(type=="int");
-    cout << "i32{" << "\n";
-    cout << "%" << "entry" << ":\n"; // Blocks will have their names in the future
+    assert(type == "int" || type == "void");
+    func_ret_int[func_def->ident] = type == "int"; // 先登记, 递归调用也能找到
+    func.name = "@" + func_def->ident;
+    func.ret_i32 = type == "int";
+    IR_SetBlock(IR_NewBlock("%entry"));
+
+    // 形参放进栈上的变量里, 和普通局部变量一样处理. 数组形参是指针, 不会被赋值, 直接用
+    symbol_tables.push_back(map<string, Symbol>());
+    int param_size = func_def->func_f_param_list.size();
+    vector<Symbol> params(param_size);
+    for (int i = 0; i < param_size; ++i)
+    {
+        auto param = (FuncFParamAST *)(func_def->func_f_param_list[i].get());
+        assert(param->b_type == "int");
+        func.params.push_back(KIR_NewTemp(func, "%arg_" + param->ident));
+        func.param_types.push_back(KType());
+        if (param->is_array)
+        {
+            params[i].is_ptr = true;
+            params[i].dims = DumpDims(param->dims);
+            func.param_types.back().dims = params[i].dims;
+            func.param_types.back().pointer = true;
+        }
+    }
+    for (int i = 0; i < param_size; ++i)
+    {
+        auto param = (FuncFParamAST *)(func_def->func_f_param_list[i].get());
+        if (params[i].is_ptr)
+            params[i].addr = KTemp(func.params[i]);
+        else
+        {
+            string var_name = "@" + param->ident;
+            params[i].addr = IR_Alloc(var_name + "_" + to_string(var_names[var_name]++));
+            IR_Store(KTemp(func.params[i]), params[i].addr);
+        }
+        symbol_tables.back()[param->ident] = params[i];
+    }
     DumpIR((BlockAST *)(func_def->block.get()));
+    symbol_tables.pop_back();
 
-    string ir_str = ss.str(), last_line = "";
-    int pt = ir_str.length() - 2;
-    while(ir_str[pt] != '\n')
-        last_line = ir_str[pt--] + last_line;
-    if (last_line.substr(0, 6) == "%other") // deal with empty ret block
-        ir_str = ir_str.substr(0, pt+1);
-    cout.rdbuf(cout_buf);
+    vector<KInst> &last = func.bbs[ir_block].insts;
+    if (last.empty() && func.bbs[ir_block].name.compare(0, 7, "%other_") == 0)
+        ir_label_order.pop_back(); // deal with empty ret block
+    else if (last.empty() || !KIR_IsTerminator(last.back()))
+    {
+        // 函数末尾没有 return
+        KInst &ret = IR_Append(KI_RETURN);
+        if (type == "int")
+            ret.lhs = KImm(0);
+    }
 
-    cout << ir_str << "}\n";
+    vector<int> remap(func.bbs.size(), -1);
+    vector<KBlock> bbs;
+    for (int bb : ir_label_order)
+    {
+        remap[bb] = bbs.size();
+        bbs.push_back(move(func.bbs[bb]));
+    }
+    KIR_RetargetBranches(bbs, remap);
+    func.bbs = move(bbs);
+    ir_func = nullptr;
+    return func;
 }
 
 static void DumpIR(const BlockAST *block)
 {
-    map<string, variant<int, string> > symbol_table;//在本block内建立符号表
-    symbol_tables.push_back(symbol_table);
+    symbol_tables.push_back(map<string, Symbol>()); //在本block内建立符号表
     int symbol_tables_size = block->block_item_list.size();
     for (int i = 0; i < symbol_tables_size; ++i)
         DumpIR((BlockItemAST *)(block->block_item_list[i].get()));
@@ -299,22 +555,25 @@ static void DumpIR(const SimpleStmtAST *stmt)
 {
     if (stmt->type == "ret")
 {
-        if (stmt->block_exp == nullptr)
-            cout << "  " << "ret\n";
-        else
-        {
-            string result_var = DumpIR((ExpAST *)(stmt->block_exp.get()));
-            cout << "  " << "ret " << result_var << "\n";
-        }
-        string other_label = "\%other_" + to_string(other_num++);
-        cout << other_label << ":\n";
+        KValue result_var = KNone();
+        if (stmt->block_exp != nullptr)
+            result_var = DumpIR((ExpAST *)(stmt->block_exp.get()));
+        IR_Append(KI_RETURN).lhs = result_var;
+        IR_OpenDeadBlock();
     }
     else if (stmt->type == "lval")
     {
-        string result_var = DumpIR((ExpAST *)(stmt->block_exp.get()));
-        variant<int, string> value = look_up_symbol_tables(stmt->l_val);
-        assert(value.index() == 1);
-        cout << "  " << "store " << result_var << ", " << get<1>(value) << "\n";
+        KValue result_var = DumpIR((ExpAST *)(stmt->block_exp.get()));
+        auto l_val = (LValAST *)(stmt->l_val.get());
+        Symbol &symbol = look_up_symbol_tables(l_val->l_val);
+        size_t rest;
+        KValue addr = DumpAddr(l_val, symbol, rest);
+        if (symbol.is_const || rest != 0)
+        {
+            cerr << "error: cannot assign to " << l_val->l_val << endl;
+            exit(1);
+        }
+        IR_Store(result_var, addr);
     }
     else if (stmt->type == "exp")
     {
@@ -323,6 +582,14 @@ static void DumpIR(const SimpleStmtAST *stmt)
     }
     else if (stmt->type == "block")
         DumpIR((BlockAST *)(stmt->block_exp.get()));
+    else if (stmt->type == "break" || stmt->type == "continue")
+    {
+        assert(!loop_labels.empty());
+        if (stmt->type == "continue")
+            loop_continued.back() = 1;
+        IR_Jump(stmt->type == "break" ? loop_labels.back().second : loop_labels.back().first);
+        IR_OpenDeadBlock();
+    }
     else
         assert(false);
 }
@@ -333,470 +600,538 @@ static void DumpIR(const StmtAST *stmt)
         DumpIR((SimpleStmtAST *)(stmt->exp_simple.get()));
     else if (stmt->type == "if")
     {
-        string if_result = DumpIR((ExpAST *)(stmt->exp_simple.get()));
-        string label_then = "\%then_" + to_string(if_else_num);
-        string label_end = "\%end_" + to_string(if_else_num);
+        KValue if_result = DumpIR((ExpAST *)(stmt->exp_simple.get()));
+        int label_then = IR_NewBlock("%then_" + to_string(if_else_num));
+        int label_end = IR_NewBlock("%end_" + to_string(if_else_num));
         if_else_num++;
-        cout << "  " << "br " << if_result << ", " << label_then << ", " << label_end << "\n";
-        cout << label_then << ":" << "\n";
+        IR_Branch(if_result, label_then, label_end);
+        IR_SetBlock(label_then);
         DumpIR((StmtAST *)(stmt->if_stmt.get()));
-        cout << "  " << "jump " << label_end << "\n";
-        cout << label_end << ":\n";
+        IR_Jump(label_end);
+        IR_SetBlock(label_end);
     }
     else if (stmt->type == "ifelse")
     {
-        string if_result = DumpIR((ExpAST *)(stmt->exp_simple.get()));
-        string label_then = "\%then_" + to_string(if_else_num);
-        string label_else = "\%else_" + to_string(if_else_num);
-        string label_end = "\%end_" + to_string(if_else_num);
+        KValue if_result = DumpIR((ExpAST *)(stmt->exp_simple.get()));
+        int label_then = IR_NewBlock("%then_" + to_string(if_else_num));
+        int label_else = IR_NewBlock("%else_" + to_string(if_else_num));
+        int label_end = IR_NewBlock("%end_" + to_string(if_else_num));
         if_else_num++;
-        cout << "  " << "br " << if_result << ", " << label_then << ", " << label_else << "\n";
-        cout << label_then << ":\n";
+        IR_Branch(if_result, label_then, label_else);
+        IR_SetBlock(label_then);
         DumpIR((StmtAST *)(stmt->if_stmt.get()));
-        cout << "  " << "jump " << label_end << "\n";
-        cout << label_else << ":\n";
+        IR_Jump(label_end);
+        IR_SetBlock(label_else);
         DumpIR((StmtAST *)(stmt->else_stmt.get()));
-        cout << "  " << "jump " << label_end << "\n";
-        cout << label_end << ":\n";
+        IR_Jump(label_end);
+        IR_SetBlock(label_end);
+    }
+    else if (stmt->type == "while")
+    {
+        // 按 do-while 的形状生成: 进入前判断一次, 条件复制到循环体末尾, 直接条件跳回
+        // 循环体开头, 每次迭代只走一条条件跳转. 只有用到 continue 时才另开一个条件块
+        // 给它跳, 没用到的 while_cond 块从来没放进块序, 函数生成完就丢掉了
+        int label_body = IR_NewBlock("%while_body_" + to_string(while_num));
+        int label_cond = IR_NewBlock("%while_cond_" + to_string(while_num));
+        int label_end = IR_NewBlock("%while_end_" + to_string(while_num));
+        while_num++;
+        KValue while_result = DumpIR((ExpAST *)(stmt->exp_simple.get()));
+        IR_Branch(while_result, label_body, label_end);
+        IR_SetBlock(label_body);
+        loop_labels.push_back(make_pair(label_cond, label_end));
+        loop_continued.push_back(0);
+        DumpIR((StmtAST *)(stmt->while_stmt.get()));
+        bool continued = loop_continued.back();
+        loop_labels.pop_back();
+        loop_continued.pop_back();
+        if (continued)
+        {
+            IR_Jump(label_cond);
+            IR_SetBlock(label_cond);
+        }
+        while_result = DumpIR((ExpAST *)(stmt->exp_simple.get()));
+        IR_Branch(while_result, label_body, label_end);
+        IR_SetBlock(label_end);
     }
     else
         assert(false);
 }
 
-static string DumpIR(const ExpAST *exp)
+// 运算符到 KIR 二元指令, 只有直接对应一条指令的运算符有意义
+static int ExpOpToKB(ExpOp op)
 {
-    string result_var = DumpIR((LOrExpAST *)(exp->lor_exp.get()));
-    return result_var;
+    switch (op)
+    {
+    case EXP_MUL: return KB_MUL;
+    case EXP_DIV: return KB_DIV;
+    case EXP_MOD: return KB_MOD;
+    case EXP_ADD: return KB_ADD;
+    case EXP_SUB: return KB_SUB;
+    case EXP_LT: return KB_LT;
+    case EXP_GT: return KB_GT;
+    case EXP_LE: return KB_LE;
+    case EXP_GE: return KB_GE;
+    case EXP_EQ: return KB_EQ;
+    case EXP_NE: return KB_NE;
+    default: assert(false);
+    }
+    return -1;
 }
 
-static string DumpIR(const UnaryExpAST *unary_exp)
+// 编译时能求值的表达式: 只由数字, 常量和常量数组里下标不越界的元素组成.
+// 除数为 0 和 INT_MIN / -1 不算, 留到运行时按目标机器的语义算
+static bool IsConstExp(const ExpAST *exp)
 {
-    if (unary_exp->type == "primary")
+    switch (exp->op)
     {
-        string result_var = DumpIR((PrimaryExpAST *)(unary_exp->exp.get()));
-        return result_var;
-    }
-    else if (unary_exp->type == "unary")
+    case EXP_NUMBER:
+        return true;
+    case EXP_LVAL:
     {
-        string result_var = DumpIR((UnaryExpAST *)(unary_exp->exp.get()));
-        string next_var = "%" + to_string(symbol_num);
-
-        if (unary_exp->op[0] == '+')
-            return result_var;
-        else if (unary_exp->op[0] == '-')
-            cout << "  " << next_var << " = sub 0, " << result_var << "\n";
-        else if (unary_exp->op[0] == '!')
-            cout << "  " << next_var << " = eq " << result_var << ", 0" << "\n";
-        else
-            assert(false);
-        symbol_num++;
-        return next_var;
+        auto l_val = (LValAST *)exp;
+        Symbol &symbol = look_up_symbol_tables(l_val->l_val);
+        if (!symbol.is_const || l_val->indices.size() != symbol.dims.size())
+            return false;
+        for (size_t i = 0; i < symbol.dims.size(); ++i)
+            if (!IsConstExp(l_val->indices[i].get()))
+                return false;
+        for (size_t i = 0; i < symbol.dims.size(); ++i)
+        {
+            int index = DumpEXP(l_val->indices[i].get());
+            if (index < 0 || index >= symbol.dims[i])
+                return false;
+        }
+        return true;
     }
-    else
+    case EXP_CALL:
+        return false;
+    case EXP_NEG:
+    case EXP_NOT:
+        return IsConstExp(((UnaryExpAST *)exp)->exp.get());
+    default:
     {
-        assert(false);
+        auto binary_exp = (BinaryExpAST *)exp;
+        if (!IsConstExp(binary_exp->lhs.get()) || !IsConstExp(binary_exp->rhs.get()))
+            return false;
+        if (binary_exp->op != EXP_DIV && binary_exp->op != EXP_MOD)
+            return true;
+        int right_result = DumpEXP(binary_exp->rhs.get());
+        return right_result != 0 && !(right_result == -1 && DumpEXP(binary_exp->lhs.get()) == INT_MIN);
+    }
     }
-    return "";
 }
 
-static string DumpIR(const PrimaryExpAST *primary_exp)
+// 数组 (或标量) 的基地址. 局部常量数组第一次按地址访问时才放进 .rodata
+static KValue SymbolAddr(Symbol &symbol)
 {
-    string result_var = "";
-    if (primary_exp->type == "exp")
-        result_var = DumpIR((ExpAST *)(primary_exp->exp.get()));
-    else if (primary_exp->type == "number")
-        result_var = to_string(primary_exp->number);
-    else if (primary_exp->type == "lval")
+    if (symbol.addr.kind == KV_NONE && !symbol.rodata_name.empty())
     {
-        variant<int, string> value = look_up_symbol_tables(primary_exp->l_val);
-        if (value.index() == 0) // const_var
-            result_var = to_string(get<0>(value));
-        else
-        { // var
-            result_var = "%" + to_string(symbol_num);
-            ++symbol_num;
-            cout << "  " << result_var << " = load " << get<1>(value) << "\n";
-        }
+        KGlobalVar global;
+        global.name = symbol.rodata_name;
+        global.type.dims = symbol.dims;
+        global.is_const = true;
+        if (any_of(symbol.values->begin(), symbol.values->end(), [](int v) { return v != 0; }))
+            global.init = *symbol.values;
+        ir_globals.push_back(global);
+        symbol.addr = KGlobalRef(symbol.rodata_name);
     }
-    else
-        assert(false);
-
-    return result_var;
+    return symbol.addr;
 }
 
-static string DumpIR(const MulExpAST *mul_exp)
+// l_val 的地址. 下标比维数少时是子数组首元素的地址 (当实参传给数组形参), rest 是剩下的维数
+static KValue DumpAddr(const LValAST *l_val, Symbol &symbol, size_t &rest)
 {
-    string result_var = "";
-    if (mul_exp->op == "")
-        result_var = DumpIR((UnaryExpAST *)(mul_exp->unary_exp.get()));
-    else
+    size_t levels = symbol.dims.size() + symbol.is_ptr;
+    size_t count = l_val->indices.size();
+    if (count > levels)
+    {
+        cerr << "error: too many indices for " << l_val->l_val << endl;
+        exit(1);
+    }
+    KValue ptr = SymbolAddr(symbol);
+    for (size_t i = 0; i < count; ++i)
     {
-    string left_result = DumpIR((MulExpAST *)(mul_exp->mul_exp.get()));
-    string right_result = DumpIR((UnaryExpAST *)(mul_exp->unary_exp.get()));
-    result_var = "%" + to_string(symbol_num++);
-        if (mul_exp->op[0] == '*')
-            cout << "  " << result_var << " = mul " << left_result << ", " << right_result << "\n";
-        else if (mul_exp->op[0] == '/')
-            cout << "  " << result_var << " = div " << left_result << ", " << right_result << "\n";
-        else if (mul_exp->op[0] == '%')
-            cout << "  " << result_var << " = mod " << left_result << ", " << right_result << "\n";
+        KValue index = DumpIR(l_val->indices[i].get());
+        if (symbol.is_ptr && i == 0)
+            ptr = IR_Ptr(KI_GETPTR, ptr, index, 4 * KIR_Words(symbol.dims));
         else
-            assert(false);
+            ptr = IR_Ptr(KI_GETELEMPTR, ptr, index, 4 * KIR_Words(symbol.dims, i + 1 - symbol.is_ptr));
     }
-
-    return result_var;
+    rest = levels - count;
+    if (rest > 0 && !(symbol.is_ptr && count == 0))
+        ptr = IR_Ptr(KI_GETELEMPTR, ptr, KImm(0), 4 * KIR_Words(symbol.dims, symbol.dims.size() - rest + 1));
+    return ptr;
 }
 
-static string DumpIR(const AddExpAST *add_exp)
+static KValue DumpIR(const ExpAST *exp)
 {
-    string result_var = "";
-    if (add_exp->op == "")
-        result_var = DumpIR((MulExpAST *)(add_exp->mul_exp.get()));
-    else
+    switch (exp->op)
     {
-    string left_result = DumpIR((AddExpAST *)(add_exp->add_exp.get()));
-    string right_result = DumpIR((MulExpAST *)(add_exp->mul_exp.get()));
-    result_var = "%" + to_string(symbol_num++);
-        if (add_exp->op[0] == '+')
-            cout << "  " << result_var << " = add " << left_result << ", " << right_result << "\n";
-        else if (add_exp->op[0] == '-')
-            cout << "  " << result_var << " = sub " << left_result << ", " << right_result << "\n";
-     else
-        assert(false);
+    case EXP_NUMBER:
+        return KImm(((NumberAST *)exp)->number);
+    case EXP_LVAL:
+    {
+        auto l_val = (LValAST *)exp;
+        Symbol &symbol = look_up_symbol_tables(l_val->l_val);
+        if (symbol.is_const && symbol.dims.empty())
+            return KImm(symbol.value);
+        if (symbol.is_const && IsConstExp(exp))
+            return KImm(DumpEXP(exp));
+        size_t rest;
+        KValue addr = DumpAddr(l_val, symbol, rest);
+        return rest == 0 ? IR_Load(addr) : addr;
+    }
+    case EXP_CALL:
+        return DumpIR((CallExpAST *)exp);
+    case EXP_NEG:
+        return IR_Binary(KB_SUB, KImm(0), DumpIR(((UnaryExpAST *)exp)->exp.get()));
+    case EXP_NOT:
+        return IR_Binary(KB_EQ, DumpIR(((UnaryExpAST *)exp)->exp.get()), KImm(0));
+    default:
+        return DumpIR((BinaryExpAST *)exp);
     }
-
-    return result_var;
 }
 
-static string DumpIR(const RelExpAST *rel_exp)
+static KValue DumpIR(const CallExpAST *call_exp)
 {
-    string result_var = "";
-    if (rel_exp->op == "")
-        result_var = DumpIR((AddExpAST *)(rel_exp->add_exp.get()));
-    else
+    assert(func_ret_int.count(call_exp->ident));
+    vector<KValue> args;
+    int size = call_exp->func_r_param_list.size();
+    for (int i = 0; i < size; ++i)
+        args.push_back(DumpIR((ExpAST *)(call_exp->func_r_param_list[i].get())));
+    KInst &call = IR_Append(KI_CALL);
+    call.callee = "@" + call_exp->ident;
+    call.args = move(args);
+    if (func_ret_int[call_exp->ident])
     {
-        string left_result = DumpIR((RelExpAST *)(rel_exp->rel_exp.get()));
-        string right_result = DumpIR((AddExpAST *)(rel_exp->add_exp.get()));
-        result_var = "%" + to_string(symbol_num++);
-        if (rel_exp->op == "<")
-            cout << "  " << result_var << " = lt " << left_result << ", " << right_result << "\n";
-        else if (rel_exp->op == ">")
-            cout << "  " << result_var << " = gt " << left_result << ", " << right_result << "\n";
-        else if (rel_exp->op == "<=")
-            cout << "  " << result_var << " = le " << left_result << ", " << right_result << "\n";
-        else if (rel_exp->op == ">=")
-            cout << "  " << result_var << " = ge " << left_result << ", " << right_result << "\n";
-        else
-            assert(false);
+        call.dest = KIR_NewTemp(*ir_func);
+        return KTemp(call.dest);
     }
-
-    return result_var;
+    return KNone();
 }
 
-static string DumpIR(const EqExpAST *eq_exp)
+static KValue DumpIR(const BinaryExpAST *binary_exp)
 {
-    string result_var = "";
-    if (eq_exp->op == "")
-        result_var = DumpIR((RelExpAST *)(eq_exp->rel_exp.get()));
-    else
+    KValue left_result = DumpIR(binary_exp->lhs.get());
+    if (binary_exp->op != EXP_AND && binary_exp->op != EXP_OR)
     {
-        string left_result = DumpIR((EqExpAST *)(eq_exp->eq_exp.get()));
-        string right_result = DumpIR((RelExpAST *)(eq_exp->rel_exp.get()));
-        result_var = "%" + to_string(symbol_num);
-        ++symbol_num;
-        if (eq_exp->op == "==")
-            cout << "  " << result_var << " = eq " << left_result << ", " << right_result << "\n";
-        else if (eq_exp->op == "!=")
-            cout << "  " << result_var << " = ne " << left_result << ", " << right_result << "\n";
-        else
-            assert(false);
-    }
-
-    return result_var;
-}
-
-static string DumpIR(const LAndExpAST *land_exp)
-{
-    string result_var = "";
-    if (land_exp->op == "")
-        result_var = DumpIR((EqExpAST *)(land_exp->eq_exp.get()));
-    else if (land_exp->op == "&&")
-{
-        string left_result = DumpIR((LAndExpAST *)(land_exp->land_exp.get()));
-        string label_then = "\%then_" + to_string(if_else_num);
-        string label_else = "\%else_" + to_string(if_else_num);
-        string label_end = "\%end_" + to_string(if_else_num);
-        ++if_else_num;
-
-        string result_var_ptr = "%" + to_string(symbol_num);
-        ++symbol_num;
-        string temp_result_var = "%" + to_string(symbol_num);
-        ++symbol_num;
-        string right_result = DumpIR((EqExpAST *)(land_exp->eq_exp.get()));
-        cout << "  " << result_var_ptr << " = alloc i32" << "\n";
-        cout << "  " << "br " << left_result << ", " << label_then << ", " << label_else << "\n";
-        cout << label_then << ":" << "\n";
-        cout << "  " << temp_result_var << " = ne " << right_result << ", 0" << "\n";
-        cout << "  " << "store " << temp_result_var << ", " << result_var_ptr << "\n";
-        cout << "  " << "jump " << label_end << "\n";
-        cout << label_else << ":" << "\n";
-        cout << "  " << "store 0, " << result_var_ptr << "\n";
-        cout << "  " << "jump " << label_end << "\n";
-        cout << label_end << ":" << "\n";
-        result_var = "%" + to_string(symbol_num++);
-        cout << "  " << result_var << " = load " << result_var_ptr << "\n";
+        KValue right_result = DumpIR(binary_exp->rhs.get());
+        return IR_Binary(ExpOpToKB(binary_exp->op), left_result, right_result);
     }
-    else
-        assert(false);
 
-    return result_var;
-}
-
-static string DumpIR(const LOrExpAST *lor_exp)
-{
-    string result_var = "";
-    if (lor_exp->op == "")
-        result_var = DumpIR((LAndExpAST *)(lor_exp->land_exp.get()));
-    else if (lor_exp->op == "||")
-    {
-        string left_result = DumpIR((LOrExpAST *)(lor_exp->lor_exp.get()));
-        string label_then = "\%then_" + to_string(if_else_num);
-        string label_else = "\%else_" + to_string(if_else_num);
-        string label_end = "\%end_" + to_string(if_else_num);
-        ++if_else_num;
-
-        string result_var_ptr = "\%" + to_string(symbol_num);
-        ++symbol_num;
-        cout << "  " << result_var_ptr << " = alloc i32" << "\n";
-        cout << "  " << "br " << left_result << ", " << label_then << ", " << label_else << "\n";
-        cout << label_then << ":" << "\n";
-        cout << "  " << "store 1, " << result_var_ptr << "\n";
-        cout << "  " << "jump " << label_end << "\n";
-        cout << label_else << ":" << "\n";
-        string temp_result_var = "%" + to_string(symbol_num++);
-        string right_result = DumpIR((LAndExpAST *)(lor_exp->land_exp.get()));
-        cout << "  " << temp_result_var << " = ne " << right_result << ", 0" << "\n";
-        cout << "  " << "store " << temp_result_var << ", " << result_var_ptr << "\n";
-        cout << "  " << "jump " << label_end << "\n";
-        cout << label_end << ":" << "\n";
-        result_var = "%" + to_string(symbol_num++);
-        cout << "  " << result_var << " = load " << result_var_ptr << "\n";
-    }
+    // 短路求值: 右边可能有函数调用, && 只在左边为真时求值, || 只在左边为假时求值
+    bool is_and = binary_exp->op == EXP_AND;
+    int label_then = IR_NewBlock("%then_" + to_string(if_else_num));
+    int label_else = IR_NewBlock("%else_" + to_string(if_else_num));
+    int label_end = IR_NewBlock("%end_" + to_string(if_else_num));
+    ++if_else_num;
+
+    KValue result_var_ptr = IR_Alloc();
+    IR_Branch(left_result, label_then, label_else);
+    IR_SetBlock(label_then);
+    if (is_and)
+        IR_Store(IR_Binary(KB_NE, DumpIR(binary_exp->rhs.get()), KImm(0)), result_var_ptr);
     else
-        assert(false);
-
-    return result_var;
+        IR_Store(KImm(1), result_var_ptr);
+    IR_Jump(label_end);
+    IR_SetBlock(label_else);
+    if (is_and)
+        IR_Store(KImm(0), result_var_ptr);
+    else
+        IR_Store(IR_Binary(KB_NE, DumpIR(binary_exp->rhs.get()), KImm(0)), result_var_ptr);
+    IR_Jump(label_end);
+    IR_SetBlock(label_end);
+    return IR_Load(result_var_ptr);
 }
 
 static int DumpEXP(const ExpAST *exp)
 {
-    int result = DumpEXP((LOrExpAST *)(exp->lor_exp.get()));
-    return result;
-}
-
-static int DumpEXP(const UnaryExpAST *unary_exp)
-{
-    int result = 0;
-    if (unary_exp->type == "primary")
-        result = DumpEXP((PrimaryExpAST *)(unary_exp->exp.get()));
-    else if (unary_exp->type == "unary")
+    switch (exp->op)
     {
-        int temp = DumpEXP((UnaryExpAST *)(unary_exp->exp.get()));
-
-            if (unary_exp->op[0]=='+')
-                result = temp;
-            else if (unary_exp->op[0]=='-')
-                result = -temp;
-            else if (unary_exp->op[0]=='!')
-                result = !temp;
-            else
-                assert(false);
-
+    case EXP_NUMBER:
+        return ((NumberAST *)exp)->number;
+    case EXP_LVAL:
+    {
+        auto l_val = (LValAST *)exp;
+        Symbol &symbol = look_up_symbol_tables(l_val->l_val);
+        if (!symbol.is_const || l_val->indices.size() != symbol.dims.size())
+        {
+            cerr << "error: " << l_val->l_val << " is not a constant" << endl;
+            exit(1);
+        }
+        if (symbol.dims.empty())
+            return symbol.value;
+        int pos = 0;
+        for (size_t i = 0; i < symbol.dims.size(); ++i)
+        {
+            int index = DumpEXP(l_val->indices[i].get());
+            if (index < 0 || index >= symbol.dims[i])
+            {
+                cerr << "error: index out of range for " << l_val->l_val << endl;
+                exit(1);
+            }
+            pos = pos * symbol.dims[i] + index;
+        }
+        return (*symbol.values)[pos];
     }
-    else
+    case EXP_NEG:
+        return (int)(0u - (unsigned)DumpEXP(((UnaryExpAST *)exp)->exp.get()));
+    case EXP_NOT:
+        return !DumpEXP(((UnaryExpAST *)exp)->exp.get());
+    case EXP_CALL:
         assert(false);
+        return 0;
+    default:
+        break;
+    }
 
-    return result;
+    auto binary_exp = (BinaryExpAST *)exp;
+    int left_result = DumpEXP(binary_exp->lhs.get());
+    if (binary_exp->op == EXP_AND && left_result == 0)
+        return 0;
+    if (binary_exp->op == EXP_OR && left_result != 0)
+        return 1;
+    int right_result = DumpEXP(binary_exp->rhs.get());
+    // 加减乘按 32 位回绕, 和运行时一样; 常量声明里的除零没法留到运行时, 只能报错
+    unsigned left_bits = left_result, right_bits = right_result;
+    if ((binary_exp->op == EXP_DIV || binary_exp->op == EXP_MOD) &&
+        (right_result == 0 || (left_result == INT_MIN && right_result == -1)))
+    {
+        cerr << "error: division overflow in constant expression" << endl;
+        exit(1);
+    }
+    switch (binary_exp->op)
+    {
+    case EXP_MUL: return (int)(left_bits * right_bits);
+    case EXP_DIV: return left_result / right_result;
+    case EXP_MOD: return left_result % right_result;
+    case EXP_ADD: return (int)(left_bits + right_bits);
+    case EXP_SUB: return (int)(left_bits - right_bits);
+    case EXP_LT: return left_result < right_result;
+    case EXP_GT: return left_result > right_result;
+    case EXP_LE: return left_result <= right_result;
+    case EXP_GE: return left_result >= right_result;
+    case EXP_EQ: return left_result == right_result;
+    case EXP_NE: return left_result != right_result;
+    case EXP_AND:
+    case EXP_OR: return right_result != 0;
+    default: assert(false);
+    }
+    return 0;
 }
 
-static int DumpEXP(const PrimaryExpAST *primary_exp)
+static void DumpIR(const DeclAST *decl)
 {
-    int result = 0;
-    if (primary_exp->type == "exp")
-        result = DumpEXP((ExpAST *)(primary_exp->exp.get()));
-    else if (primary_exp->type == "number")
-        result = primary_exp->number;
-    else if (primary_exp->type == "lval")
-    {
-        variant<int, string> value = look_up_symbol_tables(primary_exp->l_val);
-        assert(value.index() == 0);
-        result = get<0>(value);
-    }
+    if (decl->type == "const_decl")
+        DumpIR((ConstDeclAST *)(decl->decl.get()));
+    else if (decl->type == "var_decl")
+        DumpIR((VarDeclAST *)(decl->decl.get()));
     else
         assert(false);
-
-    return result;
 }
 
-static int DumpEXP(const MulExpAST *mul_exp)
+static void DumpIR(const BlockItemAST *block_item)
 {
-    int result = 0;
-    if (mul_exp->op == "")
-        result = DumpEXP((UnaryExpAST *)(mul_exp->unary_exp.get()));
+    if (block_item->type == "decl")
+        DumpIR((DeclAST *)(block_item->content.get()));
+    else if (block_item->type == "stmt")
+        DumpIR((StmtAST *)(block_item->content.get()));
     else
-    {
-    int left_result = DumpEXP((MulExpAST *)(mul_exp->mul_exp.get()));
-    int right_result = DumpEXP((UnaryExpAST *)(mul_exp->unary_exp.get()));
-        if(mul_exp->op[0] == '*')
-            result = left_result * right_result;
-        else if(mul_exp->op[0] == '/')
-            result = left_result / right_result;
-        else if(mul_exp->op[0] == '%')
-            result = left_result % right_result;
-        else
-            assert(false);
-    }
-
-    return result;
+        assert(false);
 }
 
-static int DumpEXP(const AddExpAST *add_exp)
+static void DumpIR(const ConstDeclAST *const_decl)
 {
-    int result = 0;
-    if (add_exp->op == "")
-        result = DumpEXP((MulExpAST *)(add_exp->mul_exp.get()));
-    else
-    {
-    int left_result = DumpEXP((AddExpAST *)(add_exp->add_exp.get()));
-    int right_result = DumpEXP((MulExpAST *)(add_exp->mul_exp.get()));
-        if(add_exp->op[0] == '+')
-            result = left_result + right_result;
-        else if(add_exp->op[0] == '-')
-            result = left_result - right_result;
-        else
-            assert(false);
-    }
-
-    return result;
+    assert(const_decl->b_type == "int"); // Only support int at present
+    int size = const_decl->const_def_list.size();
+    for (int i = 0; i < size; ++i)
+        DumpIR((ConstDefAST *)(const_decl->const_def_list[i].get()));
 }
 
-static int DumpEXP(const RelExpAST *rel_exp)
+// 初值里的一个元素
+static const ExpAST *InitLeaf(const ConstInitValAST *init)
 {
-    int result = 0;
-    if (rel_exp->op == "")
-        result = DumpEXP((AddExpAST *)(rel_exp->add_exp.get()));
-    else
-    {
-        int left_result = DumpEXP((RelExpAST *)(rel_exp->rel_exp.get()));
-        int right_result = DumpEXP((AddExpAST *)(rel_exp->add_exp.get()));
-        if (rel_exp->op == ">")
-            result = (bool)(left_result > right_result);
-        else if (rel_exp->op == ">=")
-            result = (bool)(left_result >= right_result);
-        else if (rel_exp->op == "<")
-            result = (bool)(left_result < right_result);
-        else if (rel_exp->op == "<=")
-            result = (bool)(left_result <= right_result);
-        else
-            assert(false);
-    }
-
-    return result;
+    return (ExpAST *)(((ConstExpAST *)(init->const_exp.get()))->exp.get());
 }
 
-static int DumpEXP(const EqExpAST *eq_exp)
+static const ExpAST *InitLeaf(const InitValAST *init)
 {
-    int result = 0;
-    if (eq_exp->op == "")
-        result = DumpEXP((RelExpAST *)(eq_exp->rel_exp.get()));
-    else
-    {
-        int left_result = DumpEXP((EqExpAST *)(eq_exp->eq_exp.get()));
-        int right_result = DumpEXP((RelExpAST *)(eq_exp->rel_exp.get()));
-        if (eq_exp->op == "==")
-            result = (bool)(left_result == right_result);
-        else if (eq_exp->op == "!=")
-            result = (bool)(left_result != right_result);
-        else
-            assert(false);
-    }
-
-    return result;
+    return (ExpAST *)(init->exp.get());
 }
 
-static int DumpEXP(const LAndExpAST *land_exp)
+// 按 SysY 的规则把初始化列表展开到 out[begin..], 覆盖 dims[level..]; 没写到的元素留着 nullptr (零).
+// 嵌套的 {} 对应能从当前位置开始对齐的最大一层子数组
+template <typename InitVal>
+static void FlattenInit(const InitVal *init, const vector<int> &dims, size_t level, size_t begin,
+                        vector<const ExpAST *> &out)
 {
-    int result = 0;
-    if (land_exp->op == "")
-        result = DumpEXP((EqExpAST *)(land_exp->eq_exp.get()));
-    else if (land_exp->op == "&&")
+    size_t end = begin + KIR_Words(dims, level), pos = begin;
+    for (auto &item : init->list)
     {
-        int left_result = DumpEXP((LAndExpAST *)(land_exp->land_exp.get()));
-        if (left_result == 0)
-            return 0;
-        result = (DumpEXP((EqExpAST *)(land_exp->eq_exp.get())) != 0);
+        auto sub = (const InitVal *)item.get();
+        if (pos >= end)
+        {
+            cerr << "error: too many initializers" << endl;
+            exit(1);
+        }
+        if (!sub->is_list)
+        {
+            out[pos++] = InitLeaf(sub);
+            continue;
+        }
+        size_t next = level + 1;
+        while (next < dims.size() && (pos - begin) % KIR_Words(dims, next) != 0)
+            ++next;
+        if (next == dims.size())
+        {
+            cerr << "error: misaligned initializer list" << endl;
+            exit(1);
+        }
+        FlattenInit(sub, dims, next, pos, out);
+        pos += KIR_Words(dims, next);
     }
-    else
-        assert(false);
-
-    return result;
 }
 
-static int DumpEXP(const LOrExpAST *lor_exp)
+template <typename InitVal>
+static vector<const ExpAST *> FlattenInit(const InitVal *init, const vector<int> &dims)
 {
-    int result = 1;
-    if (lor_exp->op == "")
-        result = DumpEXP((LAndExpAST *)(lor_exp->land_exp.get()));
-    else if (lor_exp->op == "||")
+    vector<const ExpAST *> out(KIR_Words(dims), nullptr);
+    if (dims.empty() || !init->is_list)
     {
-        int left_result = DumpEXP((LOrExpAST *)(lor_exp->lor_exp.get()));
-        if (left_result)
-            return 1;
-        result = (DumpEXP((LAndExpAST *)(lor_exp->land_exp.get())) != 0);
+        if (!dims.empty() || init->is_list)
+        {
+            cerr << "error: initializer does not match the type" << endl;
+            exit(1);
+        }
+        out[0] = InitLeaf(init);
     }
     else
-        assert(false);
+        FlattenInit(init, dims, 0, 0, out);
+    return out;
+}
 
-    return result;
+// 全部是常量表达式的初值, 折叠成一维数组
+static vector<int> FoldInit(const vector<const ExpAST *> &exps)
+{
+    vector<int> values(exps.size(), 0);
+    for (size_t i = 0; i < exps.size(); ++i)
+        if (exps[i] != nullptr)
+            values[i] = DumpEXP(exps[i]);
+    return values;
 }
 
-static void DumpIR(const DeclAST *decl)
+// 全局变量的签名, 变了用到它的函数才要重新编译 (常量数组的值会被折叠进函数里, 所以要算上).
+// 它也是合法的 Koopa, 流式模式下直接当声明放在用到它的函数前面
+static string GlobalSignature(const KGlobalVar &global, const Symbol &symbol)
 {
-    if (decl->type == "const_decl")
-        DumpIR((ConstDeclAST *)(decl->decl.get()));
-    else if (decl->type == "var_decl")
-        DumpIR((VarDeclAST *)(decl->decl.get()));
-    else
-        assert(false);
+    stringstream sig;
+    sig << "global " << global.name << " = alloc " << KIR_TypeName(global.type) << ", zeroinit";
+    if (symbol.is_const)
+        sig << " // const " << hex << HashString(string((const char *)global.init.data(), global.init.size() * sizeof(int)));
+    return sig.str();
 }
 
-static void DumpIR(const BlockItemAST *block_item)
+// 全局变量: 初值都是常量表达式, 折叠好交给后端, 放进 .data / .bss / .rodata
+static void DumpGlobal(const string &ident, Symbol &symbol, const vector<int> &values)
 {
-    if (block_item->type == "decl")
-        DumpIR((DeclAST *)(block_item->content.get()));
-    else if (block_item->type == "stmt")
-        DumpIR((StmtAST *)(block_item->content.get()));
-    else
-        assert(false);
+    KGlobalVar global;
+    global.name = "@" + ident;
+    global.type.dims = symbol.dims;
+    global.is_const = symbol.is_const;
+    if (any_of(values.begin(), values.end(), [](int v) { return v != 0; }))
+        global.init = values;
+    ir_globals.push_back(global);
+    ir_global_sigs.push_back({global.name, GlobalSignature(global, symbol)});
+    symbol.addr = KGlobalRef(global.name);
 }
 
-static void DumpIR(const ConstDeclAST *const_decl)
+// for (i = 0; i < n; ++i) body(i), n > 0. 和 while 一样生成成 do-while 的形状
+static void IR_CountedLoop(int n, const function<void(KValue)> &body)
 {
-    assert(const_decl->b_type == "int"); // Only support int at present
-    int size = const_decl->const_def_list.size();
-    for (int i = 0; i < size; ++i)
-        DumpIR((ConstDefAST *)(const_decl->const_def_list[i].get()));
+    string var_name = "@init_i";
+    KValue var = IR_Alloc(var_name + "_" + to_string(var_names[var_name]++));
+    IR_Store(KImm(0), var);
+    int label_body = IR_NewBlock("%init_body_" + to_string(while_num));
+    int label_end = IR_NewBlock("%init_end_" + to_string(while_num));
+    while_num++;
+    IR_Jump(label_body);
+    IR_SetBlock(label_body);
+    KValue i = IR_Load(var);
+    body(i);
+    KValue next = IR_Binary(KB_ADD, i, KImm(1));
+    IR_Store(next, var);
+    IR_Branch(IR_Binary(KB_LT, next, KImm(n)), label_body, label_end);
+    IR_SetBlock(label_end);
 }
 
-static void DumpIR(const ConstDefAST *const_def)
+// 局部数组的初始化. 小数组逐个元素 store; 大数组先用循环清零再写非零元素,
+// 非零的常量元素很多时改成从 .rodata 里的模板循环复制
+static void DumpArrayInit(KValue array, const string &name, const vector<int> &dims, const vector<const ExpAST *> &exps)
 {
-    int i = symbol_tables.size() - 1;
-    symbol_tables[i][const_def->ident] = DumpIR((ConstInitValAST *)(const_def->const_init_val.get()));
+    const int max_unrolled = 16;
+    int n = exps.size();
+    KValue base = array; // 第一个元素的地址 (*i32)
+    for (size_t i = 0; i < dims.size(); ++i)
+        base = IR_Ptr(KI_GETELEMPTR, base, KImm(0), 4 * KIR_Words(dims, i + 1));
+    auto element = [&](KValue index) { return IR_Ptr(KI_GETPTR, base, index, 4); };
+    if (n <= max_unrolled)
+    {
+        for (int i = 0; i < n; ++i)
+            IR_Store(exps[i] != nullptr ? DumpIR(exps[i]) : KImm(0), element(KImm(i)));
+        return;
+    }
+
+    bool all_const = true;
+    int nonzero = 0;
+    for (auto exp : exps)
+        if (exp != nullptr)
+        {
+            all_const = all_const && IsConstExp(exp);
+            nonzero += !IsConstExp(exp) || DumpEXP(exp) != 0;
+        }
+    if (all_const && nonzero > max_unrolled)
+    {
+        KGlobalVar init;
+        string init_name = "@__init_" + ir_func->name.substr(1) + "_" + name;
+        init.name = init_name + "_" + to_string(var_names[init_name]++);
+        init.type.dims = {n};
+        init.init = FoldInit(exps);
+        init.is_const = true;
+        ir_globals.push_back(init);
+        KValue src = IR_Ptr(KI_GETELEMPTR, KGlobalRef(init.name), KImm(0), 4);
+        IR_CountedLoop(n, [&](KValue i) { IR_Store(IR_Load(IR_Ptr(KI_GETPTR, src, i, 4)), element(i)); });
+        return;
+    }
+    IR_CountedLoop(n, [&](KValue i) { IR_Store(KImm(0), element(i)); });
+    for (int i = 0; i < n; ++i)
+        if (exps[i] != nullptr && !(IsConstExp(exps[i]) && DumpEXP(exps[i]) == 0))
+            IR_Store(DumpIR(exps[i]), element(KImm(i)));
 }
 
-int DumpIR(const ConstInitValAST *const_init_val)
+static void DumpIR(const ConstDefAST *const_def)
 {
-    return DumpEXP((ConstExpAST *)(const_init_val->const_exp.get()));
+    Symbol symbol;
+    symbol.is_const = true;
+    symbol.dims = DumpDims(const_def->dims);
+    vector<int> values = FoldInit(FlattenInit((ConstInitValAST *)(const_def->const_init_val.get()), symbol.dims));
+    if (symbol.dims.empty())
+    {
+        symbol.value = values[0];
+        if (symbol_tables.size() == 1)
+            ir_global_sigs.push_back({"@" + const_def->ident, "const @" + const_def->ident + " = " + to_string(symbol.value)});
+    }
+    else
+    {
+        symbol.values = make_shared<const vector<int> >(values);
+        if (symbol_tables.size() == 1)
+            DumpGlobal(const_def->ident, symbol, values);
+        else
+        {
+            string rodata_name = "@__const_" + ir_func->name.substr(1) + "_" + const_def->ident;
+            symbol.rodata_name = rodata_name + "_" + to_string(var_names[rodata_name]++);
+        }
+    }
+    symbol_tables.back()[const_def->ident] = symbol;
 }
 
 static int DumpEXP(const ConstExpAST *const_exp)
@@ -814,19 +1149,33 @@ static void DumpIR(const VarDeclAST *var_decl)
 
 static void DumpIR(const VarDefAST *var_def)
 {
-    string var_name = "@" + var_def->ident;
-    string name = var_name + "_" + to_string(var_names[var_name]++);
-    cout << "  " << name << " = alloc i32" << "\n";
-    int i = symbol_tables.size() - 1;
-    symbol_tables[i][var_def->ident] = name;
+    Symbol symbol;
+    symbol.dims = DumpDims(var_def->dims);
+    vector<const ExpAST *> exps;
     if (var_def->has_init_val)
+        exps = FlattenInit((InitValAST *)(var_def->init_val.get()), symbol.dims);
+    if (symbol_tables.size() == 1)
     {
-        string value = DumpIR((InitValAST *)(var_def->init_val.get()));
-        cout << "  store " << value << ", " << name << "\n";
+        for (auto exp : exps)
+            if (exp != nullptr && !IsConstExp(exp))
+            {
+                cerr << "error: initializer of global " << var_def->ident << " is not constant" << endl;
+                exit(1);
+            }
+        DumpGlobal(var_def->ident, symbol, exps.empty() ? vector<int>() : FoldInit(exps));
+        symbol_tables.back()[var_def->ident] = symbol;
+        return;
     }
-}
 
-static string DumpIR(const InitValAST *init_val)
-{
-    return DumpIR((ExpAST *)(init_val->exp.get()));
+    string var_name = "@" + var_def->ident;
+    KType type;
+    type.dims = symbol.dims;
+    symbol.addr = IR_Alloc(var_name + "_" + to_string(var_names[var_name]++), type);
+    symbol_tables.back()[var_def->ident] = symbol;
+    if (!var_def->has_init_val)
+        return;
+    if (symbol.dims.empty())
+        IR_Store(DumpIR(exps[0]), symbol.addr);
+    else
+        DumpArrayInit(symbol.addr, var_def->ident, symbol.dims, exps);
 }
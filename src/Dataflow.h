@@ -0,0 +1,317 @@
+#pragma once
+
+// 后端用的数据流分析框架. 值和基本块先编成从 0 开始的稠密下标, 集合都是按 64 位字
+// 排好的位向量, 并/交/差是对整段字数组的无分支循环, 编译器可以直接向量化.
+// DF_Solve 是通用的工作表求解器, 下面的活跃变量只是给它准备 gen/kill.
+// RISCV.h 按活跃变量分配寄存器, Opt.h 的死 store 删除也用它; 支配者和循环深度用 KIR.h 的.
+// -bench-dataflow 会对每个函数跑一遍并报告规模和耗时
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "KIR.h"
+
+using namespace std;
+
+struct DFBits
+{
+    vector<uint64_t> words;
+
+    DFBits(size_t bits = 0) : words((bits + 63) / 64, 0) {}
+
+    void Set(size_t i) { words[i / 64] |= uint64_t(1) << (i % 64); }
+    void Reset(size_t i) { words[i / 64] &= ~(uint64_t(1) << (i % 64)); }
+    bool Test(size_t i) const { return words[i / 64] >> (i % 64) & 1; }
+
+    // 前 bits 位全置 1, 后面补的位保持 0
+    void Fill(size_t bits)
+    {
+        for (size_t w = 0; w < words.size(); ++w)
+            words[w] = ~uint64_t(0);
+        if (bits % 64 != 0)
+            words.back() = (uint64_t(1) << (bits % 64)) - 1;
+    }
+
+    // 下面几个返回集合有没有变
+    bool UnionWith(const DFBits &other)
+    {
+        uint64_t changed = 0;
+        for (size_t w = 0; w < words.size(); ++w)
+        {
+            uint64_t next = words[w] | other.words[w];
+            changed |= next ^ words[w];
+            words[w] = next;
+        }
+        return changed != 0;
+    }
+
+    bool IntersectWith(const DFBits &other)
+    {
+        uint64_t changed = 0;
+        for (size_t w = 0; w < words.size(); ++w)
+        {
+            uint64_t next = words[w] & other.words[w];
+            changed |= next ^ words[w];
+            words[w] = next;
+        }
+        return changed != 0;
+    }
+
+    void Subtract(const DFBits &other)
+    {
+        for (size_t w = 0; w < words.size(); ++w)
+            words[w] &= ~other.words[w];
+    }
+
+    // this = gen | (in & ~kill), 数据流方程的传递函数
+    bool Transfer(const DFBits &in, const DFBits &gen, const DFBits &kill)
+    {
+        uint64_t changed = 0;
+        for (size_t w = 0; w < words.size(); ++w)
+        {
+            uint64_t next = gen.words[w] | (in.words[w] & ~kill.words[w]);
+            changed |= next ^ words[w];
+            words[w] = next;
+        }
+        return changed != 0;
+    }
+
+    size_t Count() const
+    {
+        size_t count = 0;
+        for (uint64_t w : words)
+            count += __builtin_popcountll(w);
+        return count;
+    }
+
+    template <typename Fn>
+    void ForEach(Fn fn) const
+    {
+        for (size_t w = 0; w < words.size(); ++w)
+            for (uint64_t bits = words[w]; bits != 0; bits &= bits - 1)
+                fn(w * 64 + __builtin_ctzll(bits));
+    }
+};
+
+// ---------------------------------------------------------------- 求解器
+
+struct DFGraph
+{
+    vector<vector<int> > succs, preds; // 块 0 是入口
+    vector<int> rpo;                   // 从入口可达的块的逆后序
+};
+
+static void DF_ComputeOrder(DFGraph &graph)
+{
+    int n = graph.succs.size();
+    vector<char> seen(n, 0);
+    vector<int> post;
+    vector<pair<int, size_t> > stack;
+    if (n > 0)
+    {
+        stack.push_back({0, 0});
+        seen[0] = 1;
+    }
+    while (!stack.empty())
+    {
+        int bb = stack.back().first;
+        if (stack.back().second < graph.succs[bb].size())
+        {
+            int s = graph.succs[bb][stack.back().second++];
+            if (!seen[s])
+            {
+                seen[s] = 1;
+                stack.push_back({s, 0});
+            }
+        }
+        else
+        {
+            post.push_back(bb);
+            stack.pop_back();
+        }
+    }
+    graph.rpo.assign(post.rbegin(), post.rend());
+}
+
+enum DFDirection
+{
+    DF_FORWARD,
+    DF_BACKWARD,
+};
+
+enum DFMeet
+{
+    DF_UNION,
+    DF_INTERSECT,
+};
+
+// 一个数据流问题. 调用者填 direction, meet, bits, gen, kill 和 boundary
+// (前向是入口的 in, 后向是出口块的 out), DF_Solve 填 in/out
+struct DFProblem
+{
+    DFDirection direction = DF_FORWARD;
+    DFMeet meet = DF_UNION;
+    size_t bits = 0;
+    vector<DFBits> gen, kill;
+    DFBits boundary;
+    vector<DFBits> in, out;
+    long visits = 0; // 传递函数算了几次, 衡量收敛快慢
+};
+
+// 工作表算法. 前向按逆后序, 后向按后序初始化工作表, 一般两三遍就收敛.
+// 交汇是交的问题里, 没算过的块先当全集
+static void DF_Solve(const DFGraph &graph, DFProblem &problem)
+{
+    int n = graph.succs.size();
+    bool forward = problem.direction == DF_FORWARD;
+    DFBits top(problem.bits);
+    if (problem.meet == DF_INTERSECT)
+        top.Fill(problem.bits);
+    problem.in.assign(n, top);
+    problem.out.assign(n, top);
+
+    const vector<vector<int> > &sources = forward ? graph.preds : graph.succs;
+    const vector<vector<int> > &targets = forward ? graph.succs : graph.preds;
+    vector<DFBits> &before = forward ? problem.in : problem.out;
+    vector<DFBits> &after = forward ? problem.out : problem.in;
+
+    deque<int> work;
+    vector<char> queued(n, 0);
+    for (size_t i = 0; i < graph.rpo.size(); ++i)
+    {
+        int bb = forward ? graph.rpo[i] : graph.rpo[graph.rpo.size() - 1 - i];
+        work.push_back(bb);
+        queued[bb] = 1;
+    }
+    DFBits meet(problem.bits);
+    while (!work.empty())
+    {
+        int bb = work.front();
+        work.pop_front();
+        queued[bb] = 0;
+        bool boundary = forward ? bb == 0 : sources[bb].empty();
+        if (boundary)
+            meet = problem.boundary;
+        else
+        {
+            meet = top;
+            for (int s : sources[bb])
+                if (problem.meet == DF_UNION)
+                    meet.UnionWith(after[s]);
+                else
+                    meet.IntersectWith(after[s]);
+        }
+        before[bb] = meet;
+        problem.visits++;
+        if (!after[bb].Transfer(before[bb], problem.gen[bb], problem.kill[bb]))
+            continue;
+        for (int t : targets[bb])
+            if (!queued[t])
+            {
+                work.push_back(t);
+                queued[t] = 1;
+            }
+    }
+}
+
+// ---------------------------------------------------------------- KIR 函数的稠密编号
+
+// KIR 的值本来就是从 0 开始的 temp 编号, 直接拿来当值下标
+struct DFInst
+{
+    const KInst *inst;
+    int def = -1;     // 有结果的指令的值下标
+    vector<int> uses; // 读到的值下标 (不含常数和全局变量)
+};
+
+struct DFFunction
+{
+    vector<vector<DFInst> > insts; // 每块的指令, 块的下标和 KFunc::bbs 一样
+    size_t num_values = 0;
+    DFGraph graph;
+    size_t num_insts = 0;
+};
+
+static DFFunction DF_Build(const KFunc &func)
+{
+    DFFunction fn;
+    int n = func.bbs.size();
+    fn.num_values = func.temp_names.size();
+    fn.insts.resize(n);
+    fn.graph.succs.resize(n);
+    fn.graph.preds.resize(n);
+    for (int b = 0; b < n; ++b)
+    {
+        for (auto &kinst : func.bbs[b].insts)
+        {
+            DFInst inst;
+            inst.inst = &kinst;
+            inst.def = kinst.dest;
+            auto use = [&](const KValue &operand) {
+                if (operand.kind == KV_TEMP)
+                    inst.uses.push_back(operand.v);
+            };
+            use(kinst.lhs);
+            use(kinst.rhs);
+            for (auto &arg : kinst.args)
+                use(arg);
+            fn.insts[b].push_back(inst);
+            fn.num_insts++;
+        }
+        for (int s : KIR_Successors(func.bbs[b]))
+        {
+            fn.graph.succs[b].push_back(s);
+            fn.graph.preds[s].push_back(b);
+        }
+    }
+    DF_ComputeOrder(fn.graph);
+    return fn;
+}
+
+// ---------------------------------------------------------------- 分析
+
+// 活跃变量: 后向, 并. in[b] 是进入 b 时以后还要用的值
+static DFProblem DF_Liveness(const DFFunction &fn)
+{
+    DFProblem problem;
+    problem.direction = DF_BACKWARD;
+    problem.meet = DF_UNION;
+    problem.bits = fn.num_values;
+    problem.boundary = DFBits(problem.bits);
+    problem.gen.assign(fn.insts.size(), DFBits(problem.bits));
+    problem.kill.assign(fn.insts.size(), DFBits(problem.bits));
+    for (size_t b = 0; b < fn.insts.size(); ++b)
+        for (auto &inst : fn.insts[b])
+        {
+            // 块里先用后定义的才是向上暴露的使用
+            for (int u : inst.uses)
+                if (!problem.kill[b].Test(u))
+                    problem.gen[b].Set(u);
+            if (inst.def != -1)
+                problem.kill[b].Set(inst.def);
+        }
+    DF_Solve(fn.graph, problem);
+    return problem;
+}
+
+// -bench-dataflow: 每个函数的规模, 各个分析的耗时和传递函数调用次数, 写到 stderr
+static void DF_Bench(const KFunc &func)
+{
+    auto now = [] { return chrono::steady_clock::now(); };
+    auto ms = [](chrono::steady_clock::time_point a, chrono::steady_clock::time_point b) {
+        return chrono::duration<double>(b - a).count() * 1000;
+    };
+    auto t0 = now();
+    DFFunction fn = DF_Build(func);
+    auto t1 = now();
+    DFProblem live = DF_Liveness(fn);
+    auto t2 = now();
+    fprintf(stderr, "%s: %zu insts, %zu blocks, %zu values\n", func.name.c_str(), fn.num_insts, fn.insts.size(),
+            fn.num_values);
+    fprintf(stderr, "  %-10s %10.3f ms\n", "index", ms(t0, t1));
+    fprintf(stderr, "  %-10s %10.3f ms %8ld visits\n", "liveness", ms(t1, t2), live.visits);
+}
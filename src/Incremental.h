@@ -0,0 +1,160 @@
+#pragma once
+
+// 按函数的增量编译 (-incremental=目录). 流式模式下每个函数单独生成 IR 和汇编, 结果只取决于:
+// 它自己的 token 流 (FuncDefAST::fingerprint), 它调用的函数的签名, 以及编译选项.
+// 前两样之外的都进了 key, 调用的函数记在条目里, 取的时候和现在的签名逐个比对.
+// 一个函数一个文件, 写的时候先写临时文件再 rename, 几个编译器同时用一个目录也不会读到半个文件
+
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include <unistd.h>
+#include "AST.h"
+
+using namespace std;
+
+struct IncEntry
+{
+    string signature;                // 这个函数自己的 decl, 后面的函数调用它时要用
+    vector<pair<string, string> > deps; // 调用的函数 -> 当时的签名, 没定义过的是空串
+    string ir;
+    bool has_asm = false;
+    string asm_text;
+    long stalls_before = 0, stalls_after = 0; // -sched-report 的统计, 复用时照样累计
+};
+
+// 编译器的版本: Makefile 把全部源文件的哈希传进来 (-DSYSY_BUILD_ID=...), 改了任何一个
+// 翻译单元都会变, 同样的源码构建出来的都一样. 没有它就分不清缓存是不是这个编译器写的, 不能开
+#ifndef SYSY_BUILD_ID
+#define SYSY_BUILD_ID ""
+#endif
+// 条目的格式版本, 条目的写法或者 key 的算法变了就改
+static const char *INC_MAGIC = "sysy-incremental 2";
+static string inc_dir;      // 空串表示没开
+static uint64_t inc_key = 0; // 编译选项的哈希
+static long inc_reused = 0, inc_compiled = 0;
+
+// 除了输入输出文件和增量编译自己的选项, 命令行都进 key; -fprofile-use 还要算上文件内容.
+// 编译器的版本和条目的格式版本也进 key, 换了编译器旧的条目就都作废
+static void Inc_SetOptions(int argc, const char *argv[])
+{
+    uint64_t h = HashMix(HashString(SYSY_BUILD_ID), HashString(INC_MAGIC));
+    h = HashMix(h, HashString(argv[1]));
+    for (int i = 3; i < argc; ++i)
+    {
+        string arg = argv[i];
+        if (arg == "-o")
+        {
+            ++i;
+            continue;
+        }
+        if (arg.compare(0, 13, "-incremental=") == 0 || arg == "-incremental-report")
+            continue;
+        h = HashMix(h, HashString(arg));
+        if (arg.compare(0, 14, "-fprofile-use=") == 0)
+        {
+            ifstream in(arg.substr(14), ios::binary);
+            stringstream content;
+            content << in.rdbuf();
+            h = HashMix(h, HashString(content.str()));
+        }
+    }
+    inc_key = h;
+}
+
+static string Inc_Path(uint64_t fingerprint)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.fn", (unsigned long long)HashMix(inc_key, fingerprint));
+    return inc_dir + "/" + name;
+}
+
+// 调用的函数的签名都没变才能复用
+static bool Inc_DepsMatch(const IncEntry &entry, const map<string, string> &signatures)
+{
+    for (auto &dep : entry.deps)
+    {
+        auto it = signatures.find(dep.first);
+        if ((it == signatures.end() ? string() : it->second) != dep.second)
+            return false;
+    }
+    return true;
+}
+
+static bool Inc_ReadBlob(istream &in, string &blob)
+{
+    size_t size;
+    if (!(in >> size) || in.get() != '\n')
+        return false;
+    blob.resize(size);
+    return (bool)in.read(&blob[0], size);
+}
+
+static bool Inc_Load(uint64_t fingerprint, IncEntry &entry)
+{
+    ifstream in(Inc_Path(fingerprint), ios::binary);
+    string magic;
+    if (!in || !getline(in, magic) || magic != INC_MAGIC || !getline(in, entry.signature))
+        return false;
+    size_t ndeps;
+    if (!(in >> ndeps))
+        return false;
+    in.get();
+    for (size_t i = 0; i < ndeps; ++i)
+    {
+        string line;
+        if (!getline(in, line) || line.find('\t') == string::npos)
+            return false;
+        size_t tab = line.find('\t');
+        entry.deps.push_back({line.substr(0, tab), line.substr(tab + 1)});
+    }
+    if (!(in >> entry.stalls_before >> entry.stalls_after >> entry.has_asm))
+        return false;
+    in.get();
+    return Inc_ReadBlob(in, entry.ir) && (!entry.has_asm || Inc_ReadBlob(in, entry.asm_text));
+}
+
+static void Inc_Store(uint64_t fingerprint, const IncEntry &entry)
+{
+    string path = Inc_Path(fingerprint);
+    string tmp = path + ".tmp" + to_string(getpid());
+    {
+        ofstream out(tmp, ios::binary);
+        out << INC_MAGIC << "\n" << entry.signature << "\n" << entry.deps.size() << "\n";
+        for (auto &dep : entry.deps)
+            out << dep.first << "\t" << dep.second << "\n";
+        out << entry.stalls_before << " " << entry.stalls_after << " " << entry.has_asm << "\n";
+        out << entry.ir.size() << "\n" << entry.ir;
+        if (entry.has_asm)
+            out << entry.asm_text.size() << "\n" << entry.asm_text;
+        if (!out)
+        {
+            out.close();
+            remove(tmp.c_str());
+            return; // 存不下就算了, 下次重新编译
+        }
+    }
+    error_code ec;
+    filesystem::rename(tmp, path, ec);
+    if (ec)
+        filesystem::remove(tmp, ec);
+}
+
+static bool Inc_Open(const string &dir)
+{
+    if (string(SYSY_BUILD_ID).empty())
+    {
+        cerr << "-incremental needs a compiler built with SYSY_BUILD_ID (see Makefile)" << endl;
+        return false;
+    }
+    error_code ec;
+    filesystem::create_directories(dir, ec);
+    inc_dir = dir;
+    return filesystem::is_directory(dir, ec);
+}
@@ -0,0 +1,535 @@
+#pragma once
+
+// -run: 不经过 Koopa 和 RISC-V 后端, 在进程里直接执行 KProgram.
+// 每个函数先译码一次, 变成一个定长指令的数组, 操作数是帧里槽位的下标;
+// 解释器的主循环通过每条指令里存的标签指针直接分派
+// (GCC/Clang 的 computed goto; 别的编译器用普通的 switch).
+//
+// 每次调用的帧: 每个值一个槽, 每个标量 alloc 一个格, 然后是局部数组,
+// 最后是函数用到的常量. 立即数操作数读它的常量槽, 标量 alloc 的 load/store
+// 变成槽之间的移动. 其余的都按字下标访问同一个内存数组: 底部是全局变量,
+// 上面是一帧帧的栈; 全局变量的地址也只是一个常量
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include "KIR.h"
+
+using namespace std;
+
+#if defined(__GNUC__) || defined(__clang__)
+#define INTERP_THREADED
+#endif
+
+// 二元运算沿用 KBinaryOp 的编号, 其余的接在后面
+enum InterpOp
+{
+    IOP_LOAD = KB_SAR + 1,
+    IOP_STORE,
+    IOP_BRANCH,
+    IOP_JUMP,
+    IOP_RET,
+    IOP_RET_VOID,
+    IOP_CALL,     // 调用程序里的函数
+    IOP_CALL_LIB, // 调用 SysY 运行时函数
+    IOP_LOAD_PTR, // 通过地址 load
+    IOP_STORE_PTR,
+    IOP_INDEX,    // getelemptr / getptr: a + b * target 个字
+    IOP_FRAME,    // 局部数组的地址: 帧基址 + a
+    IOP_COUNT,
+};
+
+static const char *interp_op_names[IOP_COUNT] = {"ne", "eq", "gt", "lt", "ge", "le", "add", "sub", "mul", "div",
+                                                 "mod", "and", "or", "xor", "shl", "shr", "sar", "load", "store",
+                                                 "br", "jump", "ret", "ret", "call", "call(lib)", "load(ptr)",
+                                                 "store(ptr)", "index", "frame"};
+
+enum InterpLib
+{
+    LIB_GETINT, LIB_GETCH, LIB_GETARRAY, LIB_PUTINT, LIB_PUTCH, LIB_PUTARRAY, LIB_STARTTIME, LIB_STOPTIME,
+};
+
+struct InterpInst
+{
+    const void *label = nullptr; // threaded 时是处理代码的地址
+    int op;
+    int dest = -1;   // 写的槽 (store: alloc 的格)
+    int a = -1;      // 读的槽
+    int b = -1;
+    int target = -1; // br/jump: 指令下标; call: 函数下标或 InterpLib
+    int target2 = -1; // br: false 目标; call: 在 InterpFunc::arg_slots 里的起点
+    int nargs = 0;
+};
+
+struct InterpFunc
+{
+    string name;
+    vector<InterpInst> code;
+    int frame_size = 0;
+    int const_base = 0;            // 常量占 [const_base, frame_size)
+    vector<int32_t> const_values;
+    vector<int> param_slots;
+    vector<int> arg_slots;         // 调用的实参, 整个函数共用一个池
+};
+
+struct InterpProgram
+{
+    vector<InterpFunc> funcs;
+    map<string, int> func_index; // 名字不带 '@'
+    vector<int32_t> globals;     // 内存的初始映像, 全局变量的地址从 0 开始
+};
+
+// global_addr: 每个全局变量的字地址, 下标和 kir_global_names 一样
+static InterpFunc Interp_Decode(const KFunc &func, const map<string, int> &func_index,
+                                const vector<int> &global_addr)
+{
+    InterpFunc out;
+    out.name = func.name.substr(1);
+    int ntemps = func.temp_names.size();
+    vector<int> cell(ntemps, -1), array_base(ntemps, -1);
+    int next_slot = ntemps;
+    for (auto &bb : func.bbs)
+        for (auto &inst : bb.insts)
+            if (inst.kind == KI_ALLOC && inst.type.dims.empty())
+                cell[inst.dest] = next_slot++;
+    for (auto &bb : func.bbs)
+        for (auto &inst : bb.insts)
+            if (inst.kind == KI_ALLOC && !inst.type.dims.empty())
+            {
+                array_base[inst.dest] = next_slot;
+                next_slot += KIR_Words(inst.type.dims);
+            }
+    out.const_base = next_slot;
+    map<int32_t, int> const_slot;
+    auto slot = [&](const KValue &value) {
+        if (value.kind == KV_TEMP)
+            return value.v;
+        int32_t v = value.v;
+        if (value.kind == KV_GLOBAL)
+        {
+            assert(value.v < (int)global_addr.size() && global_addr[value.v] != -1);
+            v = global_addr[value.v];
+        }
+        else
+            assert(value.kind == KV_IMM);
+        auto it = const_slot.find(v);
+        if (it != const_slot.end())
+            return it->second;
+        out.const_values.push_back(v);
+        return const_slot[v] = out.const_base + (int)out.const_values.size() - 1;
+    };
+    auto is_cell = [&](const KValue &ptr) { return ptr.kind == KV_TEMP && cell[ptr.v] != -1; };
+    for (int param : func.params)
+        out.param_slots.push_back(param);
+
+    // 块的起点要等前面的块都译码完才知道
+    vector<int> block_start(func.bbs.size());
+    vector<pair<int, int> > fixups; // (指令, 块), 用来回填 target 和 target2
+    for (size_t i = 0; i < func.bbs.size(); ++i)
+    {
+        block_start[i] = out.code.size();
+        for (auto &inst : func.bbs[i].insts)
+        {
+            InterpInst ii;
+            switch (inst.kind)
+            {
+            case KI_ALLOC:
+                if (array_base[inst.dest] == -1)
+                    continue;
+                ii.op = IOP_FRAME;
+                ii.dest = inst.dest;
+                ii.a = array_base[inst.dest];
+                break;
+            case KI_LOAD:
+                ii.op = is_cell(inst.lhs) ? IOP_LOAD : IOP_LOAD_PTR;
+                ii.dest = inst.dest;
+                ii.a = is_cell(inst.lhs) ? cell[inst.lhs.v] : slot(inst.lhs);
+                break;
+            case KI_STORE:
+                ii.op = is_cell(inst.rhs) ? IOP_STORE : IOP_STORE_PTR;
+                ii.dest = is_cell(inst.rhs) ? cell[inst.rhs.v] : -1;
+                ii.a = slot(inst.lhs);
+                if (ii.op == IOP_STORE_PTR)
+                    ii.b = slot(inst.rhs);
+                break;
+            case KI_GETELEMPTR:
+            case KI_GETPTR:
+                ii.op = IOP_INDEX;
+                ii.dest = inst.dest;
+                ii.a = slot(inst.lhs);
+                ii.b = slot(inst.rhs);
+                ii.target = inst.stride / 4;
+                break;
+            case KI_BINARY:
+                ii.op = inst.op;
+                ii.dest = inst.dest;
+                ii.a = slot(inst.lhs);
+                ii.b = slot(inst.rhs);
+                break;
+            case KI_BRANCH:
+                ii.op = IOP_BRANCH;
+                ii.a = slot(inst.lhs);
+                ii.target = inst.true_bb;
+                ii.target2 = inst.false_bb;
+                fixups.push_back({out.code.size(), 2});
+                break;
+            case KI_JUMP:
+                ii.op = IOP_JUMP;
+                ii.target = inst.true_bb;
+                fixups.push_back({out.code.size(), 1});
+                break;
+            case KI_RETURN:
+                ii.op = inst.lhs.kind == KV_NONE ? IOP_RET_VOID : IOP_RET;
+                if (ii.op == IOP_RET)
+                    ii.a = slot(inst.lhs);
+                break;
+            case KI_CALL:
+            {
+                string name = inst.callee.substr(1);
+                static const map<string, int> libs = {
+                    {"getint", LIB_GETINT}, {"getch", LIB_GETCH},     {"getarray", LIB_GETARRAY},
+                    {"putint", LIB_PUTINT}, {"putch", LIB_PUTCH},     {"putarray", LIB_PUTARRAY},
+                    {"starttime", LIB_STARTTIME}, {"stoptime", LIB_STOPTIME}};
+                if (func_index.count(name))
+                {
+                    ii.op = IOP_CALL;
+                    ii.target = func_index.at(name);
+                }
+                else if (libs.count(name))
+                {
+                    ii.op = IOP_CALL_LIB;
+                    ii.target = libs.at(name);
+                }
+                else
+                {
+                    cerr << "run: call to unsupported function " << name << endl;
+                    exit(1);
+                }
+                ii.dest = inst.dest;
+                ii.target2 = out.arg_slots.size();
+                ii.nargs = inst.args.size();
+                for (auto &arg : inst.args)
+                    out.arg_slots.push_back(slot(arg));
+                break;
+            }
+            default:
+                assert(false);
+            }
+            out.code.push_back(ii);
+        }
+    }
+    for (auto &fixup : fixups)
+    {
+        InterpInst &ii = out.code[fixup.first];
+        ii.target = block_start[ii.target];
+        if (fixup.second == 2)
+            ii.target2 = block_start[ii.target2];
+    }
+    out.frame_size = out.const_base + out.const_values.size();
+    return out;
+}
+
+static InterpProgram Interp_Decode(const KProgram &program)
+{
+    InterpProgram out;
+    vector<int> global_addr(kir_global_names.size(), -1);
+    for (auto &global : program.globals)
+    {
+        global_addr[kir_global_ids.at(global.name)] = out.globals.size();
+        if (global.init.empty())
+            out.globals.resize(out.globals.size() + KIR_Words(global.type.dims), 0);
+        else
+            out.globals.insert(out.globals.end(), global.init.begin(), global.init.end());
+    }
+    for (size_t i = 0; i < program.funcs.size(); ++i)
+        out.func_index[program.funcs[i].name.substr(1)] = i;
+    for (auto &func : program.funcs)
+        out.funcs.push_back(Interp_Decode(func, out.func_index, global_addr));
+    return out;
+}
+
+static int32_t Interp_Binary(int op, int32_t l, int32_t r)
+{
+    uint32_t ul = l, ur = r;
+    switch (op)
+    {
+    case KB_NE: return l != r;
+    case KB_EQ: return l == r;
+    case KB_GT: return l > r;
+    case KB_LT: return l < r;
+    case KB_GE: return l >= r;
+    case KB_LE: return l <= r;
+    case KB_ADD: return (int32_t)(ul + ur);
+    case KB_SUB: return (int32_t)(ul - ur);
+    case KB_MUL: return (int32_t)(ul * ur);
+    // 除以零和 INT_MIN / -1 给出 RISC-V 的结果, 不让它陷入
+    case KB_DIV: return r == 0 ? -1 : (l == INT32_MIN && r == -1) ? l : l / r;
+    case KB_MOD: return r == 0 ? l : (l == INT32_MIN && r == -1) ? 0 : l % r;
+    case KB_AND: return l & r;
+    case KB_OR: return l | r;
+    case KB_XOR: return l ^ r;
+    case KB_SHL: return (int32_t)(ul << (ur & 31));
+    case KB_SHR: return (int32_t)(ul >> (ur & 31));
+    case KB_SAR: return l >> (ur & 31);
+    }
+    assert(false);
+    return 0;
+}
+
+// 数组参数是 mem 里的字地址
+static int32_t Interp_Library(int lib, const int32_t *args, int32_t *mem, uint32_t mem_words)
+{
+    auto check = [&](int32_t addr, int32_t n) {
+        if ((uint32_t)addr >= mem_words || n < 0 || (uint32_t)n > mem_words - (uint32_t)addr)
+        {
+            cerr << "run: array argument out of range" << endl;
+            exit(1);
+        }
+    };
+    int value = 0;
+    switch (lib)
+    {
+    case LIB_GETINT:
+        if (scanf("%d", &value) != 1)
+            value = 0;
+        return value;
+    case LIB_GETCH:
+        return getchar();
+    case LIB_GETARRAY:
+    {
+        int n = 0;
+        if (scanf("%d", &n) != 1)
+            n = 0;
+        check(args[0], n);
+        for (int i = 0; i < n; ++i)
+            if (scanf("%d", &mem[args[0] + i]) != 1)
+                mem[args[0] + i] = 0;
+        return n;
+    }
+    case LIB_PUTINT:
+        printf("%d", args[0]);
+        return 0;
+    case LIB_PUTCH:
+        putchar(args[0]);
+        return 0;
+    case LIB_PUTARRAY:
+        check(args[1], args[0]);
+        printf("%d:", args[0]);
+        for (int i = 0; i < args[0]; ++i)
+            printf(" %d", mem[args[1] + i]);
+        putchar('\n');
+        return 0;
+    }
+    return 0; // starttime / stoptime
+}
+
+struct InterpResult
+{
+    int32_t exit_value = 0;
+    vector<long> histogram; // 每种 InterpOp 执行的指令数
+};
+
+// 运行 main. 值都放在一段连续的帧栈上, SysY 递归再深
+// 也不会撑大宿主的栈
+static InterpResult Interp_Run(InterpProgram &program)
+{
+    InterpResult result;
+    result.histogram.assign(IOP_COUNT, 0);
+    if (!program.func_index.count("main"))
+    {
+        cerr << "run: no main function" << endl;
+        exit(1);
+    }
+
+#ifdef INTERP_THREADED
+    static const void *labels[IOP_COUNT] = {
+        &&op_binary, &&op_binary, &&op_binary, &&op_binary, &&op_binary, &&op_binary, &&op_add,
+        &&op_sub,    &&op_binary, &&op_binary, &&op_binary, &&op_binary, &&op_binary, &&op_binary,
+        &&op_binary, &&op_binary, &&op_binary, &&op_load,   &&op_store,  &&op_branch, &&op_jump,
+        &&op_ret,    &&op_ret_void, &&op_call, &&op_call_lib, &&op_load_ptr, &&op_store_ptr, &&op_index,
+        &&op_frame,
+    };
+    for (auto &func : program.funcs)
+        for (auto &inst : func.code)
+            inst.label = labels[inst.op];
+#define INTERP_CASE(name, ...) op_##name:
+#define INTERP_NEXT()                                                                                                  \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        histogram[pc->op]++;                                                                                           \
+        goto *pc->label;                                                                                               \
+    } while (0)
+#else
+#define INTERP_CASE(name, ...) __VA_ARGS__:
+#define INTERP_NEXT()                                                                                                  \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        histogram[pc->op]++;                                                                                           \
+        goto dispatch;                                                                                                 \
+    } while (0)
+#endif
+
+    struct CallFrame
+    {
+        const InterpFunc *func;
+        const InterpInst *ret_pc;
+        int32_t *fp;
+        int dest;
+    };
+    vector<CallFrame> calls;
+    vector<int32_t> stack(1 << 24);
+    if (program.globals.size() >= stack.size() / 2)
+    {
+        cerr << "run: globals too large" << endl;
+        exit(1);
+    }
+    copy(program.globals.begin(), program.globals.end(), stack.begin());
+    int32_t *mem = stack.data();
+    uint32_t mem_words = stack.size();
+    int32_t *stack_end = stack.data() + stack.size();
+    long *histogram = result.histogram.data();
+
+    const InterpFunc *func = &program.funcs[program.func_index["main"]];
+    int32_t *fp = stack.data() + program.globals.size();
+    memcpy(fp + func->const_base, func->const_values.data(), func->const_values.size() * sizeof(int32_t));
+    const InterpInst *code = func->code.data();
+    const InterpInst *pc = code;
+    int32_t ret_value = 0;
+
+    INTERP_NEXT();
+#ifndef INTERP_THREADED
+dispatch:
+    switch (pc->op)
+    {
+#endif
+    INTERP_CASE(add, case KB_ADD)
+    fp[pc->dest] = (int32_t)((uint32_t)fp[pc->a] + (uint32_t)fp[pc->b]);
+    ++pc;
+    INTERP_NEXT();
+    INTERP_CASE(sub, case KB_SUB)
+    fp[pc->dest] = (int32_t)((uint32_t)fp[pc->a] - (uint32_t)fp[pc->b]);
+    ++pc;
+    INTERP_NEXT();
+    INTERP_CASE(binary, default)
+    fp[pc->dest] = Interp_Binary(pc->op, fp[pc->a], fp[pc->b]);
+    ++pc;
+    INTERP_NEXT();
+    INTERP_CASE(load, case IOP_LOAD)
+    INTERP_CASE(store, case IOP_STORE)
+    fp[pc->dest] = fp[pc->a];
+    ++pc;
+    INTERP_NEXT();
+    INTERP_CASE(branch, case IOP_BRANCH)
+    pc = code + (fp[pc->a] ? pc->target : pc->target2);
+    INTERP_NEXT();
+    INTERP_CASE(jump, case IOP_JUMP)
+    pc = code + pc->target;
+    INTERP_NEXT();
+    INTERP_CASE(ret, case IOP_RET)
+    ret_value = fp[pc->a];
+    INTERP_CASE(ret_void, case IOP_RET_VOID)
+    if (calls.empty())
+    {
+        result.exit_value = ret_value;
+        return result;
+    }
+    {
+        CallFrame &frame = calls.back();
+        func = frame.func;
+        code = func->code.data();
+        pc = frame.ret_pc;
+        fp = frame.fp;
+        if (frame.dest != -1)
+            fp[frame.dest] = ret_value;
+        calls.pop_back();
+    }
+    INTERP_NEXT();
+    INTERP_CASE(call, case IOP_CALL)
+    {
+        const InterpFunc *callee = &program.funcs[pc->target];
+        int32_t *callee_fp = fp + func->frame_size;
+        if (callee_fp + callee->frame_size > stack_end)
+        {
+            cerr << "run: stack overflow in " << callee->name << endl;
+            exit(1);
+        }
+        for (int i = 0; i < pc->nargs; ++i)
+            callee_fp[callee->param_slots[i]] = fp[func->arg_slots[pc->target2 + i]];
+        memcpy(callee_fp + callee->const_base, callee->const_values.data(),
+               callee->const_values.size() * sizeof(int32_t));
+        calls.push_back({func, pc + 1, fp, pc->dest});
+        func = callee;
+        code = func->code.data();
+        pc = code;
+        fp = callee_fp;
+    }
+    INTERP_NEXT();
+    INTERP_CASE(call_lib, case IOP_CALL_LIB)
+    {
+        int32_t args[2] = {pc->nargs > 0 ? fp[func->arg_slots[pc->target2]] : 0,
+                           pc->nargs > 1 ? fp[func->arg_slots[pc->target2 + 1]] : 0};
+        int32_t value = Interp_Library(pc->target, args, mem, mem_words);
+        if (pc->dest != -1)
+            fp[pc->dest] = value;
+        ++pc;
+    }
+    INTERP_NEXT();
+    INTERP_CASE(load_ptr, case IOP_LOAD_PTR)
+    if ((uint32_t)fp[pc->a] >= mem_words)
+        goto bad_address;
+    fp[pc->dest] = mem[fp[pc->a]];
+    ++pc;
+    INTERP_NEXT();
+    INTERP_CASE(store_ptr, case IOP_STORE_PTR)
+    if ((uint32_t)fp[pc->b] >= mem_words)
+        goto bad_address;
+    mem[fp[pc->b]] = fp[pc->a];
+    ++pc;
+    INTERP_NEXT();
+    INTERP_CASE(index, case IOP_INDEX)
+    fp[pc->dest] = (int32_t)((uint32_t)fp[pc->a] + (uint32_t)fp[pc->b] * (uint32_t)pc->target);
+    ++pc;
+    INTERP_NEXT();
+    INTERP_CASE(frame, case IOP_FRAME)
+    fp[pc->dest] = (int32_t)(fp - mem) + pc->a;
+    ++pc;
+    INTERP_NEXT();
+#ifndef INTERP_THREADED
+    }
+#endif
+bad_address:
+    cerr << "run: memory access out of range in " << func->name << endl;
+    exit(1);
+#undef INTERP_CASE
+#undef INTERP_NEXT
+}
+
+// 返回值和执行的指令数, 多的在前
+static void Interp_Report(const InterpResult &result, ostream &os)
+{
+    os << "exit value: " << result.exit_value << "\n";
+    vector<pair<long, int> > rows;
+    long total = 0;
+    for (int op = 0; op < IOP_COUNT; ++op)
+    {
+        total += result.histogram[op];
+        if (result.histogram[op] > 0)
+            rows.push_back({-result.histogram[op], op});
+    }
+    sort(rows.begin(), rows.end());
+    char line[64];
+    for (auto &row : rows)
+    {
+        snprintf(line, sizeof(line), "  %-10s %12ld %6.1f%%\n", interp_op_names[row.second], -row.first,
+                 -row.first * 100.0 / total);
+        os << line;
+    }
+    snprintf(line, sizeof(line), "  %-10s %12ld\n", "total", total);
+    os << line;
+}
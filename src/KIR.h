@@ -0,0 +1,707 @@
+#pragma once
+
+// DumpIR 生成的 Koopa IR 在内存里的形式, 给 Opt.h 里的 pass 用.
+// 只覆盖前端会生成的那部分 Koopa
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <iostream>
+#include <vector>
+#include <map>
+#include <set>
+#include <cassert>
+#include <cstdlib>
+
+using namespace std;
+
+enum KValueKind
+{
+    KV_NONE,
+    KV_IMM,  // 整数立即数, 值在 v
+    KV_TEMP, // 指令定义的值, 编号在 v
+    KV_GLOBAL, // 全局变量的地址, 编号在 v (见 KGlobalRef)
+};
+
+struct KValue
+{
+    int kind;
+    int v;
+};
+
+static inline KValue KNone() { return {KV_NONE, 0}; }
+static inline KValue KImm(int v) { return {KV_IMM, v}; }
+static inline KValue KTemp(int id) { return {KV_TEMP, id}; }
+static inline bool operator==(const KValue &a, const KValue &b) { return a.kind == b.kind && a.v == b.v; }
+static inline bool operator!=(const KValue &a, const KValue &b) { return !(a == b); }
+static inline bool operator<(const KValue &a, const KValue &b) { return a.kind != b.kind ? a.kind < b.kind : a.v < b.v; }
+
+// 全局变量在所有函数共用的一张表里编号, 所以函数可以在定义它的程序之前
+// (或者没有这个程序) 就引用它, 流式编译就是这样
+static vector<string> kir_global_names; // 带开头的 '@'
+static map<string, int> kir_global_ids;
+
+static KValue KGlobalRef(const string &name)
+{
+    auto it = kir_global_ids.find(name);
+    if (it != kir_global_ids.end())
+        return {KV_GLOBAL, it->second};
+    kir_global_names.push_back(name);
+    kir_global_ids[name] = kir_global_names.size() - 1;
+    return {KV_GLOBAL, (int)kir_global_names.size() - 1};
+}
+
+// alloc, 全局变量或参数的类型: dims 为空是 i32, 否则是 i32 数组,
+// dims 从外到内排. pointer 表示指向这个类型的指针 (数组形参, 第一维长度不知道)
+struct KType
+{
+    vector<int> dims;
+    bool pointer = false;
+};
+
+// dims[from..] 一共多少个 i32
+static int KIR_Words(const vector<int> &dims, size_t from = 0)
+{
+    int words = 1;
+    for (size_t i = from; i < dims.size(); ++i)
+        words *= dims[i];
+    return words;
+}
+
+static string KIR_TypeName(const KType &type)
+{
+    string name = "i32";
+    for (int i = (int)type.dims.size() - 1; i >= 0; --i)
+        name = "[" + name + ", " + to_string(type.dims[i]) + "]";
+    return type.pointer ? "*" + name : name;
+}
+
+enum KInstKind
+{
+    KI_ALLOC,
+    KI_LOAD,   // dest = load lhs
+    KI_STORE,  // store lhs, rhs
+    KI_BINARY, // dest = op lhs, rhs
+    KI_BRANCH, // br lhs, true_bb, false_bb
+    KI_JUMP,   // jump true_bb
+    KI_RETURN, // ret [lhs]
+    KI_CALL,   // [dest =] call callee(args)
+    KI_GETELEMPTR, // dest = getelemptr lhs, rhs
+    KI_GETPTR,     // dest = getptr lhs, rhs
+};
+
+// 编号和 koopa_raw_binary_op 一样, 见 RISC_Visit_Binary
+static const char *kir_binary_ops[] = {"ne", "eq", "gt", "lt", "ge", "le", "add", "sub", "mul",
+                                       "div", "mod", "and", "or", "xor", "shl", "shr", "sar"};
+enum KBinaryOp
+{
+    KB_NE, KB_EQ, KB_GT, KB_LT, KB_GE, KB_LE, KB_ADD, KB_SUB, KB_MUL,
+    KB_DIV, KB_MOD, KB_AND, KB_OR, KB_XOR, KB_SHL, KB_SHR, KB_SAR
+};
+
+struct KInst
+{
+    int kind;
+    int op = 0;    // 二元运算符
+    int dest = -1; // 这条指令定义的值
+    KValue lhs = {KV_NONE, 0};
+    KValue rhs = {KV_NONE, 0};
+    int true_bb = -1; // br / jump 的目标, 是 KFunc::bbs 的下标
+    int false_bb = -1;
+    string callee;        // 被调函数, 带开头的 '@'
+    vector<KValue> args;  // 调用的实参
+    KType type;           // alloc: 分配的类型
+    int stride = 0;       // getelemptr / getptr: 下标每加一走多少字节
+};
+
+struct KBlock
+{
+    string name; // 带开头的 '%'
+    vector<KInst> insts;
+};
+
+struct KFunc
+{
+    string name; // 带开头的 '@'
+    bool ret_i32 = true;
+    vector<int> params;         // 存放参数的值
+    vector<KType> param_types;  // 每个参数一项
+    vector<KBlock> bbs;         // bbs[0] 是入口块
+    vector<string> temp_names;  // 每个值在源码里的名字 ("" 输出成 %id)
+};
+
+struct KGlobalVar
+{
+    string name; // 带开头的 '@'
+    KType type;
+    vector<int> init;      // 展平的初值, 全零时为空
+    bool is_const = false; // 从不写, 后端放进 .rodata
+};
+
+struct KProgram
+{
+    vector<string> decls; // 读进来的 "decl ..." 行, 原样输出
+    vector<KGlobalVar> globals;
+    vector<KFunc> funcs;
+};
+
+static string KIR_ValueName(const KFunc &func, const KValue &value);
+
+static bool KIR_IsTerminator(const KInst &inst)
+{
+    return inst.kind == KI_BRANCH || inst.kind == KI_JUMP || inst.kind == KI_RETURN;
+}
+
+static int KIR_NewTemp(KFunc &func, const string &name = "")
+{
+    func.temp_names.push_back(name);
+    return func.temp_names.size() - 1;
+}
+
+// 加一个空块; 名字被占用时加数字后缀
+static int KIR_NewBlock(KFunc &func, const string &name)
+{
+    string unique = name;
+    for (int i = 1;; ++i)
+    {
+        bool taken = false;
+        for (auto &bb : func.bbs)
+            taken = taken || bb.name == unique;
+        if (!taken)
+            break;
+        unique = name + "_" + to_string(i);
+    }
+    func.bbs.push_back(KBlock());
+    func.bbs.back().name = unique;
+    return func.bbs.size() - 1;
+}
+
+// 指令读的操作数, 按求值顺序
+static vector<KValue *> KIR_Operands(KInst &inst)
+{
+    vector<KValue *> ops;
+    if (inst.lhs.kind != KV_NONE)
+        ops.push_back(&inst.lhs);
+    if (inst.rhs.kind != KV_NONE)
+        ops.push_back(&inst.rhs);
+    for (auto &arg : inst.args)
+        ops.push_back(&arg);
+    return ops;
+}
+
+static vector<int> KIR_Successors(const KBlock &bb)
+{
+    vector<int> succ;
+    if (bb.insts.empty())
+        return succ;
+    const KInst &term = bb.insts.back();
+    if (term.kind == KI_BRANCH)
+    {
+        succ.push_back(term.true_bb);
+        if (term.false_bb != term.true_bb)
+            succ.push_back(term.false_bb);
+    }
+    else if (term.kind == KI_JUMP)
+        succ.push_back(term.true_bb);
+    return succ;
+}
+
+static vector<vector<int> > KIR_Predecessors(const KFunc &func)
+{
+    vector<vector<int> > preds(func.bbs.size());
+    for (size_t i = 0; i < func.bbs.size(); ++i)
+        for (int s : KIR_Successors(func.bbs[i]))
+            preds[s].push_back(i);
+    return preds;
+}
+
+// 从入口可达的块的逆后序
+static vector<int> KIR_ReversePostOrder(const KFunc &func)
+{
+    vector<int> order;
+    vector<char> seen(func.bbs.size(), 0);
+    vector<pair<int, size_t> > stack;
+    stack.push_back({0, 0});
+    seen[0] = 1;
+    while (!stack.empty())
+    {
+        int bb = stack.back().first;
+        vector<int> succ = KIR_Successors(func.bbs[bb]);
+        if (stack.back().second < succ.size())
+        {
+            int s = succ[stack.back().second++];
+            if (!seen[s])
+            {
+                seen[s] = 1;
+                stack.push_back({s, 0});
+            }
+        }
+        else
+        {
+            order.push_back(bb);
+            stack.pop_back();
+        }
+    }
+    return vector<int>(order.rbegin(), order.rend());
+}
+
+// 直接支配者 (Cooper, Harvey & Kennedy); 不可达的块是 -1
+static vector<int> KIR_Dominators(const KFunc &func)
+{
+    vector<int> rpo = KIR_ReversePostOrder(func);
+    vector<int> rpo_index(func.bbs.size(), -1);
+    for (size_t i = 0; i < rpo.size(); ++i)
+        rpo_index[rpo[i]] = i;
+    vector<vector<int> > preds = KIR_Predecessors(func);
+    vector<int> idom(func.bbs.size(), -1);
+    idom[0] = 0;
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (size_t i = 1; i < rpo.size(); ++i)
+        {
+            int bb = rpo[i], new_idom = -1;
+            for (int p : preds[bb])
+            {
+                if (idom[p] == -1)
+                    continue;
+                if (new_idom == -1)
+                {
+                    new_idom = p;
+                    continue;
+                }
+                int a = p, b = new_idom;
+                while (a != b)
+                {
+                    while (rpo_index[a] > rpo_index[b])
+                        a = idom[a];
+                    while (rpo_index[b] > rpo_index[a])
+                        b = idom[b];
+                }
+                new_idom = a;
+            }
+            if (idom[bb] != new_idom)
+            {
+                idom[bb] = new_idom;
+                changed = true;
+            }
+        }
+    }
+    return idom;
+}
+
+static vector<vector<int> > KIR_DomTree(const vector<int> &idom)
+{
+    vector<vector<int> > children(idom.size());
+    for (size_t i = 1; i < idom.size(); ++i)
+        if (idom[i] != -1)
+            children[idom[i]].push_back(i);
+    return children;
+}
+
+// 支配树上 DFS 的进出时间: a 支配 b 当且仅当 b 的区间套在 a 的里面, 一次查询 O(1)
+struct KDomIntervals
+{
+    vector<int> idom, enter, leave;
+
+    bool Dominates(int a, int b) const
+    {
+        return idom[a] != -1 && idom[b] != -1 && enter[a] <= enter[b] && leave[b] <= leave[a];
+    }
+};
+
+static KDomIntervals KIR_DomIntervals(const KFunc &func)
+{
+    KDomIntervals dom;
+    int n = func.bbs.size();
+    dom.idom = KIR_Dominators(func);
+    dom.enter.assign(n, 0);
+    dom.leave.assign(n, 0);
+    vector<vector<int> > children = KIR_DomTree(dom.idom);
+    vector<pair<int, size_t> > stack = {{0, 0}};
+    int clock = 0;
+    dom.enter[0] = clock++;
+    while (!stack.empty())
+    {
+        int bb = stack.back().first;
+        if (stack.back().second < children[bb].size())
+        {
+            int child = children[bb][stack.back().second++];
+            dom.enter[child] = clock++;
+            stack.push_back({child, 0});
+        }
+        else
+        {
+            dom.leave[bb] = clock++;
+            stack.pop_back();
+        }
+    }
+    return dom;
+}
+
+static void KIR_RetargetBranches(vector<KBlock> &bbs, const vector<int> &remap)
+{
+    for (auto &bb : bbs)
+        for (auto &inst : bb.insts)
+        {
+            if (inst.true_bb != -1)
+                inst.true_bb = remap[inst.true_bb];
+            if (inst.false_bb != -1)
+                inst.false_bb = remap[inst.false_bb];
+        }
+}
+
+// 删掉从入口不可达的块, 重新编号跳转目标
+static void KIR_RemoveUnreachable(KFunc &func)
+{
+    vector<int> rpo = KIR_ReversePostOrder(func);
+    vector<char> live(func.bbs.size(), 0);
+    for (int bb : rpo)
+        live[bb] = 1;
+    vector<int> remap(func.bbs.size(), -1);
+    vector<KBlock> bbs;
+    for (size_t i = 0; i < func.bbs.size(); ++i)
+        if (live[i])
+        {
+            remap[i] = bbs.size();
+            bbs.push_back(move(func.bbs[i]));
+        }
+    KIR_RetargetBranches(bbs, remap);
+    func.bbs = move(bbs);
+}
+
+// 把每个操作数按 repl 替换 (按值的编号索引, KV_NONE 表示不变)
+static void KIR_ReplaceUses(KFunc &func, vector<KValue> &repl)
+{
+    for (auto &bb : func.bbs)
+        for (auto &inst : bb.insts)
+            for (KValue *op : KIR_Operands(inst))
+                while (op->kind == KV_TEMP && op->v < (int)repl.size() && repl[op->v].kind != KV_NONE)
+                    *op = repl[op->v];
+}
+
+// 由回边 (目标支配源的边) 找出的自然循环. 同一个头的循环合并;
+// 循环按从外到内排列, 所以父循环总在子循环前面
+struct KLoop
+{
+    int header;
+    int parent = -1;
+    int depth = 1;
+    vector<int> blocks; // 排好序, 含循环头
+    vector<int> latches;
+};
+
+struct KLoopNest
+{
+    vector<KLoop> loops;
+    vector<int> loop_of; // 每个块所在的最内层循环, 不在循环里是 -1
+
+    int Depth(int bb) const { return loop_of[bb] == -1 ? 0 : loops[loop_of[bb]].depth; }
+    bool Contains(int loop, int bb) const
+    {
+        return binary_search(loops[loop].blocks.begin(), loops[loop].blocks.end(), bb);
+    }
+};
+
+static KLoopNest KIR_LoopNest(const KFunc &func)
+{
+    int n = func.bbs.size();
+    KDomIntervals dom = KIR_DomIntervals(func);
+    const vector<int> &idom = dom.idom;
+    vector<vector<int> > preds = KIR_Predecessors(func);
+
+    map<int, KLoop> by_header;
+    for (int bb = 0; bb < n; ++bb)
+        for (int succ : KIR_Successors(func.bbs[bb]))
+            if (dom.Dominates(succ, bb))
+            {
+                KLoop &loop = by_header[succ];
+                loop.header = succ;
+                loop.latches.push_back(bb);
+            }
+
+    vector<KLoop> loops;
+    for (auto &kv : by_header)
+    {
+        KLoop loop = kv.second;
+        vector<char> in_loop(n, 0);
+        in_loop[loop.header] = 1;
+        vector<int> work = loop.latches;
+        while (!work.empty())
+        {
+            int bb = work.back();
+            work.pop_back();
+            if (in_loop[bb] || idom[bb] == -1)
+                continue;
+            in_loop[bb] = 1;
+            for (int p : preds[bb])
+                work.push_back(p);
+        }
+        for (int bb = 0; bb < n; ++bb)
+            if (in_loop[bb])
+                loop.blocks.push_back(bb);
+        loops.push_back(loop);
+    }
+    stable_sort(loops.begin(), loops.end(), [](const KLoop &a, const KLoop &b) {
+        return a.blocks.size() > b.blocks.size();
+    });
+
+    KLoopNest nest;
+    nest.loops = move(loops);
+    nest.loop_of.assign(n, -1);
+    for (int i = 0; i < (int)nest.loops.size(); ++i)
+    {
+        KLoop &loop = nest.loops[i];
+        for (int j = i - 1; j >= 0; --j)
+            if (nest.Contains(j, loop.header))
+            {
+                loop.parent = j;
+                loop.depth = nest.loops[j].depth + 1;
+                break;
+            }
+        for (int bb : loop.blocks)
+            nest.loop_of[bb] = i;
+    }
+    return nest;
+}
+
+static int KIR_CountInsts(const KFunc &func)
+{
+    int count = 0;
+    for (auto &bb : func.bbs)
+        count += bb.insts.size();
+    return count;
+}
+
+// profile 运行得到的块执行次数 (-fprofile-generate, 由 tools/rvsim 计数).
+// 按函数名和块名索引, 改代码时只要不动这些名字, profile 就还能用.
+// 每行一项 "@func %block count"
+struct KProfile
+{
+    map<string, long> counts;
+    set<string> funcs; // 至少有一个块被计数的函数
+    long max_count = 0;
+
+    bool Has(const KFunc &func) const { return funcs.count(func.name) > 0; }
+    // 块没有 profile 时返回 -1
+    long Count(const KFunc &func, int bb) const
+    {
+        auto it = counts.find(func.name + " " + func.bbs[bb].name);
+        return it == counts.end() ? -1 : it->second;
+    }
+};
+
+static bool KIR_ReadProfile(const string &path, KProfile &profile)
+{
+    FILE *file = fopen(path.c_str(), "r");
+    if (file == nullptr)
+        return false;
+    char func[256], bb[256];
+    long count;
+    while (fscanf(file, "%255s %255s %ld", func, bb, &count) == 3)
+    {
+        profile.counts[string(func) + " " + bb] += count;
+        profile.funcs.insert(func);
+        profile.max_count = max(profile.max_count, count);
+    }
+    fclose(file);
+    return true;
+}
+
+// pass 之间跑的结构检查: 每个块以恰好一条终结指令结尾, 跳转目标存在,
+// 每个值只定义一次, 每次使用都被定义支配. 函数没问题时返回空串
+static string KIR_Verify(const KFunc &func)
+{
+    int n = func.bbs.size();
+    if (n == 0)
+        return "function has no blocks";
+    vector<int> def_block(func.temp_names.size(), -1), def_pos(func.temp_names.size(), -1);
+    for (int param : func.params)
+        def_block[param] = 0;
+    for (int i = 0; i < n; ++i)
+    {
+        const KBlock &bb = func.bbs[i];
+        if (bb.insts.empty() || !KIR_IsTerminator(bb.insts.back()))
+            return bb.name + " does not end with a terminator";
+        for (size_t j = 0; j < bb.insts.size(); ++j)
+        {
+            const KInst &inst = bb.insts[j];
+            if (j + 1 < bb.insts.size() && KIR_IsTerminator(inst))
+                return bb.name + " has a terminator in the middle";
+            if ((inst.true_bb != -1 && inst.true_bb >= n) || (inst.false_bb != -1 && inst.false_bb >= n))
+                return bb.name + " branches to a missing block";
+            if (inst.dest == -1)
+                continue;
+            if (inst.dest >= (int)func.temp_names.size())
+                return bb.name + " defines an unknown temp";
+            if (def_block[inst.dest] != -1)
+                return KIR_ValueName(func, KTemp(inst.dest)) + " is defined twice";
+            def_block[inst.dest] = i;
+            def_pos[inst.dest] = j;
+        }
+    }
+    KDomIntervals dom = KIR_DomIntervals(func);
+    for (int i = 0; i < n; ++i)
+    {
+        if (dom.idom[i] == -1)
+            continue;
+        const KBlock &bb = func.bbs[i];
+        for (size_t j = 0; j < bb.insts.size(); ++j)
+        {
+            const KInst &inst = bb.insts[j];
+            string error;
+            auto check = [&](const KValue &op) {
+                if (op.kind != KV_TEMP || !error.empty())
+                    return;
+                int d = op.v < (int)def_block.size() ? def_block[op.v] : -1;
+                if (d == -1)
+                    error = bb.name + " uses an undefined temp";
+                else if (d == i ? def_pos[op.v] >= (int)j : !dom.Dominates(d, i))
+                    error = "use of " + KIR_ValueName(func, op) + " in " + bb.name + " is not dominated by its definition";
+            };
+            check(inst.lhs);
+            check(inst.rhs);
+            for (auto &arg : inst.args)
+                check(arg);
+            if (!error.empty())
+                return error;
+        }
+    }
+    return "";
+}
+
+// ---------------------------------------------------------------- 输出
+
+static string KIR_ValueName(const KFunc &func, const KValue &value)
+{
+    if (value.kind == KV_IMM)
+        return to_string(value.v);
+    if (value.kind == KV_GLOBAL)
+        return kir_global_names[value.v];
+    assert(value.kind == KV_TEMP);
+    const string &name = func.temp_names[value.v];
+    return name.empty() ? "%" + to_string(value.v) : name;
+}
+
+static void KIR_Dump(const KFunc &func, ostream &os)
+{
+    os << "fun " << func.name << "(";
+    for (size_t i = 0; i < func.params.size(); ++i)
+        os << (i ? ", " : "") << KIR_ValueName(func, KTemp(func.params[i])) << ": " << KIR_TypeName(func.param_types[i]);
+    os << ")" << (func.ret_i32 ? ": i32" : "") << " {\n";
+    for (auto &bb : func.bbs)
+    {
+        os << bb.name << ":\n";
+        for (auto &inst : bb.insts)
+        {
+            os << "  ";
+            if (inst.dest != -1)
+                os << KIR_ValueName(func, KTemp(inst.dest)) << " = ";
+            switch (inst.kind)
+            {
+            case KI_ALLOC:
+                os << "alloc " << KIR_TypeName(inst.type);
+                break;
+            case KI_LOAD:
+                os << "load " << KIR_ValueName(func, inst.lhs);
+                break;
+            case KI_STORE:
+                os << "store " << KIR_ValueName(func, inst.lhs) << ", " << KIR_ValueName(func, inst.rhs);
+                break;
+            case KI_BINARY:
+                os << kir_binary_ops[inst.op] << " " << KIR_ValueName(func, inst.lhs) << ", "
+                   << KIR_ValueName(func, inst.rhs);
+                break;
+            case KI_BRANCH:
+                os << "br " << KIR_ValueName(func, inst.lhs) << ", " << func.bbs[inst.true_bb].name << ", "
+                   << func.bbs[inst.false_bb].name;
+                break;
+            case KI_JUMP:
+                os << "jump " << func.bbs[inst.true_bb].name;
+                break;
+            case KI_RETURN:
+                os << "ret";
+                if (inst.lhs.kind != KV_NONE)
+                    os << " " << KIR_ValueName(func, inst.lhs);
+                break;
+            case KI_CALL:
+                os << "call " << inst.callee << "(";
+                for (size_t i = 0; i < inst.args.size(); ++i)
+                    os << (i ? ", " : "") << KIR_ValueName(func, inst.args[i]);
+                os << ")";
+                break;
+            case KI_GETELEMPTR:
+            case KI_GETPTR:
+                os << (inst.kind == KI_GETPTR ? "getptr " : "getelemptr ") << KIR_ValueName(func, inst.lhs) << ", "
+                   << KIR_ValueName(func, inst.rhs);
+                break;
+            default:
+                assert(false);
+            }
+            os << "\n";
+        }
+    }
+    os << "}\n";
+}
+
+// 从不包含 func 的程序里调用它时用的 "decl" 行
+static string KIR_Signature(const KFunc &func)
+{
+    string sig = "decl " + func.name + "(";
+    for (size_t i = 0; i < func.params.size(); ++i)
+        sig += (i ? ", " : "") + KIR_TypeName(func.param_types[i]);
+    return sig + ")" + (func.ret_i32 ? ": i32" : "");
+}
+
+// 从 init[pos] 开始的 dims[level..] 的初值; 全零的部分
+// 输出成 zeroinit
+static void KIR_DumpInit(const vector<int> &init, const vector<int> &dims, size_t level, size_t pos, ostream &os)
+{
+    if (level == dims.size())
+    {
+        os << init[pos];
+        return;
+    }
+    size_t words = KIR_Words(dims, level);
+    if (all_of(init.begin() + pos, init.begin() + pos + words, [](int v) { return v == 0; }))
+    {
+        os << "zeroinit";
+        return;
+    }
+    os << "{";
+    for (int i = 0; i < dims[level]; ++i)
+    {
+        os << (i ? ", " : "");
+        KIR_DumpInit(init, dims, level + 1, pos + i * KIR_Words(dims, level + 1), os);
+    }
+    os << "}";
+}
+
+static void KIR_Dump(const KGlobalVar &global, ostream &os)
+{
+    os << "global " << global.name << " = alloc " << KIR_TypeName(global.type) << ", ";
+    if (global.init.empty())
+        os << "zeroinit";
+    else
+        KIR_DumpInit(global.init, global.type.dims, 0, 0, os);
+    os << "\n";
+}
+
+static void KIR_Dump(const KProgram &program, ostream &os)
+{
+    for (auto &decl : program.decls)
+        os << decl << "\n";
+    if (!program.decls.empty())
+        os << "\n";
+    for (auto &global : program.globals)
+        KIR_Dump(global, os);
+    if (!program.globals.empty())
+        os << "\n";
+    for (size_t i = 0; i < program.funcs.size(); ++i)
+    {
+        if (i > 0)
+            os << "\n";
+        KIR_Dump(program.funcs[i], os);
+    }
+}
@@ -0,0 +1,1787 @@
+#pragma once
+
+// 在内存里的 Koopa IR (KIR.h) 上跑的优化 pass. 它们在 DumpIR 和后端之间运行,
+// 见 main.cpp
+
+#include <tuple>
+#include <array>
+#include <climits>
+#include <algorithm>
+#include <functional>
+#include <set>
+#include "KIR.h"
+#include "Dataflow.h"
+
+using namespace std;
+
+// 按 32 位 C 的语义计算二元运算. 结果没有定义时 (除以零, INT_MIN / -1)
+// 返回 false, 这时不能折叠
+static bool Opt_FoldBinary(int op, int l, int r, int &result)
+{
+    unsigned ul = l, ur = r;
+    switch (op)
+    {
+    case KB_NE: result = l != r; break;
+    case KB_EQ: result = l == r; break;
+    case KB_GT: result = l > r; break;
+    case KB_LT: result = l < r; break;
+    case KB_GE: result = l >= r; break;
+    case KB_LE: result = l <= r; break;
+    case KB_ADD: result = (int)(ul + ur); break;
+    case KB_SUB: result = (int)(ul - ur); break;
+    case KB_MUL: result = (int)(ul * ur); break;
+    case KB_DIV:
+    case KB_MOD:
+        if (r == 0 || (l == INT_MIN && r == -1))
+            return false;
+        result = op == KB_DIV ? l / r : l % r;
+        break;
+    case KB_AND: result = l & r; break;
+    case KB_OR: result = l | r; break;
+    case KB_XOR: result = l ^ r; break;
+    case KB_SHL: result = (int)(ul << (r & 31)); break;
+    case KB_SHR: result = (int)(ul >> (r & 31)); break;
+    case KB_SAR: result = l >> (r & 31); break;
+    default:
+        return false;
+    }
+    return true;
+}
+
+// 让二元指令等于某个操作数或常数的恒等式,
+// 比如 x + 0, x * 1, x * 0, x - x
+static bool Opt_Simplify(const KInst &inst, KValue &result)
+{
+    const KValue &l = inst.lhs, &r = inst.rhs;
+    bool l_imm = l.kind == KV_IMM, r_imm = r.kind == KV_IMM;
+    switch (inst.op)
+    {
+    case KB_ADD:
+        if (r_imm && r.v == 0) { result = l; return true; }
+        if (l_imm && l.v == 0) { result = r; return true; }
+        break;
+    case KB_SUB:
+        if (r_imm && r.v == 0) { result = l; return true; }
+        if (l == r) { result = KImm(0); return true; }
+        break;
+    case KB_MUL:
+        if ((r_imm && r.v == 0) || (l_imm && l.v == 0)) { result = KImm(0); return true; }
+        if (r_imm && r.v == 1) { result = l; return true; }
+        if (l_imm && l.v == 1) { result = r; return true; }
+        break;
+    case KB_DIV:
+        if (r_imm && r.v == 1) { result = l; return true; }
+        break;
+    case KB_EQ:
+    case KB_GE:
+    case KB_LE:
+        if (l == r) { result = KImm(1); return true; }
+        break;
+    case KB_NE:
+    case KB_GT:
+    case KB_LT:
+        if (l == r) { result = KImm(0); return true; }
+        break;
+    }
+    return false;
+}
+
+// 纯二元表达式的哈希键. 可交换的运算把操作数排好序, gt/ge 改写成 lt/le,
+// 这样 a > b 和 b < a 得到同一个编号
+static tuple<int, KValue, KValue> Opt_ExprKey(const KInst &inst)
+{
+    int op = inst.op;
+    KValue l = inst.lhs, r = inst.rhs;
+    if (op == KB_GT || op == KB_GE)
+    {
+        op = op == KB_GT ? KB_LT : KB_LE;
+        swap(l, r);
+    }
+    bool commutative = op == KB_NE || op == KB_EQ || op == KB_ADD || op == KB_MUL || op == KB_AND ||
+                       op == KB_OR || op == KB_XOR;
+    if (commutative && r < l)
+        swap(l, r);
+    return make_tuple(op, l, r);
+}
+
+// 全局值编号. 纯表达式按支配树分作用域编号, 所以只要第一次计算支配某处,
+// 那里就能直接复用; 地址运算 (getelemptr / getptr) 也一样编号.
+// load 只在中间不可能有对同一个 alloc 的 store 时复用: 块内,
+// 以及只有当前块一个前驱的后继 (扩展基本块). call 可能写全局变量和数组,
+// 所以除了标量 alloc 的 load, 别的都要忘掉
+static void Opt_GVN(KFunc &func)
+{
+    KIR_RemoveUnreachable(func);
+    vector<int> idom = KIR_Dominators(func);
+    vector<vector<int> > children = KIR_DomTree(idom);
+    vector<vector<int> > preds = KIR_Predecessors(func);
+
+    vector<char> is_alloc(func.temp_names.size(), 0);
+    for (auto &bb : func.bbs)
+        for (auto &inst : bb.insts)
+            if (inst.kind == KI_ALLOC)
+                is_alloc[inst.dest] = 1;
+
+    vector<KValue> repl(func.temp_names.size(), KNone());
+    auto resolve = [&](KValue &value) {
+        while (value.kind == KV_TEMP && repl[value.v].kind != KV_NONE)
+            value = repl[value.v];
+    };
+
+    map<tuple<int, KValue, KValue>, int> exprs;
+    vector<tuple<int, KValue, KValue> > undo;
+    struct Frame
+    {
+        int bb;
+        size_t next_child;
+        size_t undo_mark;
+        map<KValue, int> loads; // 地址 -> 块出口处存着它的值的 temp
+    };
+    vector<Frame> stack;
+    stack.push_back({0, 0, 0, map<KValue, int>()});
+
+    auto number_block = [&](Frame &frame) {
+        vector<KInst> kept;
+        for (auto &inst : func.bbs[frame.bb].insts)
+        {
+            for (KValue *op : KIR_Operands(inst))
+                resolve(*op);
+            if (inst.kind == KI_BINARY)
+            {
+                int folded;
+                KValue same;
+                if (inst.lhs.kind == KV_IMM && inst.rhs.kind == KV_IMM &&
+                    Opt_FoldBinary(inst.op, inst.lhs.v, inst.rhs.v, folded))
+                {
+                    repl[inst.dest] = KImm(folded);
+                    continue;
+                }
+                if (Opt_Simplify(inst, same))
+                {
+                    repl[inst.dest] = same;
+                    continue;
+                }
+                auto key = Opt_ExprKey(inst);
+                auto it = exprs.find(key);
+                if (it != exprs.end())
+                {
+                    repl[inst.dest] = KTemp(it->second);
+                    continue;
+                }
+                exprs[key] = inst.dest;
+                undo.push_back(key);
+            }
+            else if (inst.kind == KI_GETELEMPTR || inst.kind == KI_GETPTR)
+            {
+                // getptr p, 0 就是 p; getelemptr p, 0 改变了类型, 留着
+                if (inst.kind == KI_GETPTR && inst.rhs == KImm(0))
+                {
+                    repl[inst.dest] = inst.lhs;
+                    continue;
+                }
+                auto key = make_tuple(-1 - inst.kind, inst.lhs, inst.rhs);
+                auto it = exprs.find(key);
+                if (it != exprs.end())
+                {
+                    repl[inst.dest] = KTemp(it->second);
+                    continue;
+                }
+                exprs[key] = inst.dest;
+                undo.push_back(key);
+            }
+            else if (inst.kind == KI_LOAD)
+            {
+                if (frame.loads.count(inst.lhs))
+                {
+                    repl[inst.dest] = KTemp(frame.loads[inst.lhs]);
+                    continue;
+                }
+                frame.loads[inst.lhs] = inst.dest;
+            }
+            else if (inst.kind == KI_STORE)
+            {
+                if (inst.rhs.kind == KV_TEMP && is_alloc[inst.rhs.v])
+                    frame.loads.erase(inst.rhs);
+                else
+                    frame.loads.clear();
+            }
+            else if (inst.kind == KI_CALL)
+            {
+                for (auto it = frame.loads.begin(); it != frame.loads.end();)
+                {
+                    if (it->first.kind == KV_TEMP && is_alloc[it->first.v])
+                        ++it;
+                    else
+                        it = frame.loads.erase(it);
+                }
+            }
+            kept.push_back(inst);
+        }
+        func.bbs[frame.bb].insts = move(kept);
+    };
+
+    number_block(stack.back());
+    while (!stack.empty())
+    {
+        Frame &frame = stack.back();
+        if (frame.next_child < children[frame.bb].size())
+        {
+            int child = children[frame.bb][frame.next_child++];
+            Frame next = {child, 0, undo.size(), map<KValue, int>()};
+            if (preds[child].size() == 1 && preds[child][0] == frame.bb)
+                next.loads = frame.loads;
+            stack.push_back(move(next));
+            number_block(stack.back());
+        }
+        else
+        {
+            // 离开支配子树: 里面的表达式出了作用域
+            while (undo.size() > frame.undo_mark)
+            {
+                exprs.erase(undo.back());
+                undo.pop_back();
+            }
+            stack.pop_back();
+        }
+    }
+}
+
+// 地址只用作 load 或 store 的指针操作数的 alloc. 别的都读写不到它们,
+// 经过其他指针的 load/store 和 call 也不行, 所以内存相关的 pass 可以精确地跟踪它们
+static vector<char> Opt_TrackedAllocs(const KFunc &func)
+{
+    vector<char> tracked(func.temp_names.size(), 0);
+    for (auto &bb : func.bbs)
+        for (auto &inst : bb.insts)
+            if (inst.kind == KI_ALLOC)
+                tracked[inst.dest] = 1;
+    for (auto &bb : func.bbs)
+        for (auto inst : bb.insts)
+        {
+            vector<KValue *> ops = KIR_Operands(inst);
+            for (size_t i = 0; i < ops.size(); ++i)
+            {
+                bool is_pointer = (inst.kind == KI_LOAD && i == 0) || (inst.kind == KI_STORE && i == 1);
+                if (ops[i]->kind == KV_TEMP && !is_pointer)
+                    tracked[ops[i]->v] = 0;
+            }
+        }
+    return tracked;
+}
+
+// store 到 load 的转发: alloc 的值由前面的 store 或 load 知道时,
+// 对它的 load 换成这个值. 已知的值沿着块往下传,
+// 也传进没有别的前驱的后继
+static void Opt_ForwardStores(KFunc &func, const vector<char> &tracked)
+{
+    vector<vector<int> > preds = KIR_Predecessors(func);
+    vector<map<int, KValue> > exit_state(func.bbs.size());
+    vector<KValue> repl(func.temp_names.size(), KNone());
+    for (int bb : KIR_ReversePostOrder(func))
+    {
+        map<int, KValue> known;
+        if (preds[bb].size() == 1 && preds[bb][0] != bb)
+            known = exit_state[preds[bb][0]];
+        vector<KInst> kept;
+        for (auto &inst : func.bbs[bb].insts)
+        {
+            for (KValue *op : KIR_Operands(inst))
+                while (op->kind == KV_TEMP && repl[op->v].kind != KV_NONE)
+                    *op = repl[op->v];
+            if (inst.kind == KI_LOAD && inst.lhs.kind == KV_TEMP && tracked[inst.lhs.v])
+            {
+                auto it = known.find(inst.lhs.v);
+                if (it != known.end())
+                {
+                    repl[inst.dest] = it->second;
+                    continue;
+                }
+                known[inst.lhs.v] = KTemp(inst.dest);
+            }
+            else if (inst.kind == KI_STORE && inst.rhs.kind == KV_TEMP && tracked[inst.rhs.v])
+                known[inst.rhs.v] = inst.lhs;
+            kept.push_back(inst);
+        }
+        func.bbs[bb].insts = move(kept);
+        exit_state[bb] = move(known);
+    }
+}
+
+// 死 store 消除, 靠对跟踪的 alloc 做的反向活跃分析: 在每条路径上 alloc
+// 都被覆盖或者不再被读时, store 就是死的. 没有任何 load 的 alloc
+// 连同它的 store 一起删掉
+static void Opt_EliminateDeadStores(KFunc &func, const vector<char> &tracked)
+{
+    // 只给跟踪的 alloc 编号, 活跃集合是按字存的位向量 (Dataflow.h)
+    vector<int> slot(func.temp_names.size(), -1);
+    int num_slots = 0;
+    for (size_t t = 0; t < tracked.size(); ++t)
+        if (tracked[t])
+            slot[t] = num_slots++;
+    if (num_slots == 0)
+        return;
+    auto load_slot = [&](const KInst &inst) {
+        return inst.kind == KI_LOAD && inst.lhs.kind == KV_TEMP ? slot[inst.lhs.v] : -1;
+    };
+    auto store_slot = [&](const KInst &inst) {
+        return inst.kind == KI_STORE && inst.rhs.kind == KV_TEMP ? slot[inst.rhs.v] : -1;
+    };
+
+    int n = func.bbs.size();
+    DFGraph graph;
+    graph.succs.resize(n);
+    graph.preds.resize(n);
+    for (int i = 0; i < n; ++i)
+        for (int s : KIR_Successors(func.bbs[i]))
+        {
+            graph.succs[i].push_back(s);
+            graph.preds[s].push_back(i);
+        }
+    DF_ComputeOrder(graph);
+
+    // 每个块的效果: gen = 写之前先读, kill = 写
+    DFProblem live_slots;
+    live_slots.direction = DF_BACKWARD;
+    live_slots.meet = DF_UNION;
+    live_slots.bits = num_slots;
+    live_slots.boundary = DFBits(num_slots);
+    live_slots.gen.assign(n, DFBits(num_slots));
+    live_slots.kill.assign(n, DFBits(num_slots));
+    for (int i = 0; i < n; ++i)
+        for (auto &inst : func.bbs[i].insts)
+        {
+            int l = load_slot(inst), st = store_slot(inst);
+            if (l != -1 && !live_slots.kill[i].Test(l))
+                live_slots.gen[i].Set(l);
+            if (st != -1)
+                live_slots.kill[i].Set(st);
+        }
+    DF_Solve(graph, live_slots);
+
+    vector<char> loaded(func.temp_names.size(), 0);
+    for (int i = 0; i < n; ++i)
+    {
+        DFBits live = live_slots.out[i];
+        vector<KInst> &insts = func.bbs[i].insts;
+        vector<char> dead(insts.size(), 0);
+        for (int j = insts.size() - 1; j >= 0; --j)
+        {
+            int l = load_slot(insts[j]), st = store_slot(insts[j]);
+            if (l != -1)
+            {
+                live.Set(l);
+                loaded[insts[j].lhs.v] = 1;
+            }
+            else if (st != -1)
+            {
+                if (!live.Test(st))
+                    dead[j] = 1;
+                live.Reset(st);
+            }
+        }
+        vector<KInst> kept;
+        for (size_t j = 0; j < insts.size(); ++j)
+            if (!dead[j])
+                kept.push_back(insts[j]);
+        insts = move(kept);
+    }
+
+    // 从不被 load 的 alloc 和它的 store 一起删掉
+    for (auto &bb : func.bbs)
+    {
+        vector<KInst> kept;
+        for (auto &inst : bb.insts)
+        {
+            int alloc = inst.kind == KI_ALLOC ? inst.dest
+                        : inst.kind == KI_STORE && inst.rhs.kind == KV_TEMP ? inst.rhs.v : -1;
+            if (!(alloc != -1 && tracked[alloc] && !loaded[alloc]))
+                kept.push_back(inst);
+        }
+        bb.insts = move(kept);
+    }
+}
+
+static void Opt_MemOpt(KFunc &func)
+{
+    KIR_RemoveUnreachable(func);
+    vector<char> tracked = Opt_TrackedAllocs(func);
+    Opt_ForwardStores(func, tracked);
+    Opt_EliminateDeadStores(func, tracked);
+}
+
+// 删掉结果从没被用到的 load, 运算和地址计算,
+// 重复到不再有新的死代码为止
+static void Opt_DCE(KFunc &func)
+{
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        vector<int> uses(func.temp_names.size(), 0);
+        for (auto &bb : func.bbs)
+            for (auto inst : bb.insts)
+                for (KValue *op : KIR_Operands(inst))
+                    if (op->kind == KV_TEMP)
+                        uses[op->v]++;
+        for (auto &bb : func.bbs)
+        {
+            vector<KInst> kept;
+            for (auto &inst : bb.insts)
+            {
+                if ((inst.kind == KI_BINARY || inst.kind == KI_LOAD || inst.kind == KI_GETELEMPTR ||
+                     inst.kind == KI_GETPTR) && uses[inst.dest] == 0)
+                    changed = true;
+                else
+                    kept.push_back(inst);
+            }
+            bb.insts = move(kept);
+        }
+    }
+}
+
+// 跳转穿透和块合并. 两个目标相同的 br 变成 jump, 跳到只会再跳走的块的
+// jump 直接改到最终目标, 一个块是它 jump 目标的唯一前驱时把目标并进来
+static void Opt_SimplifyCFG(KFunc &func)
+{
+    for (auto &bb : func.bbs)
+    {
+        KInst &term = bb.insts.back();
+        if (term.kind == KI_BRANCH && term.true_bb == term.false_bb)
+        {
+            term.kind = KI_JUMP;
+            term.lhs = KNone();
+            term.false_bb = -1;
+        }
+    }
+
+    int n = func.bbs.size();
+    vector<int> forward(n);
+    for (int i = 0; i < n; ++i)
+    {
+        // 顺着空块链往下走, 遇到环就停
+        int target = i;
+        vector<char> seen(n, 0);
+        while (!seen[target] && target != 0 && func.bbs[target].insts.size() == 1 &&
+               func.bbs[target].insts[0].kind == KI_JUMP)
+        {
+            seen[target] = 1;
+            target = func.bbs[target].insts[0].true_bb;
+        }
+        forward[i] = seen[target] ? i : target;
+    }
+    for (auto &bb : func.bbs)
+    {
+        KInst &term = bb.insts.back();
+        if (term.true_bb != -1)
+            term.true_bb = forward[term.true_bb];
+        if (term.false_bb != -1)
+            term.false_bb = forward[term.false_bb];
+    }
+    KIR_RemoveUnreachable(func);
+
+    vector<vector<int> > preds = KIR_Predecessors(func);
+    for (int bb : KIR_ReversePostOrder(func))
+    {
+        // 并进前驱的块留空
+        while (!func.bbs[bb].insts.empty())
+        {
+            KInst &term = func.bbs[bb].insts.back();
+            int next = term.true_bb;
+            if (term.kind != KI_JUMP || next == bb || next == 0 || preds[next].size() != 1)
+                break;
+            func.bbs[bb].insts.pop_back();
+            vector<KInst> &moved = func.bbs[next].insts;
+            func.bbs[bb].insts.insert(func.bbs[bb].insts.end(), moved.begin(), moved.end());
+            moved.clear();
+            for (int s : KIR_Successors(func.bbs[bb]))
+                for (auto &p : preds[s])
+                    if (p == next)
+                        p = bb;
+        }
+    }
+    vector<KBlock> bbs;
+    vector<int> remap(func.bbs.size(), -1);
+    for (size_t i = 0; i < func.bbs.size(); ++i)
+        if (!func.bbs[i].insts.empty())
+        {
+            remap[i] = bbs.size();
+            bbs.push_back(move(func.bbs[i]));
+        }
+    KIR_RetargetBranches(bbs, remap);
+    func.bbs = move(bbs);
+}
+
+// 稀疏条件常量传播的格
+enum SCCPState
+{
+    SCCP_TOP,    // 还没有信息
+    SCCP_CONST,  // 已知常量
+    SCCP_BOTTOM, // 不是常量
+};
+
+struct SCCPValue
+{
+    int state;
+    int value;
+};
+
+static SCCPValue SCCP_Meet(const SCCPValue &a, const SCCPValue &b)
+{
+    if (a.state == SCCP_TOP)
+        return b;
+    if (b.state == SCCP_TOP)
+        return a;
+    if (a.state == SCCP_CONST && b.state == SCCP_CONST && a.value == b.value)
+        return a;
+    return {SCCP_BOTTOM, 0};
+}
+
+static bool operator!=(const SCCPValue &a, const SCCPValue &b)
+{
+    return a.state != b.state || (a.state == SCCP_CONST && a.value != b.value);
+}
+
+// 稀疏条件常量传播. 除了 temp, 跟踪的 alloc 的内容也在格里, 所以常量能穿过
+// store/load. 只有证明能执行的边才参与块的入口状态; 条件已知的 br 变成 jump,
+// 永远跑不到的分支删掉
+static void Opt_SCCP(KFunc &func)
+{
+    KIR_RemoveUnreachable(func);
+    vector<char> tracked = Opt_TrackedAllocs(func);
+    vector<int> slot(func.temp_names.size(), -1);
+    int num_slots = 0;
+    for (size_t t = 0; t < tracked.size(); ++t)
+        if (tracked[t])
+            slot[t] = num_slots++;
+
+    int n = func.bbs.size();
+    vector<int> rpo = KIR_ReversePostOrder(func);
+    vector<vector<int> > preds = KIR_Predecessors(func);
+    vector<SCCPValue> temps(func.temp_names.size(), {SCCP_TOP, 0});
+    for (int param : func.params)
+        temps[param] = {SCCP_BOTTOM, 0};
+    vector<vector<SCCPValue> > mem_out(n, vector<SCCPValue>(num_slots, {SCCP_TOP, 0}));
+    vector<char> executable(n, 0);
+    // edge_taken[b][0/1]: b 的终结指令的 true / false 边可能执行
+    vector<array<char, 2> > edge_taken(n, {{0, 0}});
+    executable[0] = 1;
+
+    auto lookup = [&](const KValue &value) -> SCCPValue {
+        if (value.kind == KV_IMM)
+            return {SCCP_CONST, value.v};
+        if (value.kind != KV_TEMP)
+            return {SCCP_BOTTOM, 0}; // 全局变量的地址
+        return temps[value.v];
+    };
+
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (int bb : rpo)
+        {
+            if (!executable[bb])
+                continue;
+            // 入口处没初始化的局部变量当作未知值
+            vector<SCCPValue> mem(num_slots, {bb == 0 ? SCCP_BOTTOM : SCCP_TOP, 0});
+            for (int p : preds[bb])
+            {
+                const KInst &term = func.bbs[p].insts.back();
+                bool taken = (term.true_bb == bb && edge_taken[p][0]) || (term.false_bb == bb && edge_taken[p][1]);
+                if (executable[p] && taken)
+                    for (int k = 0; k < num_slots; ++k)
+                        mem[k] = SCCP_Meet(mem[k], mem_out[p][k]);
+            }
+            for (auto &inst : func.bbs[bb].insts)
+            {
+                SCCPValue result = {SCCP_BOTTOM, 0};
+                switch (inst.kind)
+                {
+                case KI_ALLOC:
+                    if (slot[inst.dest] != -1)
+                        mem[slot[inst.dest]] = {SCCP_BOTTOM, 0};
+                    break;
+                case KI_LOAD:
+                    if (inst.lhs.kind == KV_TEMP && slot[inst.lhs.v] != -1)
+                        result = mem[slot[inst.lhs.v]];
+                    break;
+                case KI_STORE:
+                    if (inst.rhs.kind == KV_TEMP && slot[inst.rhs.v] != -1)
+                        mem[slot[inst.rhs.v]] = lookup(inst.lhs);
+                    break;
+                case KI_BINARY:
+                {
+                    SCCPValue l = lookup(inst.lhs), r = lookup(inst.rhs);
+                    int folded;
+                    if (l.state == SCCP_TOP || r.state == SCCP_TOP)
+                        result = {SCCP_TOP, 0};
+                    else if (l.state == SCCP_CONST && r.state == SCCP_CONST &&
+                             Opt_FoldBinary(inst.op, l.value, r.value, folded))
+                        result = {SCCP_CONST, folded};
+                    break;
+                }
+                case KI_BRANCH:
+                {
+                    SCCPValue cond = lookup(inst.lhs);
+                    array<char, 2> taken = edge_taken[bb];
+                    if (cond.state == SCCP_BOTTOM)
+                        taken = {{1, 1}};
+                    else if (cond.state == SCCP_CONST)
+                        taken[cond.value != 0 ? 0 : 1] = 1;
+                    if (taken != edge_taken[bb])
+                    {
+                        edge_taken[bb] = taken;
+                        changed = true;
+                    }
+                    if (taken[0] && !executable[inst.true_bb])
+                        executable[inst.true_bb] = changed = true;
+                    if (taken[1] && !executable[inst.false_bb])
+                        executable[inst.false_bb] = changed = true;
+                    break;
+                }
+                case KI_JUMP:
+                    if (!edge_taken[bb][0])
+                        edge_taken[bb][0] = changed = true;
+                    if (!executable[inst.true_bb])
+                        executable[inst.true_bb] = changed = true;
+                    break;
+                }
+                if (inst.dest != -1 && inst.kind != KI_ALLOC)
+                {
+                    SCCPValue merged = SCCP_Meet(temps[inst.dest], result);
+                    if (merged != temps[inst.dest])
+                    {
+                        temps[inst.dest] = merged;
+                        changed = true;
+                    }
+                }
+            }
+            for (int k = 0; k < num_slots; ++k)
+            {
+                SCCPValue merged = SCCP_Meet(mem_out[bb][k], mem[k]);
+                if (merged != mem_out[bb][k])
+                {
+                    mem_out[bb][k] = merged;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    for (int bb = 0; bb < n; ++bb)
+    {
+        if (!executable[bb])
+            continue;
+        vector<KInst> kept;
+        for (auto &inst : func.bbs[bb].insts)
+        {
+            if ((inst.kind == KI_BINARY || inst.kind == KI_LOAD) && temps[inst.dest].state == SCCP_CONST)
+                continue;
+            for (KValue *op : KIR_Operands(inst))
+                if (op->kind == KV_TEMP && temps[op->v].state == SCCP_CONST)
+                    *op = KImm(temps[op->v].value);
+            if (inst.kind == KI_BRANCH && edge_taken[bb][0] != edge_taken[bb][1])
+            {
+                inst.kind = KI_JUMP;
+                inst.true_bb = edge_taken[bb][0] ? inst.true_bb : inst.false_bb;
+                inst.false_bb = -1;
+                inst.lhs = KNone();
+            }
+            kept.push_back(inst);
+        }
+        func.bbs[bb].insts = move(kept);
+    }
+    KIR_RemoveUnreachable(func);
+    Opt_SimplifyCFG(func);
+}
+
+// ------------------------------------------------------------ 循环相关的 pass
+
+// 返回从循环外跳进循环头的块; 循环头在循环外有多个前驱,
+// 或者唯一的那个还跳到别处时, 新建一个
+static int Opt_Preheader(KFunc &func, const KLoop &loop)
+{
+    vector<vector<int> > preds = KIR_Predecessors(func);
+    vector<int> outside;
+    for (int p : preds[loop.header])
+        if (!binary_search(loop.blocks.begin(), loop.blocks.end(), p))
+            outside.push_back(p);
+    if (outside.size() == 1 && KIR_Successors(func.bbs[outside[0]]).size() == 1)
+        return outside[0];
+
+    int ph = KIR_NewBlock(func, func.bbs[loop.header].name + "_ph");
+    KInst jump;
+    jump.kind = KI_JUMP;
+    jump.true_bb = loop.header;
+    func.bbs[ph].insts.push_back(jump);
+    for (int p : outside)
+    {
+        KInst &term = func.bbs[p].insts.back();
+        if (term.true_bb == loop.header)
+            term.true_bb = ph;
+        if (term.false_bb == loop.header)
+            term.false_bb = ph;
+    }
+    return ph;
+}
+
+// 对每个循环跑 fn, 内层先跑. 途中加的 preheader 会改变循环嵌套, 所以每处理完
+// 一个循环就重新算; 新块加在最后, 循环头的下标不变
+template <typename Fn>
+static void Opt_ForEachLoop(KFunc &func, Fn fn)
+{
+    KIR_RemoveUnreachable(func);
+    int n = func.bbs.size();
+    vector<char> done(n, 0);
+    while (true)
+    {
+        KLoopNest nest = KIR_LoopNest(func);
+        int pick = -1;
+        for (int i = nest.loops.size() - 1; i >= 0 && pick == -1; --i)
+            if (nest.loops[i].header != 0 && !done[nest.loops[i].header])
+                pick = i;
+        if (pick == -1)
+            break;
+        done[nest.loops[pick].header] = 1;
+        fn(nest.loops[pick]);
+    }
+
+    // 新加的 preheader 放回各自循环头的前面, 文本里定义仍然先于使用
+    vector<int> remap(func.bbs.size());
+    vector<KBlock> bbs;
+    for (int i = 0; i < n; ++i)
+    {
+        for (int j = n; j < (int)func.bbs.size(); ++j)
+            if (!func.bbs[j].insts.empty() && func.bbs[j].insts.back().true_bb == i)
+            {
+                remap[j] = bbs.size();
+                bbs.push_back(move(func.bbs[j]));
+            }
+        remap[i] = bbs.size();
+        bbs.push_back(move(func.bbs[i]));
+    }
+    KIR_RetargetBranches(bbs, remap);
+    func.bbs = move(bbs);
+}
+
+// 循环不变量外提. 只用到循环外定义的值的运算和地址计算搬到 preheader.
+// 循环都经过一个守卫进入 (见 while 的翻译), 所以外提的代码只在循环体会执行时才执行;
+// div/mod 仍然只在除数是非零常数时才搬.
+// 后端把跨块的值都写回栈上, 只在本块里用的 load 外提后变成 preheader 里一条 sw 加上
+// 每轮一条 lw, 不比原来好. 所以循环里从不 store 的 alloc 的 load 只在两种情况下外提:
+// 有运算跟着它一起外提 (那个运算在 preheader 里直接用寄存器里的值), 或者它的值本来
+// 就跨块 (原来每轮都要 sw, 外提后这条 sw 也出了循环)
+static void Opt_LICM(KFunc &func)
+{
+    vector<char> tracked = Opt_TrackedAllocs(func);
+    Opt_ForEachLoop(func, [&](const KLoop &loop) {
+        vector<char> in_loop(func.bbs.size(), 0);
+        for (int bb : loop.blocks)
+            in_loop[bb] = 1;
+        size_t num_temps = func.temp_names.size();
+        vector<char> variant(num_temps, 0), stored(num_temps, 0);
+        for (int bb : loop.blocks)
+            for (auto &inst : func.bbs[bb].insts)
+            {
+                if (inst.dest != -1)
+                    variant[inst.dest] = 1;
+                if (inst.kind == KI_STORE && inst.rhs.kind == KV_TEMP && tracked[inst.rhs.v])
+                    stored[inst.rhs.v] = 1;
+            }
+        auto invariant = [&](const KValue &v) { return v.kind != KV_TEMP || !variant[v.v]; };
+
+        // 按 RPO 走, 操作数先于使用者被标记
+        vector<int> order;
+        for (int bb : KIR_ReversePostOrder(func))
+            if (in_loop[bb])
+                order.push_back(bb);
+        vector<char> hoist(num_temps, 0);
+        vector<KInst *> loads;
+        for (int bb : order)
+            for (auto &inst : func.bbs[bb].insts)
+            {
+                bool ok = false;
+                if (inst.kind == KI_BINARY && invariant(inst.lhs) && invariant(inst.rhs))
+                    ok = (inst.op != KB_DIV && inst.op != KB_MOD) || (inst.rhs.kind == KV_IMM && inst.rhs.v != 0);
+                else if ((inst.kind == KI_GETELEMPTR || inst.kind == KI_GETPTR) && invariant(inst.lhs) &&
+                         invariant(inst.rhs))
+                    ok = true;
+                else if (inst.kind == KI_LOAD && invariant(inst.lhs) && inst.lhs.kind == KV_TEMP &&
+                         tracked[inst.lhs.v] && !stored[inst.lhs.v])
+                {
+                    ok = true;
+                    loads.push_back(&inst);
+                }
+                if (ok)
+                {
+                    variant[inst.dest] = 0;
+                    hoist[inst.dest] = 1;
+                }
+            }
+
+        vector<char> crosses(num_temps, 0);
+        vector<int> def_block(num_temps, -1);
+        for (int bb : loop.blocks)
+            for (auto &inst : func.bbs[bb].insts)
+                if (inst.dest != -1)
+                    def_block[inst.dest] = bb;
+        for (int bb = 0; bb < (int)func.bbs.size(); ++bb)
+            for (auto &inst : func.bbs[bb].insts)
+                for (KValue *op : KIR_Operands(inst))
+                    if (op->kind == KV_TEMP && def_block[op->v] != -1 && def_block[op->v] != bb)
+                        crosses[op->v] = 1;
+
+        // 只在本块里用, 又没有外提的运算用到的 load 留在循环里; 这会让用到它的
+        // 运算也留下, 再让别的 load 失去用处, 所以反复做到不再变化
+        for (bool changed = true; changed;)
+        {
+            changed = false;
+            vector<int> hoisted_uses(num_temps, 0);
+            for (int bb : loop.blocks)
+                for (auto &inst : func.bbs[bb].insts)
+                {
+                    if (inst.dest == -1 || !hoist[inst.dest])
+                        continue;
+                    bool operands_moved = true;
+                    for (KValue *op : KIR_Operands(inst))
+                        if (op->kind == KV_TEMP && variant[op->v])
+                            operands_moved = false;
+                    if (!operands_moved)
+                    {
+                        hoist[inst.dest] = 0;
+                        variant[inst.dest] = 1;
+                        changed = true;
+                        continue;
+                    }
+                    for (KValue *op : KIR_Operands(inst))
+                        if (op->kind == KV_TEMP)
+                            hoisted_uses[op->v]++;
+                }
+            for (KInst *load : loads)
+                if (hoist[load->dest] && hoisted_uses[load->dest] == 0 && !crosses[load->dest])
+                {
+                    hoist[load->dest] = 0;
+                    variant[load->dest] = 1;
+                    changed = true;
+                }
+        }
+
+        vector<KInst> hoisted;
+        for (int bb : order)
+        {
+            vector<KInst> kept;
+            for (auto &inst : func.bbs[bb].insts)
+            {
+                if (inst.dest != -1 && hoist[inst.dest])
+                    hoisted.push_back(inst);
+                else
+                    kept.push_back(inst);
+            }
+            func.bbs[bb].insts = move(kept);
+        }
+        if (hoisted.empty())
+            return;
+        int ph = Opt_Preheader(func, loop);
+        vector<KInst> &insts = func.bbs[ph].insts;
+        insts.insert(insts.end() - 1, hoisted.begin(), hoisted.end());
+    });
+}
+
+// ------------------------------------------------------------ 循环展开
+
+// Opt_Unroll 的限制, 由命令行设置 (见 PM_ParseOption).
+// 大小按循环各块里的 KIR 指令数算
+struct UnrollParams
+{
+    int factor = 4;      // 部分展开时每轮跑几份循环体
+    int budget = 160;    // 展开出来的各份加起来最多多少
+    bool report = false; // -unroll-report
+};
+static UnrollParams unroll_params;
+
+// Opt_Unroll 能数清次数的循环: 只有一个回边块, 以
+// "br (test op bound), header, exit" 结尾, test 是归纳变量 iv 在它唯一的更新
+// i = i + step 之后的值, bound 在循环里不变
+struct UnrollShape
+{
+    int latch = -1;
+    int exit = -1;
+    int size = 0;
+    int iv = -1;
+    int step = 0;
+    int op = 0; // test 在左边
+    KValue test = {KV_NONE, 0};
+    KValue bound = {KV_NONE, 0};
+    int bound_alloc = -1; // bound 是对这个 alloc 的 load, 在回边块里又 load 一次
+};
+
+static bool Opt_Dominates(const vector<int> &idom, int a, int b)
+{
+    while (b != a && b != 0 && idom[b] != -1)
+        b = idom[b];
+    return b == a;
+}
+
+// 填好 shape, 或者返回循环为什么不符合
+static string Opt_UnrollShape(const KFunc &func, const KLoop &loop, const vector<char> &tracked,
+                              const vector<int> &idom, UnrollShape &shape)
+{
+    vector<char> in_loop(func.bbs.size(), 0);
+    for (int bb : loop.blocks)
+        in_loop[bb] = 1;
+    if (loop.latches.size() != 1)
+        return "several latches";
+    shape.latch = loop.latches[0];
+    const KInst &term = func.bbs[shape.latch].insts.back();
+    if (term.kind != KI_BRANCH || term.true_bb != loop.header || in_loop[term.false_bb] || term.lhs.kind != KV_TEMP)
+        return "latch is not a conditional back edge";
+    shape.exit = term.false_bb;
+
+    // 每个在循环里定义的 temp 在哪儿, 每个 alloc 在循环里被 store 几次
+    size_t num_temps = func.temp_names.size();
+    vector<pair<int, int> > def(num_temps, make_pair(-1, -1));
+    vector<int> stores(num_temps, 0);
+    pair<int, int> iv_store(-1, -1);
+    for (int bb : loop.blocks)
+    {
+        for (int s : KIR_Successors(func.bbs[bb]))
+            if (!in_loop[s] && !(bb == shape.latch && s == shape.exit))
+                return "several exits";
+        const vector<KInst> &insts = func.bbs[bb].insts;
+        shape.size += insts.size();
+        for (size_t i = 0; i < insts.size(); ++i)
+        {
+            if (insts[i].dest != -1)
+                def[insts[i].dest] = make_pair(bb, (int)i);
+            if (insts[i].kind == KI_STORE && insts[i].rhs.kind == KV_TEMP)
+                stores[insts[i].rhs.v]++;
+        }
+    }
+    auto inst_at = [&](const KValue &v) -> const KInst * {
+        if (v.kind != KV_TEMP || def[v.v].first == -1)
+            return nullptr;
+        return &func.bbs[def[v.v].first].insts[def[v.v].second];
+    };
+    // a 在同一轮里先于 b 执行
+    auto before = [&](pair<int, int> a, pair<int, int> b) {
+        return a.first == b.first ? a.second < b.second : Opt_Dominates(idom, a.first, b.first);
+    };
+
+    const KInst *cond = inst_at(term.lhs);
+    if (cond == nullptr || cond->kind != KI_BINARY || cond->op > KB_LE)
+        return "exit test is not a comparison";
+    static const int swapped[] = {KB_NE, KB_EQ, KB_LT, KB_GT, KB_LE, KB_GE};
+    for (int side = 0; side < 2; ++side)
+    {
+        KValue test = side == 0 ? cond->lhs : cond->rhs, bound = side == 0 ? cond->rhs : cond->lhs;
+        const KInst *t = inst_at(test);
+        if (t == nullptr)
+            continue;
+
+        // test 是更新后的 i: 要么是存进 i 的 add, 要么是更新之后对 i 的 load
+        int iv = -1;
+        pair<int, int> load_pos = def[test.v];
+        if (t->kind == KI_LOAD && t->lhs.kind == KV_TEMP && tracked[t->lhs.v])
+            iv = t->lhs.v;
+        for (int bb : loop.blocks)
+            for (size_t i = 0; i < func.bbs[bb].insts.size(); ++i)
+            {
+                const KInst &inst = func.bbs[bb].insts[i];
+                if (inst.kind != KI_STORE || inst.rhs.kind != KV_TEMP || !tracked[inst.rhs.v])
+                    continue;
+                if (inst.rhs.v == iv || (iv == -1 && inst.lhs == test))
+                {
+                    iv = inst.rhs.v;
+                    iv_store = make_pair(bb, (int)i);
+                }
+            }
+        if (iv == -1 || stores[iv] != 1 || !Opt_Dominates(idom, iv_store.first, shape.latch))
+            continue;
+        const KInst &store = func.bbs[iv_store.first].insts[iv_store.second];
+        if (t->kind == KI_LOAD && !before(iv_store, load_pos))
+            continue;
+
+        const KInst *add = inst_at(store.lhs);
+        if (add == nullptr || add->kind != KI_BINARY)
+            continue;
+        KValue old = add->lhs, k = add->rhs;
+        if (add->op == KB_ADD && old.kind == KV_IMM)
+            swap(old, k);
+        const KInst *load = inst_at(old);
+        if ((add->op != KB_ADD && add->op != KB_SUB) || k.kind != KV_IMM || load == nullptr ||
+            load->kind != KI_LOAD || load->lhs != KTemp(iv) || !before(def[old.v], iv_store))
+            continue;
+        long long step = add->op == KB_ADD ? k.v : -(long long)k.v;
+        if (step == 0 || step < INT_MIN || step > INT_MAX)
+            continue;
+
+        // bound: 常数, 循环外定义的值, 或者循环里不写的 alloc 的 load
+        const KInst *b = inst_at(bound);
+        shape.bound_alloc = -1;
+        if (b != nullptr)
+        {
+            if (b->kind != KI_LOAD || b->lhs.kind != KV_TEMP || !tracked[b->lhs.v] || stores[b->lhs.v] != 0)
+                continue;
+            shape.bound_alloc = b->lhs.v;
+        }
+        shape.iv = iv;
+        shape.step = step;
+        shape.op = side == 0 ? cond->op : swapped[cond->op];
+        shape.test = test;
+        shape.bound = bound;
+        return "";
+    }
+    return "no induction variable in the exit test";
+}
+
+// 控制离开块 bb 时 alloc iv 的值: 顺着唯一前驱往回走,
+// 能找到对它 store 的常数时才有
+static bool Opt_UnrollStart(const KFunc &func, const vector<vector<int> > &preds, int bb, int iv, int &start)
+{
+    for (int hops = 0; hops < 8; ++hops)
+    {
+        const vector<KInst> &insts = func.bbs[bb].insts;
+        for (size_t i = insts.size(); i-- > 0;)
+            if (insts[i].kind == KI_STORE && insts[i].rhs == KTemp(iv))
+            {
+                start = insts[i].lhs.v;
+                return insts[i].lhs.kind == KV_IMM;
+            }
+        if (preds[bb].size() != 1)
+            return false;
+        bb = preds[bb][0];
+    }
+    return false;
+}
+
+// 为复制循环做准备: 循环里的 alloc 搬到入口块, 每一份用同样的变量;
+// 循环里定义, 循环后用到的 temp 经过一个 alloc 传出去, 因为复制之后
+// 它的定义不再支配那些使用
+static void Opt_UnrollPrepare(KFunc &func, const KLoop &loop)
+{
+    vector<char> in_loop(func.bbs.size(), 0), defined(func.temp_names.size(), 0);
+    for (int bb : loop.blocks)
+        in_loop[bb] = 1;
+    vector<KInst> allocs;
+    for (int bb : loop.blocks)
+    {
+        vector<KInst> kept;
+        for (auto &inst : func.bbs[bb].insts)
+        {
+            if (inst.kind == KI_ALLOC)
+                allocs.push_back(inst);
+            else
+                kept.push_back(inst);
+            if (inst.dest != -1)
+                defined[inst.dest] = 1;
+        }
+        func.bbs[bb].insts = move(kept);
+    }
+
+    map<int, int> slots; // temp -> alloc
+    for (size_t bb = 0; bb < func.bbs.size(); ++bb)
+    {
+        if (in_loop[bb])
+            continue;
+        map<int, int> reloaded;
+        vector<KInst> loads;
+        for (auto &inst : func.bbs[bb].insts)
+            for (KValue *op : KIR_Operands(inst))
+            {
+                if (op->kind != KV_TEMP || !defined[op->v])
+                    continue;
+                if (!reloaded.count(op->v))
+                {
+                    if (!slots.count(op->v))
+                    {
+                        KInst alloc;
+                        alloc.kind = KI_ALLOC;
+                        alloc.dest = KIR_NewTemp(func);
+                        allocs.push_back(alloc);
+                        slots[op->v] = alloc.dest;
+                    }
+                    KInst load;
+                    load.kind = KI_LOAD;
+                    load.dest = KIR_NewTemp(func);
+                    load.lhs = KTemp(slots[op->v]);
+                    loads.push_back(load);
+                    reloaded[op->v] = load.dest;
+                }
+                *op = KTemp(reloaded[op->v]);
+            }
+        vector<KInst> &insts = func.bbs[bb].insts;
+        insts.insert(insts.begin(), loads.begin(), loads.end());
+    }
+    for (int bb : loop.blocks)
+    {
+        vector<KInst> out;
+        for (auto &inst : func.bbs[bb].insts)
+        {
+            out.push_back(inst);
+            if (inst.dest != -1 && slots.count(inst.dest))
+            {
+                KInst store;
+                store.kind = KI_STORE;
+                store.lhs = KTemp(inst.dest);
+                store.rhs = KTemp(slots[inst.dest]);
+                out.push_back(store);
+            }
+        }
+        func.bbs[bb].insts = move(out);
+    }
+    vector<KInst> &entry = func.bbs[0].insts;
+    entry.insert(entry.begin(), allocs.begin(), allocs.end());
+}
+
+// 在后面加一份循环的块. 循环里的跳转指向复制出的块, 跳出循环的保持不变;
+// temp_map 给出循环里定义的每个 temp 的副本. 返回每个块的副本
+static vector<int> Opt_CloneLoop(KFunc &func, const KLoop &loop, const string &suffix, vector<KValue> &temp_map)
+{
+    temp_map.assign(func.temp_names.size(), KNone());
+    vector<int> block_map(func.bbs.size(), -1);
+    for (int bb : loop.blocks)
+        for (auto &inst : func.bbs[bb].insts)
+            if (inst.dest != -1)
+                temp_map[inst.dest] = KTemp(KIR_NewTemp(func));
+    for (int bb : loop.blocks)
+        block_map[bb] = KIR_NewBlock(func, func.bbs[bb].name + suffix);
+    for (int bb : loop.blocks)
+    {
+        vector<KInst> insts = func.bbs[bb].insts;
+        for (auto &inst : insts)
+        {
+            for (KValue *op : KIR_Operands(inst))
+                if (op->kind == KV_TEMP && temp_map[op->v].kind != KV_NONE)
+                    *op = temp_map[op->v];
+            if (inst.dest != -1)
+                inst.dest = temp_map[inst.dest].v;
+            if (inst.true_bb != -1 && block_map[inst.true_bb] != -1)
+                inst.true_bb = block_map[inst.true_bb];
+            if (inst.false_bb != -1 && block_map[inst.false_bb] != -1)
+                inst.false_bb = block_map[inst.false_bb];
+        }
+        func.bbs[block_map[bb]].insts = move(insts);
+    }
+    return block_map;
+}
+
+static KInst Opt_MakeBinary(KFunc &func, int op, KValue lhs, KValue rhs)
+{
+    KInst inst;
+    inst.kind = KI_BINARY;
+    inst.op = op;
+    inst.dest = KIR_NewTemp(func);
+    inst.lhs = lhs;
+    inst.rhs = rhs;
+    return inst;
+}
+
+// 展开一个最内层循环; 返回做了什么, 给 -unroll-report 用
+static string Opt_UnrollLoop(KFunc &func, const KLoop &loop)
+{
+    vector<char> tracked = Opt_TrackedAllocs(func);
+    vector<int> idom = KIR_Dominators(func);
+    UnrollShape shape;
+    string reject = Opt_UnrollShape(func, loop, tracked, idom, shape);
+    if (!reject.empty())
+        return "not unrolled: " + reject;
+    int budget = unroll_params.budget, size = shape.size;
+    int ph = Opt_Preheader(func, loop);
+
+    // 次数已知: 从 i 的初值开始按 32 位回绕逐轮算退出条件
+    int trips = 0, start;
+    if (shape.bound.kind == KV_IMM && Opt_UnrollStart(func, KIR_Predecessors(func), ph, shape.iv, start))
+    {
+        uint32_t i = start;
+        for (int t = 1; t * size <= budget && trips == 0; ++t)
+        {
+            i += (uint32_t)shape.step;
+            int go = 0;
+            Opt_FoldBinary(shape.op, (int)i, shape.bound.v, go);
+            if (!go)
+                trips = t;
+        }
+    }
+
+    // 否则每轮跑 factor 份, 进入前检查 i + (factor - 1) * step 仍然满足条件,
+    // 即 i op bound - span. 剩下的不到 factor 轮交给原来的循环
+    int factor = min(unroll_params.factor, budget / max(size, 1));
+    long long span = (long long)(factor - 1) * shape.step;
+    bool monotonic = ((shape.op == KB_LT || shape.op == KB_LE) && shape.step > 0) ||
+                     ((shape.op == KB_GT || shape.op == KB_GE) && shape.step < 0);
+    if (trips == 0)
+    {
+        if (factor < 2)
+            return "not unrolled: size " + to_string(size) + " over budget";
+        if (!monotonic)
+            return "not unrolled: trip count unknown and exit test not monotonic";
+        if (span < INT_MIN || span > INT_MAX ||
+            (shape.bound.kind == KV_IMM && (shape.bound.v - span < INT_MIN || shape.bound.v - span > INT_MAX)))
+            return "not unrolled: bound too close to overflow";
+    }
+
+    Opt_UnrollPrepare(func, loop);
+    string header = func.bbs[loop.header].name;
+    int copies = trips != 0 ? trips : factor;
+    // 检查块先建, 文本上在各份前面, 它算出的 lim 先定义后使用
+    int check = trips != 0 ? -1 : KIR_NewBlock(func, header + "_ucheck");
+    int first = -1, pending = ph; // pending 的最后一条跳到下一份的入口
+    vector<KValue> temp_map;
+    for (int c = 1; c <= copies; ++c)
+    {
+        vector<int> block_map = Opt_CloneLoop(func, loop, "_u" + to_string(c), temp_map);
+        int head = block_map[loop.header], latch = block_map[shape.latch];
+        if (first == -1)
+            first = head;
+        func.bbs[pending].insts.back().true_bb = head;
+        KInst &term = func.bbs[latch].insts.back();
+        term = KInst();
+        term.kind = KI_JUMP;
+        term.true_bb = shape.exit;
+        pending = latch;
+    }
+    if (trips != 0)
+        return "unrolled fully: " + to_string(trips) + " trips, size " + to_string(size) + " -> " +
+               to_string(trips * size);
+
+    func.bbs[ph].insts.back().true_bb = check;
+    KValue bound = shape.bound, lim, enter;
+    vector<KInst> &guard = func.bbs[check].insts;
+    if (shape.bound_alloc != -1)
+    {
+        KInst load;
+        load.kind = KI_LOAD;
+        load.dest = KIR_NewTemp(func);
+        load.lhs = KTemp(shape.bound_alloc);
+        guard.push_back(load);
+        bound = KTemp(load.dest);
+    }
+    KInst cur;
+    cur.kind = KI_LOAD;
+    cur.dest = KIR_NewTemp(func);
+    cur.lhs = KTemp(shape.iv);
+    guard.push_back(cur);
+    if (bound.kind == KV_IMM)
+    {
+        lim = KImm(bound.v - span);
+        guard.push_back(Opt_MakeBinary(func, shape.op, KTemp(cur.dest), lim));
+        enter = KTemp(guard.back().dest);
+    }
+    else
+    {
+        // bound - span 回绕时不进展开的循环
+        guard.push_back(Opt_MakeBinary(func, KB_SUB, bound, KImm(span)));
+        lim = KTemp(guard.back().dest);
+        guard.push_back(Opt_MakeBinary(func, shape.step > 0 ? KB_LT : KB_GT, lim, bound));
+        int no_wrap = guard.back().dest;
+        guard.push_back(Opt_MakeBinary(func, shape.op, KTemp(cur.dest), lim));
+        guard.push_back(Opt_MakeBinary(func, KB_AND, KTemp(guard.back().dest), KTemp(no_wrap)));
+        enter = KTemp(guard.back().dest);
+    }
+    KInst br;
+    br.kind = KI_BRANCH;
+    br.lhs = enter;
+    br.true_bb = first;
+    br.false_bb = loop.header;
+    guard.push_back(br);
+
+    // 最后一份: 还够 factor 轮就回到第一份, 否则到 rest 按原来的条件决定进不进原循环
+    int rest = KIR_NewBlock(func, header + "_urest");
+    vector<KInst> &tail = func.bbs[pending].insts;
+    KValue cond = temp_map[func.bbs[shape.latch].insts.back().lhs.v];
+    tail.back() = Opt_MakeBinary(func, shape.op, temp_map[shape.test.v], lim);
+    br.lhs = KTemp(tail.back().dest);
+    br.true_bb = first;
+    br.false_bb = rest;
+    tail.push_back(br);
+    br.lhs = cond;
+    br.true_bb = loop.header;
+    br.false_bb = shape.exit;
+    func.bbs[rest].insts.push_back(br);
+    return "unrolled by " + to_string(factor) + " with remainder, size " + to_string(size) + " -> " +
+           to_string(factor * size + size);
+}
+
+// 循环展开. 由归纳变量计数的最内层循环会被复制: 次数是已知常数并且
+// 复制出来的不超过 unroll_params.budget 时完全展开, 否则每轮复制
+// unroll_params.factor 份, 原来的循环留下来跑剩下的几轮.
+// 后面的 pass 会合并这些副本, 在它们之间转发变量
+static void Opt_Unroll(KFunc &func)
+{
+    KIR_RemoveUnreachable(func);
+    int n = func.bbs.size();
+    KLoopNest nest = KIR_LoopNest(func);
+    vector<vector<int> > placed_before(n);
+    for (int l = 0; l < (int)nest.loops.size(); ++l)
+    {
+        const KLoop &loop = nest.loops[l];
+        bool innermost = true;
+        for (auto &other : nest.loops)
+            innermost = innermost && other.parent != l;
+        if (!innermost || loop.header == 0)
+            continue;
+        string header = func.bbs[loop.header].name;
+        int first_new = func.bbs.size();
+        string result = Opt_UnrollLoop(func, loop);
+        if (unroll_params.report)
+            cerr << header << " in " << func.name << ": " << result << endl;
+        for (int bb = first_new; bb < (int)func.bbs.size(); ++bb)
+            placed_before[loop.header].push_back(bb);
+    }
+
+    // 新块放在各自循环头的前面; 完全展开后原来的循环不可达, 一并删掉
+    vector<int> remap(func.bbs.size());
+    vector<KBlock> bbs;
+    for (int i = 0; i < n; ++i)
+    {
+        for (int bb : placed_before[i])
+        {
+            remap[bb] = bbs.size();
+            bbs.push_back(move(func.bbs[bb]));
+        }
+        remap[i] = bbs.size();
+        bbs.push_back(move(func.bbs[i]));
+    }
+    KIR_RetargetBranches(bbs, remap);
+    func.bbs = move(bbs);
+    KIR_RemoveUnreachable(func);
+}
+
+// ------------------------------------------------------------ profile
+
+// -fprofile-use 读进来的块执行次数, 见 PM_ParseOption. 没给时为空,
+// 下面的 pass 就不改 IR
+static KProfile opt_profile;
+
+// 按 profile 排块. 从入口开始, 每个块后面跟它最热的还没排的后继, 热路径
+// 顺着往下走, 后端可以省掉跳转; 一条链断了就从剩下最热的块开始下一条,
+// 从没执行过的块就到了最后. 块只排在它的直接支配者之后: 后端要求
+// 文本里值的定义在使用之前
+static void Opt_ProfileLayout(KFunc &func)
+{
+    if (!opt_profile.Has(func))
+        return;
+    int n = func.bbs.size();
+    vector<int> idom = KIR_Dominators(func);
+    vector<long> count(n);
+    for (int i = 0; i < n; ++i)
+        count[i] = opt_profile.Count(func, i);
+    vector<char> placed(n, 0);
+    auto ready = [&](int bb) { return !placed[bb] && (idom[bb] == -1 || placed[idom[bb]]); };
+
+    vector<int> order = {0};
+    placed[0] = 1;
+    while ((int)order.size() < n)
+    {
+        int next = -1;
+        for (int s : KIR_Successors(func.bbs[order.back()]))
+            if (ready(s) && (next == -1 || count[s] > count[next]))
+                next = s;
+        if (next == -1)
+            for (int i = 0; i < n; ++i)
+                if (ready(i) && (next == -1 || count[i] > count[next]))
+                    next = i;
+        placed[next] = 1;
+        order.push_back(next);
+    }
+
+    vector<int> remap(n);
+    vector<KBlock> bbs;
+    for (int bb : order)
+    {
+        remap[bb] = bbs.size();
+        bbs.push_back(move(func.bbs[bb]));
+    }
+    KIR_RetargetBranches(bbs, remap);
+    func.bbs = move(bbs);
+}
+
+// ------------------------------------------------------------ 内联
+
+// Opt_Inline 的代价模型. 被调函数的大小减去调用本身的开销和这个调用点
+// 预计能折叠掉的部分, 不超过 threshold 就内联. 由命令行设置, 见
+// PM_ParseOption. 有 profile 时热的调用点有加成, 从没执行过的调用点只在
+// 内联后能删掉被调函数时才内联
+struct InlineParams
+{
+    int threshold = 30;          // 每个调用点允许增加的指令数
+    int const_arg_bonus = 8;     // 每个常数实参, 预计能折叠掉
+    int single_site_bonus = 60;  // 内联之后被调函数就没了
+    int max_caller_size = 5000;  // 调用者超过这么大就不再内联进去
+    int hot_bonus = 60;          // 调用点执行次数至少是最热块的 hot_percent%
+    int hot_percent = 1;
+    bool report = false;         // -inline-report
+};
+static InlineParams inline_params;
+
+// 自底向上的调用图: 被调函数在调用者前面,
+// recursive[f] 标出能调用到自己的函数
+static vector<int> Opt_CallGraphOrder(const KProgram &program, vector<char> &recursive)
+{
+    int n = program.funcs.size();
+    map<string, int> index;
+    for (int i = 0; i < n; ++i)
+        index[program.funcs[i].name] = i;
+    vector<vector<int> > callees(n);
+    for (int i = 0; i < n; ++i)
+        for (auto &bb : program.funcs[i].bbs)
+            for (auto &inst : bb.insts)
+                if (inst.kind == KI_CALL && index.count(inst.callee))
+                    callees[i].push_back(index[inst.callee]);
+
+    // Tarjan; 强连通分量按被调函数在前的顺序出来
+    vector<int> order, low(n), num(n, -1), stack;
+    vector<char> on_stack(n, 0);
+    recursive.assign(n, 0);
+    int counter = 0;
+    function<void(int)> visit = [&](int f) {
+        num[f] = low[f] = counter++;
+        stack.push_back(f);
+        on_stack[f] = 1;
+        for (int g : callees[f])
+        {
+            if (num[g] == -1)
+            {
+                visit(g);
+                low[f] = min(low[f], low[g]);
+            }
+            else if (on_stack[g])
+                low[f] = min(low[f], num[g]);
+            if (g == f)
+                recursive[f] = 1;
+        }
+        if (low[f] != num[f])
+            return;
+        vector<int> scc;
+        int g;
+        do
+        {
+            g = stack.back();
+            stack.pop_back();
+            on_stack[g] = 0;
+            scc.push_back(g);
+        } while (g != f);
+        for (int h : scc)
+        {
+            recursive[h] = recursive[h] || scc.size() > 1;
+            order.push_back(h);
+        }
+    };
+    for (int i = 0; i < n; ++i)
+        if (num[i] == -1)
+            visit(i);
+    return order;
+}
+
+// 把 caller.bbs[bb].insts[pos] 处的调用换成 callee 的一份副本.
+// 块在调用之后拆开, 被调函数的块放在两半中间, 文本里定义仍然先于使用.
+// 每个 ret 跳到后半块, 有多个 ret 时返回值经过一个 alloc 传过去
+static void Opt_InlineCall(KFunc &caller, int bb, int pos, const KFunc &callee)
+{
+    int n = caller.bbs.size();
+    KInst call = caller.bbs[bb].insts[pos];
+    string prefix = "%" + callee.name.substr(1) + "_";
+
+    set<string> taken(caller.temp_names.begin(), caller.temp_names.end());
+    auto unique_name = [&](const string &name) {
+        string unique = name;
+        for (int i = 1; taken.count(unique); ++i)
+            unique = name + "_" + to_string(i);
+        taken.insert(unique);
+        return unique;
+    };
+
+    vector<KValue> temp_map(callee.temp_names.size(), KNone());
+    for (size_t i = 0; i < callee.params.size(); ++i)
+        temp_map[callee.params[i]] = call.args[i];
+    for (size_t i = 0; i < callee.temp_names.size(); ++i)
+        if (temp_map[i].kind == KV_NONE)
+        {
+            const string &name = callee.temp_names[i];
+            temp_map[i] = KTemp(KIR_NewTemp(caller, name.empty() ? "" : unique_name(name)));
+        }
+    vector<int> block_map(callee.bbs.size());
+    for (size_t i = 0; i < callee.bbs.size(); ++i)
+        block_map[i] = KIR_NewBlock(caller, prefix + callee.bbs[i].name.substr(1));
+    int cont = KIR_NewBlock(caller, prefix + "cont");
+
+    int rets = 0;
+    for (auto &cbb : callee.bbs)
+        rets += cbb.insts.back().kind == KI_RETURN;
+    KValue ret_slot = KNone();
+    if (call.dest != -1 && rets > 1)
+    {
+        KInst alloc;
+        alloc.kind = KI_ALLOC;
+        alloc.dest = KIR_NewTemp(caller, unique_name("@" + callee.name.substr(1) + "_ret"));
+        caller.bbs[0].insts.insert(caller.bbs[0].insts.begin(), alloc);
+        ret_slot = KTemp(alloc.dest);
+        if (bb == 0)
+            pos++;
+    }
+
+    vector<KValue> repl(caller.temp_names.size(), KNone());
+    for (size_t i = 0; i < callee.bbs.size(); ++i)
+    {
+        vector<KInst> insts;
+        for (KInst inst : callee.bbs[i].insts)
+        {
+            for (KValue *op : KIR_Operands(inst))
+                if (op->kind == KV_TEMP)
+                    *op = temp_map[op->v];
+            if (inst.dest != -1)
+                inst.dest = temp_map[inst.dest].v;
+            if (inst.true_bb != -1)
+                inst.true_bb = block_map[inst.true_bb];
+            if (inst.false_bb != -1)
+                inst.false_bb = block_map[inst.false_bb];
+            if (inst.kind == KI_RETURN)
+            {
+                if (call.dest != -1 && ret_slot.kind != KV_NONE)
+                {
+                    KInst store;
+                    store.kind = KI_STORE;
+                    store.lhs = inst.lhs;
+                    store.rhs = ret_slot;
+                    insts.push_back(store);
+                }
+                else if (call.dest != -1)
+                    repl[call.dest] = inst.lhs;
+                inst = KInst();
+                inst.kind = KI_JUMP;
+                inst.true_bb = cont;
+            }
+            insts.push_back(inst);
+        }
+        caller.bbs[block_map[i]].insts = move(insts);
+    }
+
+    vector<KInst> &head = caller.bbs[bb].insts;
+    vector<KInst> tail(head.begin() + pos + 1, head.end());
+    head.resize(pos);
+    KInst jump;
+    jump.kind = KI_JUMP;
+    jump.true_bb = block_map[0];
+    head.push_back(jump);
+    if (ret_slot.kind != KV_NONE)
+    {
+        KInst load;
+        load.kind = KI_LOAD;
+        load.dest = call.dest;
+        load.lhs = ret_slot;
+        tail.insert(tail.begin(), load);
+    }
+    caller.bbs[cont].insts = move(tail);
+    KIR_ReplaceUses(caller, repl);
+
+    // 新块放在被拆开的块后面
+    vector<int> remap(caller.bbs.size());
+    vector<KBlock> bbs;
+    for (int i = 0; i < n; ++i)
+    {
+        remap[i] = bbs.size();
+        bbs.push_back(move(caller.bbs[i]));
+        if (i == bb)
+            for (int j = n; j < (int)caller.bbs.size(); ++j)
+            {
+                remap[j] = bbs.size();
+                bbs.push_back(move(caller.bbs[j]));
+            }
+    }
+    KIR_RetargetBranches(bbs, remap);
+    caller.bbs = move(bbs);
+}
+
+// 自底向上的内联. 调用者在被调函数之后处理, 所以复制的是已经内联过的
+// 被调函数; 递归函数从不内联. 内联后没有调用者的函数删掉
+static void Opt_Inline(KProgram &program)
+{
+    vector<char> recursive;
+    vector<int> order = Opt_CallGraphOrder(program, recursive);
+    map<string, int> index, sites;
+    for (size_t i = 0; i < program.funcs.size(); ++i)
+        index[program.funcs[i].name] = i;
+    for (auto &func : program.funcs)
+        for (auto &bb : func.bbs)
+            for (auto &inst : bb.insts)
+                if (inst.kind == KI_CALL)
+                    sites[inst.callee]++;
+
+    vector<char> inlined(program.funcs.size(), 0);
+    int total = 0;
+    for (int f : order)
+    {
+        KFunc &caller = program.funcs[f];
+        for (size_t bb = 0; bb < caller.bbs.size(); ++bb)
+            for (size_t pos = 0; pos < caller.bbs[bb].insts.size(); ++pos)
+            {
+                const KInst &call = caller.bbs[bb].insts[pos];
+                if (call.kind != KI_CALL || !index.count(call.callee))
+                    continue;
+                int g = index[call.callee];
+                const KFunc &callee = program.funcs[g];
+                int size = KIR_CountInsts(callee), const_args = 0;
+                for (auto &arg : call.args)
+                    const_args += arg.kind == KV_IMM;
+                bool single = sites[callee.name] == 1 && callee.name != "@main";
+                long count = opt_profile.Count(caller, bb);
+                bool hot = count > 0 && count * 100 >= opt_profile.max_count * inline_params.hot_percent;
+                int cost = size - ((int)call.args.size() + 2) - const_args * inline_params.const_arg_bonus -
+                           (single ? inline_params.single_site_bonus : 0) - (hot ? inline_params.hot_bonus : 0);
+                string reason;
+                if (recursive[g])
+                    reason = "recursive";
+                else if (count == 0 && !single)
+                    reason = "never executed";
+                else if (KIR_CountInsts(caller) + size > inline_params.max_caller_size)
+                    reason = "caller too large";
+                else if (cost > inline_params.threshold)
+                    reason = "cost " + to_string(cost) + " > " + to_string(inline_params.threshold);
+                if (inline_params.report)
+                    cerr << (reason.empty() ? "inlined " : "not inlined ") << callee.name << " into " << caller.name
+                         << ": size " << size << ", const args " << const_args << ", sites " << sites[callee.name]
+                         << (count >= 0 ? ", count " + to_string(count) : "")
+                         << (reason.empty() ? ", cost " + to_string(cost) : " (" + reason + ")") << endl;
+                if (!reason.empty())
+                    continue;
+
+                sites[callee.name]--;
+                for (auto &cbb : callee.bbs)
+                    for (auto &inst : cbb.insts)
+                        if (inst.kind == KI_CALL)
+                            sites[inst.callee]++;
+                Opt_InlineCall(caller, bb, pos, callee);
+                inlined[g] = 1;
+                total++;
+                // 拆出来的后半块紧跟在被调函数的块后面, 下一轮外层循环会扫到它
+                break;
+            }
+    }
+
+    vector<KFunc> kept;
+    for (size_t i = 0; i < program.funcs.size(); ++i)
+    {
+        KFunc &func = program.funcs[i];
+        if (inlined[i] && sites[func.name] == 0 && func.name != "@main")
+        {
+            if (inline_params.report)
+                cerr << "removed " << func.name << endl;
+            continue;
+        }
+        kept.push_back(move(func));
+    }
+    program.funcs = move(kept);
+    if (inline_params.report)
+        cerr << "inlined " << total << " call sites" << endl;
+}
+
+// ------------------------------------------------------------ 尾递归
+
+// 自递归的尾调用 ("call @f(...)" 紧接着 ret 它的结果) 变成跳回函数体开头.
+// 参数搬进新入口块里建的 alloc, 每个尾调用不再调用, 而是把实参存到那里;
+// 后面 memopt 会再把它们转发掉. 传了函数自己的数组的调用不动:
+// 每层递归都有那个数组自己的一份
+static void Opt_TailRecursion(KFunc &func)
+{
+    vector<const KInst *> defs(func.temp_names.size(), nullptr);
+    for (auto &bb : func.bbs)
+        for (auto &inst : bb.insts)
+            if (inst.dest != -1)
+                defs[inst.dest] = &inst;
+    auto local_array = [&](KValue v) {
+        while (v.kind == KV_TEMP && defs[v.v] &&
+               (defs[v.v]->kind == KI_GETELEMPTR || defs[v.v]->kind == KI_GETPTR))
+            v = defs[v.v]->lhs;
+        return v.kind == KV_TEMP && defs[v.v] && defs[v.v]->kind == KI_ALLOC;
+    };
+
+    vector<pair<int, int> > sites; // (块, 调用的位置)
+    for (size_t bb = 0; bb < func.bbs.size(); ++bb)
+    {
+        const vector<KInst> &insts = func.bbs[bb].insts;
+        for (size_t i = 0; i + 1 < insts.size(); ++i)
+        {
+            const KInst &call = insts[i], &ret = insts[i + 1];
+            if (call.kind != KI_CALL || call.callee != func.name || ret.kind != KI_RETURN ||
+                !(call.dest == -1 ? ret.lhs.kind == KV_NONE : ret.lhs == KTemp(call.dest)))
+                continue;
+            bool own_array = false;
+            for (auto &arg : call.args)
+                own_array = own_array || local_array(arg);
+            if (!own_array)
+                sites.push_back(make_pair(bb, i));
+        }
+    }
+    if (sites.empty())
+        return;
+
+    int n = func.bbs.size();
+    int body = KIR_NewBlock(func, "%tail_recurse");
+    vector<int> slots;
+    for (size_t i = 0; i < func.params.size(); ++i)
+        slots.push_back(KIR_NewTemp(func));
+    for (auto &site : sites)
+    {
+        vector<KInst> &insts = func.bbs[site.first].insts;
+        KInst call = insts[site.second];
+        insts.resize(site.second);
+        for (size_t i = 0; i < slots.size(); ++i)
+        {
+            KInst store;
+            store.kind = KI_STORE;
+            store.lhs = call.args[i];
+            store.rhs = KTemp(slots[i]);
+            insts.push_back(store);
+        }
+        KInst jump;
+        jump.kind = KI_JUMP;
+        jump.true_bb = body;
+        insts.push_back(jump);
+    }
+
+    // 新的入口块存参数, 原来的入口块成了循环头, 开头从 alloc 里读参数
+    vector<KInst> entry, head;
+    vector<KValue> repl(func.temp_names.size(), KNone());
+    for (auto &inst : func.bbs[0].insts)
+        (inst.kind == KI_ALLOC ? entry : head).push_back(inst);
+    for (size_t i = 0; i < slots.size(); ++i)
+    {
+        KInst alloc, store, load;
+        alloc.kind = KI_ALLOC;
+        alloc.dest = slots[i];
+        alloc.type = func.param_types[i];
+        store.kind = KI_STORE;
+        store.lhs = KTemp(func.params[i]);
+        store.rhs = KTemp(slots[i]);
+        load.kind = KI_LOAD;
+        load.dest = KIR_NewTemp(func);
+        load.lhs = KTemp(slots[i]);
+        entry.push_back(alloc);
+        entry.push_back(store);
+        head.insert(head.begin() + i, load);
+        repl[func.params[i]] = KTemp(load.dest);
+    }
+    func.bbs[0].insts.clear();
+    func.bbs[body].insts = move(head);
+    KIR_ReplaceUses(func, repl);
+    KInst jump;
+    jump.kind = KI_JUMP;
+    jump.true_bb = body;
+    entry.push_back(jump);
+    func.bbs[0].insts = move(entry);
+
+    // 循环体紧跟在新的入口块后面
+    vector<int> remap(func.bbs.size());
+    vector<KBlock> bbs;
+    bbs.push_back(move(func.bbs[0]));
+    bbs.push_back(move(func.bbs[body]));
+    for (int i = 1; i < n; ++i)
+    {
+        remap[i] = bbs.size();
+        bbs.push_back(move(func.bbs[i]));
+    }
+    remap[0] = 0;
+    remap[body] = 1;
+    KIR_RetargetBranches(bbs, remap);
+    func.bbs = move(bbs);
+}
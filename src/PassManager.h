@@ -0,0 +1,210 @@
+#pragma once
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "KIR.h"
+#include "Opt.h"
+
+using namespace std;
+
+// 在 DumpIR 和后端之间对 KIR 跑的优化流水线
+// 每个 pass 要么按函数运行, 要么需要看到整个程序 (比如以后的内联)
+
+struct Pass
+{
+    string name;
+    int min_level;                  // 从哪个 -O 等级开始默认开启
+    void (*run_func)(KFunc &);      // 按函数运行
+    void (*run_program)(KProgram &); // 按程序运行
+};
+
+struct PassOptions
+{
+    int opt_level = 0; // 不给 -O 时不优化, 和以前的默认行为一样
+    bool time_passes = false;
+    bool verify_ir = false;
+    vector<pair<string, bool> > toggles; // -f<pass> / -fno-<pass>, 按出现顺序生效
+};
+
+// 流水线按顺序执行; 同一个 pass 可以出现多次 (-O2 下再跑一轮清理)
+static vector<Pass> PM_Pipeline()
+{
+    return {
+        {"tailrec", 1, Opt_TailRecursion, nullptr},
+        {"inline", 1, nullptr, Opt_Inline},
+        {"sccp", 1, Opt_SCCP, nullptr},
+        {"memopt", 1, Opt_MemOpt, nullptr},
+        {"gvn", 1, Opt_GVN, nullptr},
+        {"licm", 1, Opt_LICM, nullptr},
+        {"unroll", 2, Opt_Unroll, nullptr},
+        {"simplifycfg", 2, Opt_SimplifyCFG, nullptr},
+        {"sccp", 2, Opt_SCCP, nullptr},
+        {"memopt", 2, Opt_MemOpt, nullptr},
+        {"dce", 1, Opt_DCE, nullptr},
+        {"layout", 1, Opt_ProfileLayout, nullptr}, // 只在 -fprofile-use 时有事做
+    };
+}
+
+static bool PM_KnownPass(const string &name)
+{
+    for (auto &pass : PM_Pipeline())
+        if (pass.name == name)
+            return true;
+    return false;
+}
+
+// 识别并吃掉一个流水线相关的选项, 不认识的返回 false
+static bool PM_ParseOption(PassOptions &opts, const string &arg)
+{
+    if (arg == "-O0" || arg == "-O1" || arg == "-O2")
+    {
+        opts.opt_level = arg[2] - '0';
+        return true;
+    }
+    if (arg == "-time-passes")
+    {
+        opts.time_passes = true;
+        return true;
+    }
+    if (arg == "-verify-ir")
+    {
+        opts.verify_ir = true;
+        return true;
+    }
+    if (arg == "-inline-report")
+    {
+        inline_params.report = true;
+        return true;
+    }
+    if (arg.compare(0, 18, "-inline-threshold=") == 0)
+    {
+        inline_params.threshold = atoi(arg.c_str() + 18);
+        return true;
+    }
+    if (arg == "-unroll-report")
+    {
+        unroll_params.report = true;
+        return true;
+    }
+    if (arg.compare(0, 15, "-unroll-factor=") == 0)
+    {
+        unroll_params.factor = atoi(arg.c_str() + 15);
+        return true;
+    }
+    if (arg.compare(0, 15, "-unroll-budget=") == 0)
+    {
+        unroll_params.budget = atoi(arg.c_str() + 15);
+        return true;
+    }
+    if (arg.compare(0, 14, "-fprofile-use=") == 0)
+    {
+        if (!KIR_ReadProfile(arg.substr(14), opt_profile))
+        {
+            cerr << "cannot read profile " << arg.substr(14) << endl;
+            exit(1);
+        }
+        return true;
+    }
+    if (arg.compare(0, 5, "-fno-") == 0 || arg.compare(0, 2, "-f") == 0)
+    {
+        bool enable = arg.compare(0, 5, "-fno-") != 0;
+        string name = arg.substr(enable ? 2 : 5);
+        if (!PM_KnownPass(name))
+        {
+            cerr << "unknown pass: " << name << endl;
+            exit(1);
+        }
+        opts.toggles.push_back({name, enable});
+        return true;
+    }
+    return false;
+}
+
+static bool PM_Enabled(const PassOptions &opts, const Pass &pass)
+{
+    bool enabled = opts.opt_level >= pass.min_level;
+    for (auto &toggle : opts.toggles)
+        if (toggle.first == pass.name)
+            enabled = toggle.second;
+    return enabled;
+}
+
+static int PM_CountInsts(const KProgram &program)
+{
+    int count = 0;
+    for (auto &func : program.funcs)
+        count += KIR_CountInsts(func);
+    return count;
+}
+
+static void PM_Verify(const KProgram &program, const string &after)
+{
+    for (auto &func : program.funcs)
+    {
+        string err = KIR_Verify(func);
+        if (!err.empty())
+        {
+            cerr << "IR verification failed after " << after << " in @" << func.name << ": " << err << endl;
+            KIR_Dump(func, cerr);
+            abort();
+        }
+    }
+}
+
+static void PM_Run(KProgram &program, const PassOptions &opts)
+{
+    bool verify = opts.verify_ir;
+#ifdef KIR_VERIFY
+    verify = true; // debug 构建总是检查
+#endif
+    if (verify)
+        PM_Verify(program, "irgen");
+
+    struct Stat
+    {
+        string name;
+        double seconds = 0;
+        int runs = 0;
+        int delta = 0;
+    };
+    vector<Stat> stats;
+    double total = 0;
+    for (auto &pass : PM_Pipeline())
+    {
+        if (!PM_Enabled(opts, pass))
+            continue;
+        int before = PM_CountInsts(program);
+        auto start = chrono::steady_clock::now();
+        if (pass.run_program)
+            pass.run_program(program);
+        else
+            for (auto &func : program.funcs)
+                pass.run_func(func);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        total += seconds;
+        if (verify)
+            PM_Verify(program, pass.name);
+
+        size_t i = 0;
+        while (i < stats.size() && stats[i].name != pass.name)
+            ++i;
+        if (i == stats.size())
+            stats.push_back({pass.name});
+        stats[i].seconds += seconds;
+        stats[i].runs++;
+        stats[i].delta += PM_CountInsts(program) - before;
+    }
+
+    if (opts.time_passes)
+    {
+        fprintf(stderr, "===== pass execution timing report (-O%d) =====\n", opts.opt_level);
+        fprintf(stderr, "%-14s %5s %12s %8s %10s\n", "pass", "runs", "time(ms)", "%", "insts");
+        for (auto &s : stats)
+            fprintf(stderr, "%-14s %5d %12.3f %7.1f%% %+10d\n", s.name.c_str(), s.runs, s.seconds * 1000,
+                    total > 0 ? s.seconds * 100 / total : 0.0, s.delta);
+        fprintf(stderr, "%-14s %5s %12.3f %8s %10d\n", "total", "", total * 1000, "", PM_CountInsts(program));
+    }
+}
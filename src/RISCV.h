@@ -1,14 +1,22 @@
 #pragma once
 
+#include <algorithm>
 #include <string>
 #include <iostream>
 #include <cassert>
-
+#include <sstream>
+#include <set>
 #include <map>
-#include "koopa.h"
+#include <vector>
+#include "KIR.h"
+#include "Dataflow.h"
+#include "RVSched.h"
 
 using namespace std;
 
+// 后端直接读优化后的 KIR. 值就是 KIR 的 temp 编号; 常数和地址 (alloc 出来的栈位置,
+// 全局变量) 不进 value_map, 要用时再放进寄存器
+
 struct Reg
 {
     int reg_name;
@@ -16,239 +24,600 @@ struct Reg
 };
 
 int stack_top = 0;
-static map<uintptr_t, int> stack_frame;
 
-int stack_size = 0;
-string reg_names[16] = {"a0", "a1", "a2", "a3", "a4", "a5", "a6","a7", "t0", "t1", "t2", "t3", "t4", "t5", "t6","x0"};
-koopa_raw_value_t registers[16]; 
-int reg_stats[16] = {0};
+// a0-a7, t0-t5 是调用者保存的; s1-s11 是被调用者保存的, 只给跨过函数调用的值用
+// t6 不参与分配: 栈上偏移量放不进 12 位立即数时用来算地址
+const int NUM_CALLER_REGS = 14;
+const int NUM_REGS = 25;
+const int REG_ZERO = 25;
+string reg_names[26] = {"a0", "a1", "a2", "a3", "a4", "a5", "a6", "a7", "t0", "t1", "t2", "t3", "t4", "t5",
+                        "s1", "s2", "s3", "s4", "s5", "s6", "s7", "s8", "s9", "s10", "s11", "x0"};
+int registers[26]; // 寄存器里放的值的 temp 编号, 常数和地址是 -1
+int reg_stats[26] = {0};
+// 寄存器里是不是还放着 li 进去的常数: 常数不进 value_map, 用完寄存器就空出来,
+// 但在被别的东西写掉之前, 同一块里再用到这个常数可以直接拿来用, 不用再 li
+bool reg_has_imm[26] = {false};
+int32_t reg_imm[26];
 
-koopa_raw_value_t present_value = 0; // 当前正访问的指令
+int present_value = -1; // 当前正访问的值的 temp 编号
 
-map<const koopa_raw_value_t, Reg> value_map;
+map<int, Reg> value_map;
+// 基本块的循环深度, 键是 "函数名 块名", 由 main 根据 KIR 的循环分析填好
+static map<string, int> block_loop_depth;
+// -fprofile-use 读进来的块执行次数, 键同上; 有次数的块按次数给溢出加权
+static map<string, long> block_count;
+// -fprofile-generate: 每个函数在 .bss 里有一个计数器数组 __profile.<函数名>, 按块的输出顺序
+// 一块一个字, 块开头直接 lw/addi/sw 加一. rvsim 在程序结束时把它们读出来写成 profile
+static bool profile_generate = false;
+// 函数体生成完之后按块做指令调度 (RVSched.h), -O1 起默认开启
+static bool sched_enabled = false;
+// 紧跟在当前块后面输出的块, 跳到它的 j 可以省掉; -1 是没有
+static int next_bb;
+static const KFunc *present_func;
+static string current_func;
+// 函数级的状态: 是否调用了别的函数, 用到了哪些 s 寄存器
+static bool is_leaf;
+static bool saved_used[NUM_REGS];
+// 当前函数的稠密编号和活跃变量 (Dataflow.h), 值的下标就是 temp 编号
+static DFFunction df_func;
+static DFProblem df_live;
+// 正在生成的指令所在的块 (KFunc::bbs 的下标) 和位置, 换出寄存器时据此判断里面的值还用不用
+static int present_block = 0;
+static int present_pos = 0;
+// 每个值在当前块里最后一次被使用的位置, -1 是本块不再用; 换块时只清上一块设过的
+static vector<int> last_use_here;
+static vector<int> last_use_touched;
+// 定义到本块里最后一次使用之间隔着调用的值
+static vector<char> crosses_call;
+// 每个值的溢出代价, 见 spill_weight
+static vector<long> use_weight;
+// 每个值是哪条指令定义的, 参数是 nullptr
+static vector<const KInst *> value_def;
+// 尾调用: 紧跟着 ret 它的返回值, 参数都在寄存器里. 恢复栈帧后 tail 过去,
+// 被调函数直接返回到我们的调用者, 后面那条 ret 不用生成
+static set<const KInst *> tail_calls;
+// ret 和尾调用处先占位, 栈帧大小在整个函数生成完之后才知道
+static const string epilogue_mark = "#epilogue\n";
+// 地址是 sp + 常数的值 (alloc, 以及从它出发下标都是常数的 getelemptr / getptr) -> 偏移量.
+// 它们和常数一样不占寄存器, 访存直接用 offset(sp), 要当值用时再算
+static map<int, int> frame_addr;
 
 // Declaration of the functions
-void RISC_Visit(const koopa_raw_program_t &program);
-void RISC_Visit(const koopa_raw_slice_t &slice);
-void RISC_Visit(const koopa_raw_function_t &func);
-void RISC_Visit(const koopa_raw_basic_block_t &bb);
-void RISC_Visit(const koopa_raw_return_t &ret);
-Reg RISC_Visit(const koopa_raw_value_t &value);
-Reg RISC_Visit(const koopa_raw_integer_t &integer);
-Reg RISC_Visit(const koopa_raw_binary_t &binary);
-Reg RISC_Visit(const koopa_raw_load_t &load);
-void RISC_Visit(const koopa_raw_store_t &store);
-void RISC_Visit(const koopa_raw_branch_t &branch);
-void RISC_Visit(const koopa_raw_jump_t &jump);
+void RISC_Visit(const KProgram &program);
+void RISC_Visit(const KFunc &func);
+void RISC_Visit(int bb);
+void RISC_Visit(const KInst &inst);
+Reg RISC_Visit(const KValue &value);
+void RISC_Visit_Return(const KInst &ret);
+Reg RISC_Visit_Integer(int32_t int_val);
+Reg RISC_Visit_Binary(const KInst &binary);
+Reg RISC_Visit_Load(const KInst &load);
+void RISC_Visit_Store(const KInst &store);
+void RISC_Visit_Branch(const KInst &branch);
+void RISC_Visit_Jump(const KInst &jump);
+Reg RISC_Visit_Call(const KInst &call);
 int find_reg(int stat);
-int cal_size(const koopa_raw_slice_t &slice);
+void emit_stack(const string &op, const string &reg, int offset);
+void emit_sp_adjust(int delta);
+bool is_static_addr(const KValue &value);
+void emit_addr(const string &reg, const KValue &value);
+Reg RISC_Visit_Ptr(const KValue &src, const KValue &index, int stride);
+void RISC_VisitGlobals(const vector<KGlobalVar> &globals);
+string bb_label(int bb);
+string symbol_name(const KValue &global);
+long block_weight(int bb);
+bool used_after(int value, int pos);
+bool used_later_here(int value);
+bool used_across_blocks(int value);
+bool points_to_frame(const KValue &value);
+long spill_weight(int value);
+void cal_magic(int32_t d, int32_t &magic, int &shift);
+Reg div_by_const(const KInst &binary, int left_register, int32_t d);
 
 int find_reg(int stat)
 {
-    for (int i = 0; i < 15; ++i)
+    // 跨调用的值先找 s 寄存器, 其它值只用 a/t 寄存器, 免得平白多存取一个 s 寄存器
+    bool cross = present_value != -1 && crosses_call[present_value];
+    int first = cross ? NUM_CALLER_REGS : 0, last = cross ? NUM_REGS : NUM_CALLER_REGS;
+    for (int pass = 0; pass < 2; ++pass)
     {
-        if (reg_stats[i] == 0)
+        // 空闲寄存器里先挑没缓存常数的
+        int chosen = -1;
+        for (int i = first; i < last; ++i)
+        {
+            if (reg_stats[i] == 0 && (chosen == -1 || (reg_has_imm[chosen] && !reg_has_imm[i])))
+                chosen = i;
+        }
+        if (chosen != -1)
         {
-            registers[i] = present_value;
-            reg_stats[i] = stat;
-            return i;
+            registers[chosen] = present_value;
+            reg_stats[chosen] = stat;
+            reg_has_imm[chosen] = false;
+            if (chosen >= NUM_CALLER_REGS)
+                saved_used[chosen] = true;
+            return chosen;
         }
+        if (!cross)
+            break;
+        first = 0;
+        last = NUM_CALLER_REGS;
     }
-    for (int i = 0; i < 15; ++i)
+    // 没有空闲寄存器: 本块后面不再用的值直接丢掉, 否则换出循环里用得最少的值
+    int victim = -1;
+    long victim_weight = 0;
+    for (int i = 0; i < NUM_REGS; ++i)
     {
         if (reg_stats[i] == 1)
         {
-            value_map[registers[i]].reg_name = -1;
-            int add = value_map[registers[i]].reg_add;
-            if (add == -1)
+            long weight = used_later_here(registers[i]) ? spill_weight(registers[i]) : -1;
+            if (victim == -1 || weight < victim_weight)
             {
-                add = stack_top;
-                stack_top += 4;
-                value_map[registers[i]].reg_add = add;
-                cout << "  sw " << reg_names[i] << ", " << to_string(add) << "(sp)" << "\n";
+                victim = i;
+                victim_weight = weight;
             }
-            registers[i] = present_value;
-            reg_stats[i] = stat;
-            return i;
         }
     }
-    assert(false);
-    return -1;
+    assert(victim != -1);
+    value_map[registers[victim]].reg_name = -1;
+    int add = value_map[registers[victim]].reg_add;
+    if (add == -1 && victim_weight >= 0)
+    {
+        add = stack_top;
+        stack_top += 4;
+        value_map[registers[victim]].reg_add = add;
+        emit_stack("sw", reg_names[victim], add);
+    }
+    registers[victim] = present_value;
+    reg_stats[victim] = stat;
+    reg_has_imm[victim] = false;
+    return victim;
 }
 
-// 访问 raw program
-void RISC_Visit(const koopa_raw_program_t &program)
+// 访问整个程序
+void RISC_Visit(const KProgram &program)
 {
-    cout << ".text" << "\n";
     // 访问所有全局变量
-    RISC_Visit(program.values);
+    RISC_VisitGlobals(program.globals);
+    cout << ".text" << "\n";
     // 访问所有函数
-    RISC_Visit(program.funcs);
+    for (auto &func : program.funcs)
+        RISC_Visit(func);
 }
 
-// 访问 raw slice
-void RISC_Visit(const koopa_raw_slice_t &slice)
+// 访问函数
+// 栈帧布局 (从 sp 往上): 传给被调函数的第 9 个起的参数, 参数和局部变量的栈位置,
+// 被调用者保存的 s 寄存器, ra. 叶子函数不存 ra, 空栈帧不动 sp
+void RISC_Visit(const KFunc &func)
 {
-    for (size_t i = 0; i < slice.len; ++i)
+    value_map.clear();
+    frame_addr.clear();
+    tail_calls.clear();
+    present_func = &func;
+    current_func = func.name;
+    df_func = DF_Build(func);
+    df_live = DF_Liveness(df_func);
+    size_t num_values = df_func.num_values;
+    last_use_here.assign(num_values, -1);
+    last_use_touched.clear();
+    crosses_call.assign(num_values, 0);
+    use_weight.assign(num_values, 0);
+    value_def.assign(num_values, nullptr);
+    for (size_t b = 0; b < func.bbs.size(); ++b)
     {
-        auto ptr = slice.buffer[i];
-        // 根据 slice 的 kind 决定将 ptr 视作何种元素
-        switch (slice.kind)
+        long weight = block_weight(b);
+        for (auto &inst : df_func.insts[b])
         {
-        case KOOPA_RSIK_FUNCTION:
-            // 访问函数
-            RISC_Visit(reinterpret_cast<koopa_raw_function_t>(ptr));
-            break;
-        case KOOPA_RSIK_BASIC_BLOCK:
-            // 访问基本块
-            RISC_Visit(reinterpret_cast<koopa_raw_basic_block_t>(ptr));
-            break;
-        case KOOPA_RSIK_VALUE:
-            // 访问指令
-            RISC_Visit(reinterpret_cast<koopa_raw_value_t>(ptr));
-            break;
-        default:
-            // 我们暂时不会遇到其他内容, 于是不对其做任何处理
-            assert(false);
+            for (int u : inst.uses)
+                use_weight[u] += weight;
+            if (inst.def != -1)
+                value_def[inst.def] = inst.inst;
         }
     }
-}
+    is_leaf = true;
+    int max_args = 0;
+    for (auto &bb : func.bbs)
+    {
+        for (size_t j = 0; j < bb.insts.size(); ++j)
+        {
+            const KInst &inst = bb.insts[j];
+            if (inst.kind != KI_CALL)
+                continue;
+            const KInst *next = j + 1 < bb.insts.size() ? &bb.insts[j + 1] : nullptr;
+            bool tail = next != nullptr && next->kind == KI_RETURN && inst.args.size() <= 8 &&
+                        ((inst.dest != -1 && next->lhs == KTemp(inst.dest)) ||
+                         (next->lhs.kind == KV_NONE && inst.dest == -1));
+            for (size_t k = 0; k < inst.args.size() && tail; ++k)
+                tail = !points_to_frame(inst.args[k]);
+            if (tail)
+            {
+                // tail 不改 ra, 只有尾调用的函数也算叶子
+                tail_calls.insert(&inst);
+                continue;
+            }
+            is_leaf = false;
+            max_args = max(max_args, (int)inst.args.size());
+        }
+    }
+    for (int i = 0; i < NUM_REGS; ++i)
+        saved_used[i] = false;
+    stack_top = max(max_args - 8, 0) * 4;
+    for (int param : func.params)
+    {
+        value_map[param] = {-1, stack_top};
+        stack_top += 4;
+    }
 
-// 访问函数
-void RISC_Visit(const koopa_raw_function_t &func)
-{
-    cout << "  " << ".globl " << (func->name + 1) << "\n";
-    cout << (func->name + 1) << ":" << "\n";
-    RISC_Visit(func->bbs);
+    // 先把函数体生成到缓冲区里, 才知道栈帧多大
+    stringstream body;
+    streambuf *old_buf = cout.rdbuf(body.rdbuf());
+    for (size_t i = 0; i < func.bbs.size(); ++i)
+    {
+        next_bb = i + 1 < func.bbs.size() ? i + 1 : -1;
+        RISC_Visit((int)i);
+    }
+    cout.rdbuf(old_buf);
+
+    vector<int> saved;
+    for (int i = NUM_CALLER_REGS; i < NUM_REGS; ++i)
+        if (saved_used[i])
+            saved.push_back(i);
+    int frame = stack_top + 4 * ((int)saved.size() + (is_leaf ? 0 : 1));
+    frame = (frame + 15) / 16 * 16;
+
+    stringstream epilogue;
+    old_buf = cout.rdbuf(epilogue.rdbuf());
+    for (size_t i = 0; i < saved.size(); ++i)
+        emit_stack("lw", reg_names[saved[i]], frame - 4 * ((int)i + (is_leaf ? 1 : 2)));
+    if (!is_leaf)
+        emit_stack("lw", "ra", frame - 4);
+    emit_sp_adjust(frame);
+    cout.rdbuf(old_buf);
+
+    cout << "  " << ".globl " << func.name.substr(1) << "\n";
+    cout << func.name.substr(1) << ":" << "\n";
+    emit_sp_adjust(-frame);
+    if (!is_leaf)
+        emit_stack("sw", "ra", frame - 4);
+    for (size_t i = 0; i < saved.size(); ++i)
+        emit_stack("sw", reg_names[saved[i]], frame - 4 * ((int)i + (is_leaf ? 1 : 2)));
+    // 参数放到自己的栈位置上, 第 9 个起的参数在调用者的栈帧里
+    for (size_t i = 0; i < func.params.size(); ++i)
+    {
+        int slot = value_map[func.params[i]].reg_add;
+        if (i < 8)
+            emit_stack("sw", reg_names[i], slot);
+        else
+        {
+            emit_stack("lw", "t0", frame + ((int)i - 8) * 4);
+            emit_stack("sw", "t0", slot);
+        }
+    }
+    string text = sched_enabled ? RVSched_Function(body.str()) : body.str();
+    string epilogue_text = epilogue.str();
+    for (size_t pos = text.find(epilogue_mark); pos != string::npos; pos = text.find(epilogue_mark, pos))
+    {
+        text.replace(pos, epilogue_mark.size(), epilogue_text);
+        pos += epilogue_text.size();
+    }
+    cout << text << "\n";
+    if (profile_generate)
+    {
+        string counters = "__profile." + current_func.substr(1);
+        cout << ".bss" << "\n";
+        cout << "  " << ".p2align 2" << "\n";
+        cout << "  " << ".globl " << counters << "\n";
+        cout << counters << ":" << "\n";
+        cout << "  " << ".zero " << 4 * func.bbs.size() << "\n";
+        cout << ".text" << "\n" << "\n";
+    }
 }
 
 // 访问基本块
-void RISC_Visit(const koopa_raw_basic_block_t &bb)
+void RISC_Visit(int bb)
 {
-    int stack_frame_size = cal_size(bb->insts);
-    cout << "addi sp, sp, -" + to_string(stack_frame_size * 4) << "\n";
     // 访问所有指令
-    cout << bb->name + 1 << ":" << "\n";
-    RISC_Visit(bb->insts);
+    cout << bb_label(bb) << ":" << "\n";
+    present_block = bb;
+    // 块的边界上没有活在寄存器里的值, 计数可以借 t0 和 t6
+    if (profile_generate)
+    {
+        string counters = "__profile." + current_func.substr(1);
+        int offset = 4 * bb;
+        cout << "  " << "lui t6, %hi(" << counters << ")" << "\n";
+        cout << "  " << "addi t6, t6, %lo(" << counters << ")" << "\n";
+        if (offset >= 2048)
+        {
+            cout << "  " << "li t0, " << to_string(offset) << "\n";
+            cout << "  " << "add t6, t6, t0" << "\n";
+            offset = 0;
+        }
+        cout << "  " << "lw t0, " << to_string(offset) << "(t6)" << "\n";
+        cout << "  " << "addi t0, t0, 1" << "\n";
+        cout << "  " << "sw t0, " << to_string(offset) << "(t6)" << "\n";
+    }
+    // 可以从多个前驱跳进来, 寄存器里的内容都不可信了;
+    // 跨块使用的值在定义时已经写回了栈上
+    for (auto &kv : value_map)
+        kv.second.reg_name = -1;
+    for (int i = 0; i < NUM_REGS; ++i)
+    {
+        reg_stats[i] = 0;
+        reg_has_imm[i] = false;
+    }
+    // 本块里每个值最后一次使用的位置; 定义之后, 最后一次使用之前有调用的值优先放进 s 寄存器
+    for (int id : last_use_touched)
+        last_use_here[id] = -1;
+    last_use_touched.clear();
+    const vector<DFInst> &insts = df_func.insts[bb];
+    int n = insts.size();
+    for (int i = 0; i < n; ++i)
+        for (int u : insts[i].uses)
+        {
+            if (last_use_here[u] == -1)
+                last_use_touched.push_back(u);
+            last_use_here[u] = i;
+        }
+    for (int i = n - 1, next_call = n; i >= 0; --i)
+    {
+        if (insts[i].def != -1 && next_call < last_use_here[insts[i].def])
+            crosses_call[insts[i].def] = 1;
+        if (insts[i].inst->kind == KI_CALL)
+            next_call = i;
+    }
+    for (int i = 0; i < n; ++i)
+    {
+        present_pos = i;
+        RISC_Visit(*insts[i].inst);
+    }
 }
 
-int cal_size(const koopa_raw_slice_t &slice)
+string bb_label(int bb)
 {
-    int stack_frame_size = 0;
-    for (size_t i = 0; i < slice.len; ++i)
+    // 不同函数里可以有同名的块
+    return ".L" + current_func.substr(1) + "." + present_func->bbs[bb].name.substr(1);
+}
+
+// 全局变量的符号名, 不带 '@'
+string symbol_name(const KValue &global)
+{
+    return kir_global_names[global.v].substr(1);
+}
+
+// lw/sw reg, offset(sp)
+void emit_stack(const string &op, const string &reg, int offset)
+{
+    if (offset >= -2048 && offset < 2048)
+        cout << "  " << op << " " << reg << ", " << to_string(offset) << "(sp)" << "\n";
+    else
     {
-        auto ptr = slice.buffer[i];
-        assert(slice.kind == KOOPA_RSIK_VALUE);
-        auto value = reinterpret_cast<koopa_raw_value_t>(ptr);
-        if (value->kind.tag == KOOPA_RVT_ALLOC || value->ty->tag != KOOPA_RTT_UNIT)
-        {
-            stack_frame[reinterpret_cast<uintptr_t>(value)] = stack_frame_size;
-            stack_frame_size++;
-        }
+        cout << "  " << "li t6, " << to_string(offset) << "\n";
+        cout << "  " << "add t6, sp, t6" << "\n";
+        cout << "  " << op << " " << reg << ", 0(t6)" << "\n";
     }
-    if ((stack_frame_size & 3) > 0)
+}
+
+void emit_sp_adjust(int delta)
+{
+    if (delta == 0)
+        return;
+    if (delta >= -2048 && delta < 2048)
+        cout << "  " << "addi sp, sp, " << to_string(delta) << "\n";
+    else
     {
-        stack_frame_size = ((stack_frame_size >> 2) + 1) << 2;
+        cout << "  " << "li t6, " << to_string(delta) << "\n";
+        cout << "  " << "add sp, sp, t6" << "\n";
     }
-    return stack_frame_size;
 }
 
-Reg RISC_Visit(const koopa_raw_value_t &value)
+bool is_static_addr(const KValue &value)
 {
-    // 返回时值一定在寄存器里
-    koopa_raw_value_t old_value = present_value;
-    present_value = value;
-    if (value_map.count(value))
+    return value.kind == KV_GLOBAL || (value.kind == KV_TEMP && frame_addr.count(value.v));
+}
+
+// 把不占寄存器的地址算进 reg: sp + 常数, 或全局变量的 %hi/%lo
+void emit_addr(const string &reg, const KValue &value)
+{
+    if (value.kind == KV_GLOBAL)
     {
-        if (value_map[value].reg_name == -1)
-        {
-            int reg_name = find_reg(1);
-            value_map[value].reg_name = reg_name;
-            cout << "  "    << "lw " << reg_names[reg_name] << ", " << to_string(value_map[value].reg_add) << "(sp)" << "\n";
-        }
-        present_value = old_value;
-        return value_map[value];
+        cout << "  " << "lui " << reg << ", %hi(" << symbol_name(value) << ")" << "\n";
+        cout << "  " << "addi " << reg << ", " << reg << ", %lo(" << symbol_name(value) << ")" << "\n";
+        return;
     }
+    int offset = frame_addr.at(value.v);
+    if (offset == 0)
+        cout << "  " << "mv " << reg << ", sp" << "\n";
+    else if (offset >= -2048 && offset < 2048)
+        cout << "  " << "addi " << reg << ", sp, " << to_string(offset) << "\n";
+    else
+    {
+        cout << "  " << "li " << reg << ", " << to_string(offset) << "\n";
+        cout << "  " << "add " << reg << ", sp, " << reg << "\n";
+    }
+}
+
+// 值在当前块 pos 及以后还有没有使用 (别的块的使用已经靠栈位置保证了)
+bool used_after(int value, int pos)
+{
+    return value != -1 && last_use_here[value] >= pos;
+}
 
-    const auto &kind = value->kind;
+// 当前块里正在生成的指令及其后面还有没有使用, 别的块定义的值也算
+bool used_later_here(int value)
+{
+    return used_after(value, present_pos);
+}
+
+// 当前块定义的值在块的出口还活着, 即别的块要用 (SSA 里定义支配所有使用)
+bool used_across_blocks(int value)
+{
+    return value != -1 && df_live.out[present_block].Test(value);
+}
+
+// 指向本函数栈帧里的数组: 栈帧要留着, 这样的参数不能尾调用
+bool points_to_frame(const KValue &value)
+{
+    const KInst *def = value.kind == KV_TEMP ? value_def[value.v] : nullptr;
+    while (def != nullptr && (def->kind == KI_GETELEMPTR || def->kind == KI_GETPTR))
+        def = def->lhs.kind == KV_TEMP ? value_def[def->lhs.v] : nullptr;
+    return def != nullptr && def->kind == KI_ALLOC;
+}
+
+// 块的执行次数: 有 profile 时用计数, 否则按循环深度估计, 深一层乘 10
+long block_weight(int bb)
+{
+    string key = current_func + " " + present_func->bbs[bb].name;
+    auto it = block_count.find(key);
+    if (it != block_count.end())
+        return it->second + 1;
+    int depth = min(block_loop_depth[key], 6);
+    long weight = 1;
+    while (depth--)
+        weight *= 10;
+    return weight;
+}
+
+// 溢出代价: 每个使用按所在块的 block_weight 加权, 生成函数前已经算好
+long spill_weight(int value)
+{
+    return value == -1 ? 0 : use_weight[value];
+}
+
+// 生成一条指令
+void RISC_Visit(const KInst &inst)
+{
+    int old_value = present_value;
+    present_value = inst.dest;
     struct Reg result_var = {-1, -1};
-    switch (kind.tag)
+    switch (inst.kind)
     {
-    case KOOPA_RVT_RETURN:
-        // 访问 return 指令
-        RISC_Visit(kind.data.ret);
+    case KI_RETURN:
+        RISC_Visit_Return(inst);
         break;
-    case KOOPA_RVT_INTEGER:
-        // 访问 integer 指令
-        result_var = RISC_Visit(kind.data.integer); 
+    case KI_BINARY:
+        result_var = RISC_Visit_Binary(inst);
         break;
-    case KOOPA_RVT_BINARY:
-        result_var = RISC_Visit(kind.data.binary);
-        value_map[value] = result_var;
+    case KI_ALLOC:
+        frame_addr[inst.dest] = stack_top;
+        stack_top += inst.type.pointer ? 4 : 4 * KIR_Words(inst.type.dims);
         break;
-    case KOOPA_RVT_ALLOC:
-        result_var.reg_add = stack_top;
-        stack_top += 4;
-        value_map[value] = result_var;
+    case KI_GETELEMPTR:
+    case KI_GETPTR:
+        result_var = RISC_Visit_Ptr(inst.lhs, inst.rhs, inst.stride);
+        break;
+    case KI_LOAD:
+        result_var = RISC_Visit_Load(inst);
         break;
-    case KOOPA_RVT_LOAD:
-        result_var = RISC_Visit(kind.data.load);
-        value_map[value] = result_var;
+    case KI_STORE:
+        RISC_Visit_Store(inst);
         break;
-    case KOOPA_RVT_STORE:
-        RISC_Visit(kind.data.store);
+    case KI_BRANCH:
+        RISC_Visit_Branch(inst);
         break;
-    case KOOPA_RVT_BRANCH:
-        RISC_Visit(kind.data.branch);
+    case KI_JUMP:
+        RISC_Visit_Jump(inst);
         break;
-    case KOOPA_RVT_JUMP:
-        RISC_Visit(kind.data.jump);
+    case KI_CALL:
+        result_var = RISC_Visit_Call(inst);
         break;
     default:
         assert(false);
     }
+    if (inst.dest != -1 && inst.kind != KI_ALLOC && !frame_addr.count(inst.dest))
+    {
+        // 别的块要用的值马上写回栈上
+        if (used_across_blocks(inst.dest))
+        {
+            result_var.reg_add = stack_top;
+            stack_top += 4;
+            emit_stack("sw", reg_names[result_var.reg_name], result_var.reg_add);
+        }
+        value_map[inst.dest] = result_var;
+    }
 
     present_value = old_value; // 防止递归时改掉值
+}
 
-    return result_var;
+// 把操作数放进寄存器
+Reg RISC_Visit(const KValue &value)
+{
+    // 返回时值一定在寄存器里
+    if (value.kind == KV_IMM)
+    {
+        int old_value = present_value;
+        present_value = -1;
+        struct Reg result_var = RISC_Visit_Integer(value.v);
+        present_value = old_value;
+        return result_var;
+    }
+    int old_value = present_value;
+    present_value = value.kind == KV_TEMP ? value.v : -1;
+    if (is_static_addr(value))
+    {
+        // 和常数一样用完就放掉
+        struct Reg result_var = {find_reg(0), -1};
+        emit_addr(reg_names[result_var.reg_name], value);
+        present_value = old_value;
+        return result_var;
+    }
+    assert(value.kind == KV_TEMP && value_map.count(value.v));
+    Reg &slot = value_map[value.v];
+    if (slot.reg_name == -1)
+    {
+        int reg_name = find_reg(1);
+        slot.reg_name = reg_name;
+        emit_stack("lw", reg_names[reg_name], slot.reg_add);
+    }
+    present_value = old_value;
+    return slot;
 }
 
-void RISC_Visit(const koopa_raw_return_t &ret)
+void RISC_Visit_Return(const KInst &ret)
 {
-    koopa_raw_value_t ret_value = ret.value;
-    struct Reg result_var = RISC_Visit(ret_value);
-    cout << "  " << "mv a0, " << reg_names[result_var.reg_name] << "\n";
-    if (stack_size <= 2048)
-        cout << "  "<< "addi sp, sp, " << to_string(stack_size) << "\n";
-    else
+    int pos = present_pos;
+    if (pos > 0 && tail_calls.count(&present_func->bbs[present_block].insts[pos - 1]))
+        return;
+    if (ret.lhs.kind != KV_NONE)
     {
-        cout << "  "<< "li t0, " << to_string(stack_size) << "\n";
-        cout << "  "<< "addi sp, sp, t0" << "\n";
+        struct Reg result_var = RISC_Visit(ret.lhs);
+        if (result_var.reg_name != 0)
+            cout << "  " << "mv a0, " << reg_names[result_var.reg_name] << "\n";
     }
+    cout << epilogue_mark;
     cout << "  " << "ret" << "\n";
 }
 
-Reg RISC_Visit(const koopa_raw_integer_t &integer)
+Reg RISC_Visit_Integer(int32_t int_val)
 {
     // integer stored in registers, thus returns register number
-    int32_t int_val = integer.value;
     struct Reg result_var = {-1, -1};
     if (int_val == 0)
     {
-        result_var.reg_name = 15;
+        result_var.reg_name = REG_ZERO;
         return result_var;
     }
+    // 常数从来不占 value_map 的位置, 也就不会被换出去; 要用时再 li 一次
+    for (int i = 0; i < NUM_REGS; ++i)
+    {
+        if (reg_has_imm[i] && reg_imm[i] == int_val)
+        {
+            result_var.reg_name = i;
+            return result_var;
+        }
+    }
     result_var.reg_name = find_reg(0);
     cout << "  " << "li " << reg_names[result_var.reg_name] << ", " << to_string(int_val) << "\n";
+    reg_has_imm[result_var.reg_name] = true;
+    reg_imm[result_var.reg_name] = int_val;
 
     return result_var;
 }
 
-Reg RISC_Visit(const koopa_raw_binary_t &binary)
+Reg RISC_Visit_Binary(const KInst &binary)
 {
-    // returns memory reg_add
     struct Reg left_val = RISC_Visit(binary.lhs);
     int left_register = left_val.reg_name;
+    if ((binary.op == KB_DIV || binary.op == KB_MOD) && binary.rhs.kind == KV_IMM && binary.rhs.v != 0)
+        return div_by_const(binary, left_register, binary.rhs.v);
     int old_stat = reg_stats[left_register];
     reg_stats[left_register] = 2;
     struct Reg right_val = RISC_Visit(binary.rhs);
@@ -262,47 +631,47 @@ Reg RISC_Visit(const koopa_raw_binary_t &binary)
 
     switch (binary.op)
     {
-    case 0: // ne
+    case KB_NE:
         cout << "  "<< "xor " << result_reg_name << ", " << left_reg_name << ", " << right_reg_name << "\n";
         cout << "  "<< "snez " << result_reg_name << ", " << result_reg_name << "\n";
         break;
-    case 1: // eq
+    case KB_EQ:
         cout << "  "<< "xor " << result_reg_name << ", " << left_reg_name << ", " << right_reg_name << "\n";
         cout << "  "<< "seqz " << result_reg_name << ", " << result_reg_name << "\n";
         break;
-    case 2: // gt
+    case KB_GT:
         cout << "  " << "sgt " << result_reg_name << ", " << left_reg_name << ", " << right_reg_name << "\n";
         break;
-    case 3: // lt
+    case KB_LT:
         cout << "  "<< "slt " << result_reg_name << ", " << left_reg_name << ", " << right_reg_name << "\n";
         break;
-    case 4: // ge 
+    case KB_GE:
         cout << "  "<< "slt " << result_reg_name << ", " << left_reg_name << ", " << right_reg_name << "\n";
         cout << "  "<< "xori " << result_reg_name << ", " << result_reg_name << ", 1" << "\n";
         break;
-    case 5: // le
+    case KB_LE:
         cout << "  "<< "sgt " << result_reg_name << ", " << left_reg_name << ", " << right_reg_name << "\n";
         cout << "  "<< "xori " << result_reg_name << ", " << result_reg_name << ", 1" << "\n";
         break;
-    case 6: // add
+    case KB_ADD:
         cout << "  "<< "add " << result_reg_name << ", " << left_reg_name << ", " << right_reg_name << "\n";
         break;
-    case 7: // sub
+    case KB_SUB:
         cout << "  "<< "sub " << result_reg_name << ", " << left_reg_name << ", " << right_reg_name << "\n";
         break;
-    case 8: // mul
+    case KB_MUL:
         cout << "  "<< "mul " << result_reg_name << ", " << left_reg_name << ", " << right_reg_name << "\n";
         break;
-    case 9: // div
+    case KB_DIV:
         cout << "  "<< "div " << result_reg_name << ", " << left_reg_name << ", " << right_reg_name << "\n";
         break;
-    case 10: // mod
+    case KB_MOD:
         cout << "  "<< "rem " << result_reg_name << ", " << left_reg_name << ", " << right_reg_name << "\n";
         break;
-    case 11: // and
+    case KB_AND:
         cout << "  "<< "and " << result_reg_name << ", " << left_reg_name << ", " << right_reg_name << "\n";
         break;
-    case 12: // or
+    case KB_OR:
         cout << "  "<< "or " << result_reg_name << ", " << left_reg_name << ", " << right_reg_name << "\n";
         break;
     default:
@@ -312,41 +681,400 @@ Reg RISC_Visit(const koopa_raw_binary_t &binary)
     return result_var;
 }
 
-Reg RISC_Visit(const koopa_raw_load_t &load)
+// 地址是 sp + 常数时直接 offset(sp); 全局变量用 %hi/%lo; 其它指针先放进寄存器
+Reg RISC_Visit_Load(const KInst &load)
 {
-    koopa_raw_value_t src = load.src;
-    int reg_name = find_reg(1), reg_add = value_map[src].reg_add;
-    struct Reg result_var = {reg_name, reg_add};
-    cout << "  " << "lw " << reg_names[reg_name] << ", " << to_string(reg_add) << "(sp)" << "\n";
+    const KValue &src = load.lhs;
+    // 读出来的值有自己的栈位置: 之后的 store 可能改掉 src
+    struct Reg result_var = {-1, -1};
+    if (src.kind == KV_TEMP && frame_addr.count(src.v))
+    {
+        result_var.reg_name = find_reg(1);
+        emit_stack("lw", reg_names[result_var.reg_name], frame_addr[src.v]);
+    }
+    else if (src.kind == KV_GLOBAL)
+    {
+        result_var.reg_name = find_reg(1);
+        string reg = reg_names[result_var.reg_name];
+        cout << "  " << "lui " << reg << ", %hi(" << symbol_name(src) << ")" << "\n";
+        cout << "  " << "lw " << reg << ", %lo(" << symbol_name(src) << ")(" << reg << ")" << "\n";
+    }
+    else
+    {
+        int ptr_register = RISC_Visit(src).reg_name;
+        int old_stat = reg_stats[ptr_register];
+        reg_stats[ptr_register] = 2;
+        result_var.reg_name = find_reg(1);
+        reg_stats[ptr_register] = old_stat;
+        cout << "  " << "lw " << reg_names[result_var.reg_name] << ", 0(" << reg_names[ptr_register] << ")" << "\n";
+    }
+    return result_var;
+}
+
+// store lhs, rhs: lhs 是要存的值, rhs 是地址
+void RISC_Visit_Store(const KInst &store)
+{
+    struct Reg value = RISC_Visit(store.lhs);
+    const KValue &dest = store.rhs;
+    if (dest.kind == KV_TEMP && frame_addr.count(dest.v))
+    {
+        emit_stack("sw", reg_names[value.reg_name], frame_addr[dest.v]);
+        return;
+    }
+    // 地址要另占一个寄存器, 别让它挤掉要存的值
+    int old_stat = reg_stats[value.reg_name];
+    if (value.reg_name != REG_ZERO)
+        reg_stats[value.reg_name] = 2;
+    if (dest.kind == KV_GLOBAL)
+    {
+        int addr_register = find_reg(0);
+        string reg = reg_names[addr_register];
+        cout << "  " << "lui " << reg << ", %hi(" << symbol_name(dest) << ")" << "\n";
+        cout << "  " << "sw " << reg_names[value.reg_name] << ", %lo(" << symbol_name(dest) << ")(" << reg << ")" << "\n";
+    }
+    else
+    {
+        int ptr_register = RISC_Visit(dest).reg_name;
+        cout << "  " << "sw " << reg_names[value.reg_name] << ", 0(" << reg_names[ptr_register] << ")" << "\n";
+    }
+    if (value.reg_name != REG_ZERO)
+        reg_stats[value.reg_name] = old_stat;
+}
 
+// getelemptr / getptr: 两者在地址计算上一样, 都是 src + index * stride
+Reg RISC_Visit_Ptr(const KValue &src, const KValue &index, int stride)
+{
+    struct Reg result_var = {-1, -1};
+    if (index.kind == KV_IMM)
+    {
+        int delta = index.v * stride;
+        if (src.kind == KV_TEMP && frame_addr.count(src.v))
+        {
+            frame_addr[present_value] = frame_addr[src.v] + delta;
+            return result_var;
+        }
+        int src_register = RISC_Visit(src).reg_name;
+        int old_stat = reg_stats[src_register];
+        reg_stats[src_register] = 2;
+        result_var.reg_name = find_reg(1);
+        reg_stats[src_register] = old_stat;
+        string result_reg_name = reg_names[result_var.reg_name];
+        if (delta == 0)
+            cout << "  " << "mv " << result_reg_name << ", " << reg_names[src_register] << "\n";
+        else if (delta >= -2048 && delta < 2048)
+            cout << "  " << "addi " << result_reg_name << ", " << reg_names[src_register] << ", " << delta << "\n";
+        else
+        {
+            cout << "  " << "li " << result_reg_name << ", " << delta << "\n";
+            cout << "  " << "add " << result_reg_name << ", " << reg_names[src_register] << ", " << result_reg_name << "\n";
+        }
+        return result_var;
+    }
+    int src_register = RISC_Visit(src).reg_name;
+    int old_src_stat = reg_stats[src_register];
+    reg_stats[src_register] = 2;
+    int index_register = RISC_Visit(index).reg_name;
+    int old_index_stat = reg_stats[index_register];
+    reg_stats[index_register] = 2;
+    result_var.reg_name = find_reg(1);
+    reg_stats[index_register] = old_index_stat;
+    reg_stats[src_register] = old_src_stat;
+    string result_reg_name = reg_names[result_var.reg_name];
+    int shift = 0;
+    while ((1 << shift) < stride)
+        ++shift;
+    if ((1 << shift) == stride)
+        cout << "  " << "slli " << result_reg_name << ", " << reg_names[index_register] << ", " << shift << "\n";
+    else
+    {
+        cout << "  " << "li " << result_reg_name << ", " << stride << "\n";
+        cout << "  " << "mul " << result_reg_name << ", " << reg_names[index_register] << ", " << result_reg_name << "\n";
+    }
+    cout << "  " << "add " << result_reg_name << ", " << reg_names[src_register] << ", " << result_reg_name << "\n";
     return result_var;
 }
 
-void RISC_Visit(const koopa_raw_store_t &store)
+// 全局变量: 有非零初值的放 .data, 全零的放 .bss, 常量放 .rodata. 连续的零用 .zero
+void RISC_VisitGlobals(const vector<KGlobalVar> &globals)
 {
-    struct Reg value = RISC_Visit(store.value);
-    koopa_raw_value_t dest = store.dest;
-    assert(value_map.count(dest));
-    if (value_map[dest].reg_add == -1)
+    string section;
+    for (auto &global : globals)
     {
-        value_map[dest].reg_add = stack_top;
-        stack_top += 4;
+        vector<int32_t> words(global.init.begin(), global.init.end());
+        words.resize(KIR_Words(global.type.dims), 0);
+        bool zero = all_of(words.begin(), words.end(), [](int32_t w) { return w == 0; });
+        string want = global.is_const ? ".section .rodata" : zero ? ".bss" : ".data";
+        if (want != section)
+        {
+            section = want;
+            cout << section << "\n";
+            cout << "  " << ".p2align 2" << "\n";
+        }
+        cout << "  " << ".globl " << global.name.substr(1) << "\n";
+        cout << global.name.substr(1) << ":" << "\n";
+        for (size_t pos = 0; pos < words.size();)
+        {
+            size_t end = pos;
+            if (words[pos] == 0)
+            {
+                while (end < words.size() && words[end] == 0)
+                    ++end;
+                cout << "  " << ".zero " << 4 * (end - pos) << "\n";
+            }
+            else
+            {
+                cout << "  " << ".word ";
+                while (end < words.size() && words[end] != 0 && end - pos < 8)
+                {
+                    cout << (end > pos ? ", " : "") << words[end];
+                    ++end;
+                }
+                cout << "\n";
+            }
+            pos = end;
+        }
     }
-    int reg_name = value.reg_name, reg_add = value_map[dest].reg_add;
-    cout << "  " << "sw " << reg_names[reg_name] << ", " << to_string(reg_add) << "(sp)" << "\n";
+    if (!section.empty())
+        cout << "\n";
 }
 
-void RISC_Visit(const koopa_raw_branch_t &branch)
+void RISC_Visit_Branch(const KInst &branch)
 {
-    string true_label = branch.true_bb->name + 1;
-    string false_label = branch.false_bb->name + 1;
-    int cond_reg = RISC_Visit(branch.cond).reg_name;
+    string true_label = bb_label(branch.true_bb);
+    string false_label = bb_label(branch.false_bb);
+    int cond_reg = RISC_Visit(branch.lhs).reg_name;
+    // 下一个块是哪一边就落到哪一边
+    if (branch.true_bb == next_bb && branch.false_bb != next_bb)
+    {
+        cout << "  " << "beqz " << reg_names[cond_reg] << ", " << false_label << "\n";
+        return;
+    }
     cout << "  " << "bnez " << reg_names[cond_reg] << ", " << true_label << "\n";
-    cout << "  " << "j " << false_label << "\n";
+    if (branch.false_bb != next_bb)
+        cout << "  " << "j " << false_label << "\n";
 }
 
-void RISC_Visit(const koopa_raw_jump_t &jump)
+void RISC_Visit_Jump(const KInst &jump)
 {
-    string target = jump.target->name + 1;
+    if (jump.true_bb == next_bb)
+        return;
+    string target = bb_label(jump.true_bb);
     cout << "  " << "j " << target << "\n";
 }
+
+// 调用约定: 前 8 个参数放 a0-a7, 其余放在 sp 开始的出参区, 返回值在 a0
+Reg RISC_Visit_Call(const KInst &call)
+{
+    int pos = present_pos;
+    // 调用会改掉 a/t 寄存器: 调用之后还要用的值先写回栈上
+    for (int i = 0; i < NUM_CALLER_REGS; ++i)
+    {
+        if (reg_stats[i] == 1)
+        {
+            int value = registers[i];
+            if (value_map[value].reg_add == -1 && used_after(value, pos + 1))
+            {
+                value_map[value].reg_add = stack_top;
+                stack_top += 4;
+                emit_stack("sw", reg_names[i], value_map[value].reg_add);
+            }
+        }
+    }
+    // 第 9 个起的参数先写进出参区, 前 8 个里在寄存器中的参数要一起搬 (目标和源可能交叉)
+    vector<pair<string, string> > moves; // (目标, 源)
+    for (size_t i = 0; i < call.args.size(); ++i)
+    {
+        const KValue &arg = call.args[i];
+        bool in_reg = arg.kind == KV_TEMP && !is_static_addr(arg) && value_map[arg.v].reg_name != -1;
+        if (i < 8)
+        {
+            if (in_reg)
+                moves.push_back({reg_names[i], reg_names[value_map[arg.v].reg_name]});
+            continue;
+        }
+        string reg = in_reg ? reg_names[value_map[arg.v].reg_name] : "t6";
+        if (arg.kind == KV_IMM)
+            cout << "  " << "li t6, " << to_string(arg.v) << "\n";
+        else if (is_static_addr(arg))
+            emit_addr("t6", arg);
+        else if (!in_reg)
+            emit_stack("lw", "t6", value_map[arg.v].reg_add);
+        emit_stack("sw", reg, ((int)i - 8) * 4);
+    }
+    while (!moves.empty())
+    {
+        bool progress = false;
+        for (size_t k = 0; k < moves.size() && !progress; ++k)
+        {
+            bool blocked = false;
+            for (size_t m = 0; m < moves.size(); ++m)
+                if (m != k && moves[m].second == moves[k].first)
+                    blocked = true;
+            if (blocked)
+                continue;
+            if (moves[k].first != moves[k].second)
+                cout << "  " << "mv " << moves[k].first << ", " << moves[k].second << "\n";
+            moves.erase(moves.begin() + k);
+            progress = true;
+        }
+        if (!progress)
+        {
+            // 成环了: 借 t6 断开
+            string src = moves[0].second;
+            cout << "  " << "mv t6, " << src << "\n";
+            for (auto &move : moves)
+                if (move.second == src)
+                    move.second = "t6";
+        }
+    }
+    for (size_t i = 0; i < call.args.size() && i < 8; ++i)
+    {
+        const KValue &arg = call.args[i];
+        if (arg.kind == KV_IMM)
+            cout << "  " << "li " << reg_names[i] << ", " << to_string(arg.v) << "\n";
+        else if (is_static_addr(arg))
+            emit_addr(reg_names[i], arg);
+        else if (value_map[arg.v].reg_name == -1)
+            emit_stack("lw", reg_names[i], value_map[arg.v].reg_add);
+    }
+    for (int i = 0; i < NUM_CALLER_REGS; ++i)
+    {
+        if (reg_stats[i] == 1)
+            value_map[registers[i]].reg_name = -1;
+        reg_stats[i] = 0;
+        reg_has_imm[i] = false;
+    }
+    struct Reg result_var = {-1, -1};
+    if (tail_calls.count(&call))
+    {
+        cout << epilogue_mark;
+        cout << "  " << "tail " << call.callee.substr(1) << "\n";
+        return result_var;
+    }
+    cout << "  " << "call " << call.callee.substr(1) << "\n";
+    if (call.dest != -1)
+    {
+        // 还要跨过后面的调用的返回值挪进 s 寄存器
+        result_var.reg_name = find_reg(1);
+        if (result_var.reg_name != 0)
+            cout << "  " << "mv " << reg_names[result_var.reg_name] << ", a0" << "\n";
+    }
+    return result_var;
+}
+
+// Hacker's Delight 10-1: 有符号除以 d 用的魔数和移位量,
+// 要求 |d| >= 2 且不是 2 的幂
+void cal_magic(int32_t d, int32_t &magic, int &shift)
+{
+    const uint32_t two31 = 0x80000000u;
+    uint32_t ad = d < 0 ? 0u - (uint32_t)d : (uint32_t)d;
+    uint32_t t = two31 + ((uint32_t)d >> 31);
+    uint32_t anc = t - 1 - t % ad;
+    int p = 31;
+    uint32_t q1 = two31 / anc, r1 = two31 - q1 * anc;
+    uint32_t q2 = two31 / ad, r2 = two31 - q2 * ad;
+    uint32_t delta;
+    do
+    {
+        p++;
+        q1 = 2 * q1;
+        r1 = 2 * r1;
+        if (r1 >= anc)
+        {
+            q1++;
+            r1 -= anc;
+        }
+        q2 = 2 * q2;
+        r2 = 2 * r2;
+        if (r2 >= ad)
+        {
+            q2++;
+            r2 -= ad;
+        }
+        delta = ad - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+    magic = (int32_t)(q2 + 1);
+    if (d < 0)
+        magic = -magic;
+    shift = p - 32;
+}
+
+// x / d 和 x % d, d 是编译期常量: 用乘高位和移位代替 div/rem,
+// 结果和 C 的截断除法完全一致
+Reg div_by_const(const KInst &binary, int left_register, int32_t d)
+{
+    bool is_mod = binary.op == KB_MOD;
+    int old_stat = reg_stats[left_register];
+    reg_stats[left_register] = 2; // x 在整个序列里都要用
+    struct Reg result_var = {find_reg(1), -1};
+    string x = reg_names[left_register];
+    string res = reg_names[result_var.reg_name];
+
+    if (d == 1 || d == -1)
+    {
+        if (is_mod)
+            cout << "  " << "mv " << res << ", x0" << "\n";
+        else if (d == 1)
+            cout << "  " << "mv " << res << ", " << x << "\n";
+        else
+            cout << "  " << "sub " << res << ", x0, " << x << "\n";
+        reg_stats[left_register] = old_stat;
+        return result_var;
+    }
+
+    reg_stats[result_var.reg_name] = 2;
+    int tmp_register = find_reg(2);
+    reg_stats[result_var.reg_name] = 1;
+    string tmp = reg_names[tmp_register];
+    uint32_t ad = d < 0 ? 0u - (uint32_t)d : (uint32_t)d;
+    if ((ad & (ad - 1)) == 0)
+    {
+        // 2^k: 负数先加上 2^k - 1 再算术右移
+        int k = 0;
+        while ((1u << k) != ad)
+            k++;
+        if (k == 1)
+            cout << "  " << "srli " << tmp << ", " << x << ", 31" << "\n";
+        else
+        {
+            cout << "  " << "srai " << tmp << ", " << x << ", 31" << "\n";
+            cout << "  " << "srli " << tmp << ", " << tmp << ", " << to_string(32 - k) << "\n";
+        }
+        cout << "  " << "add " << res << ", " << x << ", " << tmp << "\n";
+        cout << "  " << "srai " << res << ", " << res << ", " << to_string(k) << "\n";
+        if (is_mod)
+        {
+            // x % d == x % |d| == x - (x / |d|) * |d|
+            cout << "  " << "slli " << res << ", " << res << ", " << to_string(k) << "\n";
+            cout << "  " << "sub " << res << ", " << x << ", " << res << "\n";
+        }
+        else if (d < 0)
+            cout << "  " << "sub " << res << ", x0, " << res << "\n";
+    }
+    else
+    {
+        int32_t magic;
+        int shift;
+        cal_magic(d, magic, shift);
+        cout << "  " << "li " << tmp << ", " << to_string(magic) << "\n";
+        cout << "  " << "mulh " << res << ", " << x << ", " << tmp << "\n";
+        if (d > 0 && magic < 0)
+            cout << "  " << "add " << res << ", " << res << ", " << x << "\n";
+        else if (d < 0 && magic > 0)
+            cout << "  " << "sub " << res << ", " << res << ", " << x << "\n";
+        if (shift > 0)
+            cout << "  " << "srai " << res << ", " << res << ", " << to_string(shift) << "\n";
+        // 商为负时加 1, 向零取整
+        cout << "  " << "srli " << tmp << ", " << res << ", 31" << "\n";
+        cout << "  " << "add " << res << ", " << res << ", " << tmp << "\n";
+        if (is_mod)
+        {
+            cout << "  " << "li " << tmp << ", " << to_string(d) << "\n";
+            cout << "  " << "mul " << tmp << ", " << res << ", " << tmp << "\n";
+            cout << "  " << "sub " << res << ", " << x << ", " << tmp << "\n";
+        }
+    }
+    reg_stats[tmp_register] = 0;
+    reg_stats[left_register] = old_stat;
+    return result_var;
+}
@@ -0,0 +1,871 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// 内置汇编器 (-obj): 把 RISC_Visit 输出的汇编文本直接编码成 RV32IM 机器码,
+// 写成可重定位的 ELF 目标文件, 不用再调外部汇编器.
+// 只认后端自己会生成的指令和伪指令; 汇编可以一段一段地喂 (流式模式每个函数一段),
+// .L 开头的局部标号只在一段里有效, 函数调用和全局变量的地址一律留给链接器重定位.
+// 全局变量放在 .data / .rodata / .bss 里, 只认 .word, .zero 和 .p2align
+
+const int R_RISCV_CALL_PLT = 19;
+const int R_RISCV_HI20 = 26;   // lui rd, %hi(sym)
+const int R_RISCV_LO12_I = 27; // addi / lw 的 %lo(sym)
+const int R_RISCV_LO12_S = 28; // sw 的 %lo(sym)
+
+enum RVSection
+{
+    RV_TEXT, RV_DATA, RV_RODATA, RV_BSS,
+};
+
+struct RVSymbol
+{
+    string name;
+    uint32_t value = 0; // 在所在节里的偏移
+    uint32_t size = 0;
+    bool defined = false;
+    int section = RV_TEXT; // 函数在 .text 里, 其它的是全局变量
+};
+
+struct RVReloc
+{
+    uint32_t offset; // 指令的位置; call / tail 是 auipc 的位置, 后面紧跟 jalr
+    int symbol;      // RVObject::symbols 的下标
+    int type;
+};
+
+struct RVObject
+{
+    vector<uint8_t> text;
+    vector<uint8_t> data, rodata;
+    uint32_t bss_size = 0;
+    vector<RVSymbol> symbols;
+    map<string, int> symbol_index;
+    vector<RVReloc> relocs;
+    map<string, uint32_t> labels; // 所有标号的位置, 包括不进符号表的 .L 局部标号
+};
+
+// 一条源指令, 编码成 size 个字节
+struct RVAsmInst
+{
+    string line;
+    string op;
+    vector<string> args;
+    uint32_t offset = 0;
+    int size = 4;
+};
+
+static int RVAsm_Symbol(RVObject &obj, const string &name)
+{
+    auto it = obj.symbol_index.find(name);
+    if (it != obj.symbol_index.end())
+        return it->second;
+    obj.symbols.push_back(RVSymbol());
+    obj.symbols.back().name = name;
+    obj.symbol_index[name] = obj.symbols.size() - 1;
+    return obj.symbols.size() - 1;
+}
+
+[[noreturn]] static void RVAsm_Error(const string &msg, const string &line)
+{
+    cerr << "asm error: " << msg << ": " << line << endl;
+    abort();
+}
+
+static int RVAsm_Reg(const string &name, const string &line)
+{
+    static map<string, int> regs;
+    if (regs.empty())
+    {
+        regs["x0"] = regs["zero"] = 0;
+        regs["ra"] = 1;
+        regs["sp"] = 2;
+        regs["gp"] = 3;
+        regs["tp"] = 4;
+        regs["t0"] = 5, regs["t1"] = 6, regs["t2"] = 7;
+        regs["s0"] = regs["fp"] = 8;
+        regs["s1"] = 9;
+        for (int i = 0; i < 8; ++i)
+            regs["a" + to_string(i)] = 10 + i;
+        for (int i = 2; i < 12; ++i)
+            regs["s" + to_string(i)] = 16 + i;
+        for (int i = 3; i < 7; ++i)
+            regs["t" + to_string(i)] = 25 + i;
+    }
+    auto it = regs.find(name);
+    if (it == regs.end())
+        RVAsm_Error("bad register '" + name + "'", line);
+    return it->second;
+}
+
+static int32_t RVAsm_Imm(const string &text, const string &line)
+{
+    char *end;
+    long value = strtol(text.c_str(), &end, 0);
+    if (text.empty() || *end != '\0')
+        RVAsm_Error("bad immediate '" + text + "'", line);
+    return (int32_t)value;
+}
+
+// "%hi(sym)" / "%lo(sym)" (kind 是 "hi" 或 "lo") -> sym, 不是这种写法返回空串
+static string RVAsm_RelocSymbol(const string &text, const string &kind)
+{
+    if (text.size() < 6 || text.compare(0, 4, "%" + kind + "(") != 0 || text.back() != ')')
+        return "";
+    return text.substr(4, text.size() - 5);
+}
+
+// "off(reg)" -> (off, reg). 偏移量也可以是 %lo(sym), 这时 sym 非空, off 为 0
+static pair<int32_t, int> RVAsm_Mem(const string &text, const string &line, string &sym)
+{
+    size_t open = text.rfind('('), close = text.size() - 1;
+    if (open == string::npos || text[close] != ')')
+        RVAsm_Error("bad memory operand '" + text + "'", line);
+    sym = RVAsm_RelocSymbol(text.substr(0, open), "lo");
+    int32_t offset = sym.empty() ? RVAsm_Imm(text.substr(0, open), line) : 0;
+    return {offset, RVAsm_Reg(text.substr(open + 1, close - open - 1), line)};
+}
+
+static bool RVAsm_FitsImm12(int32_t imm)
+{
+    return imm >= -2048 && imm < 2048;
+}
+
+// li 拆成 lui 的高 20 位和 addi 的低 12 位 (低位按有符号算, 所以高位要进位)
+static void RVAsm_SplitImm(int32_t imm, uint32_t &hi, int32_t &lo)
+{
+    hi = ((uint32_t)imm + 0x800) >> 12;
+    lo = (int32_t)((uint32_t)imm - (hi << 12));
+}
+
+// ---------------------------------------------------------------- 编码
+
+static uint32_t RVAsm_R(int funct7, int rs2, int rs1, int funct3, int rd, int opcode)
+{
+    return (uint32_t)funct7 << 25 | rs2 << 20 | rs1 << 15 | funct3 << 12 | rd << 7 | opcode;
+}
+
+static uint32_t RVAsm_I(int32_t imm, int rs1, int funct3, int rd, int opcode)
+{
+    return ((uint32_t)imm & 0xfff) << 20 | rs1 << 15 | funct3 << 12 | rd << 7 | opcode;
+}
+
+static uint32_t RVAsm_S(int32_t imm, int rs2, int rs1, int funct3, int opcode)
+{
+    uint32_t u = (uint32_t)imm;
+    return (u >> 5 & 0x7f) << 25 | rs2 << 20 | rs1 << 15 | funct3 << 12 | (u & 0x1f) << 7 | opcode;
+}
+
+static uint32_t RVAsm_B(int32_t imm, int rs2, int rs1, int funct3)
+{
+    uint32_t u = (uint32_t)imm;
+    return (u >> 12 & 1) << 31 | (u >> 5 & 0x3f) << 25 | rs2 << 20 | rs1 << 15 | funct3 << 12 | (u >> 1 & 0xf) << 8 |
+           (u >> 11 & 1) << 7 | 0x63;
+}
+
+static uint32_t RVAsm_J(int32_t imm, int rd)
+{
+    uint32_t u = (uint32_t)imm;
+    return (u >> 20 & 1) << 31 | (u >> 1 & 0x3ff) << 21 | (u >> 11 & 1) << 20 | (u >> 12 & 0xff) << 12 | rd << 7 | 0x6f;
+}
+
+static uint32_t RVAsm_U(uint32_t imm20, int rd, int opcode)
+{
+    return (imm20 & 0xfffff) << 12 | rd << 7 | opcode;
+}
+
+// R 型指令: funct7, funct3
+static const map<string, pair<int, int> > &RVAsm_ROps()
+{
+    static const map<string, pair<int, int> > ops = {
+        {"add", {0x00, 0}}, {"sub", {0x20, 0}}, {"sll", {0x00, 1}}, {"slt", {0x00, 2}}, {"sltu", {0x00, 3}},
+        {"xor", {0x00, 4}}, {"srl", {0x00, 5}}, {"sra", {0x20, 5}}, {"or", {0x00, 6}},  {"and", {0x00, 7}},
+        {"mul", {0x01, 0}}, {"mulh", {0x01, 1}}, {"div", {0x01, 4}}, {"rem", {0x01, 6}},
+    };
+    return ops;
+}
+
+// I 型算术指令: funct3 (移位的 funct7 放在立即数高位)
+static const map<string, pair<int, int> > &RVAsm_IOps()
+{
+    static const map<string, pair<int, int> > ops = {
+        {"addi", {0x00, 0}}, {"slti", {0x00, 2}}, {"sltiu", {0x00, 3}}, {"xori", {0x00, 4}}, {"ori", {0x00, 6}},
+        {"andi", {0x00, 7}}, {"slli", {0x00, 1}}, {"srli", {0x00, 5}},  {"srai", {0x20, 5}},
+    };
+    return ops;
+}
+
+static void RVAsm_Emit(RVObject &obj, uint32_t word)
+{
+    for (int i = 0; i < 4; ++i)
+        obj.text.push_back(word >> (8 * i) & 0xff);
+}
+
+static bool RVAsm_InBranchRange(int32_t delta)
+{
+    return delta >= -4096 && delta < 4096;
+}
+
+static void RVAsm_Encode(RVObject &obj, const RVAsmInst &inst, const map<string, uint32_t> &labels)
+{
+    const string &op = inst.op, &line = inst.line;
+    const vector<string> &a = inst.args;
+    auto need = [&](size_t n) {
+        if (a.size() != n)
+            RVAsm_Error("expected " + to_string(n) + " operands", line);
+    };
+    auto target = [&](const string &label) -> int32_t {
+        auto it = labels.find(label);
+        if (it == labels.end())
+            RVAsm_Error("undefined label '" + label + "'", line);
+        return (int32_t)(it->second - inst.offset);
+    };
+
+    if (RVAsm_ROps().count(op) || op == "sgt")
+    {
+        need(3);
+        int rd = RVAsm_Reg(a[0], line), rs1 = RVAsm_Reg(a[1], line), rs2 = RVAsm_Reg(a[2], line);
+        if (op == "sgt")
+            RVAsm_Emit(obj, RVAsm_R(0x00, rs1, rs2, 2, rd, 0x33)); // slt rd, rs2, rs1
+        else
+            RVAsm_Emit(obj, RVAsm_R(RVAsm_ROps().at(op).first, rs2, rs1, RVAsm_ROps().at(op).second, rd, 0x33));
+    }
+    else if (op == "addi" && a.size() == 3 && !RVAsm_RelocSymbol(a[2], "lo").empty())
+    {
+        obj.relocs.push_back({inst.offset, RVAsm_Symbol(obj, RVAsm_RelocSymbol(a[2], "lo")), R_RISCV_LO12_I});
+        RVAsm_Emit(obj, RVAsm_I(0, RVAsm_Reg(a[1], line), 0, RVAsm_Reg(a[0], line), 0x13));
+    }
+    else if (RVAsm_IOps().count(op))
+    {
+        need(3);
+        int32_t imm = RVAsm_Imm(a[2], line);
+        auto fields = RVAsm_IOps().at(op);
+        if (fields.second == 1 || fields.second == 5)
+        {
+            if (imm < 0 || imm > 31)
+                RVAsm_Error("shift amount out of range", line);
+            imm |= fields.first << 5;
+        }
+        else if (!RVAsm_FitsImm12(imm))
+            RVAsm_Error("immediate out of range", line);
+        RVAsm_Emit(obj, RVAsm_I(imm, RVAsm_Reg(a[1], line), fields.second, RVAsm_Reg(a[0], line), 0x13));
+    }
+    else if (op == "li")
+    {
+        need(2);
+        int rd = RVAsm_Reg(a[0], line);
+        int32_t imm = RVAsm_Imm(a[1], line);
+        if (RVAsm_FitsImm12(imm))
+            RVAsm_Emit(obj, RVAsm_I(imm, 0, 0, rd, 0x13));
+        else
+        {
+            uint32_t hi;
+            int32_t lo;
+            RVAsm_SplitImm(imm, hi, lo);
+            RVAsm_Emit(obj, RVAsm_U(hi, rd, 0x37));
+            if (lo != 0)
+                RVAsm_Emit(obj, RVAsm_I(lo, rd, 0, rd, 0x13));
+        }
+    }
+    else if (op == "lui")
+    {
+        need(2);
+        string sym = RVAsm_RelocSymbol(a[1], "hi");
+        if (sym.empty())
+            RVAsm_Error("lui only takes %hi(symbol)", line);
+        obj.relocs.push_back({inst.offset, RVAsm_Symbol(obj, sym), R_RISCV_HI20});
+        RVAsm_Emit(obj, RVAsm_U(0, RVAsm_Reg(a[0], line), 0x37));
+    }
+    else if (op == "mv")
+    {
+        need(2);
+        RVAsm_Emit(obj, RVAsm_I(0, RVAsm_Reg(a[1], line), 0, RVAsm_Reg(a[0], line), 0x13));
+    }
+    else if (op == "seqz")
+    {
+        need(2);
+        RVAsm_Emit(obj, RVAsm_I(1, RVAsm_Reg(a[1], line), 3, RVAsm_Reg(a[0], line), 0x13));
+    }
+    else if (op == "snez")
+    {
+        need(2);
+        RVAsm_Emit(obj, RVAsm_R(0x00, RVAsm_Reg(a[1], line), 0, 3, RVAsm_Reg(a[0], line), 0x33));
+    }
+    else if (op == "lw" || op == "sw")
+    {
+        need(2);
+        string sym;
+        auto mem = RVAsm_Mem(a[1], line, sym);
+        if (!RVAsm_FitsImm12(mem.first))
+            RVAsm_Error("offset out of range", line);
+        if (!sym.empty())
+            obj.relocs.push_back({inst.offset, RVAsm_Symbol(obj, sym), op == "lw" ? R_RISCV_LO12_I : R_RISCV_LO12_S});
+        if (op == "lw")
+            RVAsm_Emit(obj, RVAsm_I(mem.first, mem.second, 2, RVAsm_Reg(a[0], line), 0x03));
+        else
+            RVAsm_Emit(obj, RVAsm_S(mem.first, RVAsm_Reg(a[0], line), mem.second, 2, 0x23));
+    }
+    else if (op == "bnez" || op == "beqz")
+    {
+        need(2);
+        int rs = RVAsm_Reg(a[0], line), funct3 = op == "bnez" ? 1 : 0;
+        int32_t delta = target(a[1]);
+        if (inst.size == 4)
+            RVAsm_Emit(obj, RVAsm_B(delta, 0, rs, funct3));
+        else
+        {
+            // 够不着: 反过来跳过一条 j
+            RVAsm_Emit(obj, RVAsm_B(8, 0, rs, funct3 ^ 1));
+            RVAsm_Emit(obj, RVAsm_J(delta - 4, 0));
+        }
+    }
+    else if (op == "j")
+    {
+        need(1);
+        int32_t delta = target(a[0]);
+        if (delta < -(1 << 20) || delta >= (1 << 20))
+            RVAsm_Error("jump out of range", line);
+        RVAsm_Emit(obj, RVAsm_J(delta, 0));
+    }
+    else if (op == "call")
+    {
+        need(1);
+        obj.relocs.push_back({inst.offset, RVAsm_Symbol(obj, a[0]), R_RISCV_CALL_PLT});
+        RVAsm_Emit(obj, RVAsm_U(0, 1, 0x17));      // auipc ra, 0
+        RVAsm_Emit(obj, RVAsm_I(0, 1, 0, 1, 0x67)); // jalr ra, 0(ra)
+    }
+    else if (op == "tail")
+    {
+        // 尾调用: 用 t1 算地址, 不写 ra
+        need(1);
+        obj.relocs.push_back({inst.offset, RVAsm_Symbol(obj, a[0]), R_RISCV_CALL_PLT});
+        RVAsm_Emit(obj, RVAsm_U(0, 6, 0x17));      // auipc t1, 0
+        RVAsm_Emit(obj, RVAsm_I(0, 6, 0, 0, 0x67)); // jalr zero, 0(t1)
+    }
+    else if (op == "ret")
+    {
+        need(0);
+        RVAsm_Emit(obj, RVAsm_I(0, 1, 0, 0, 0x67));
+    }
+    else
+        RVAsm_Error("unknown instruction", line);
+}
+
+// ---------------------------------------------------------------- 反汇编 (-verify-obj)
+
+static string RVAsm_RegName(int reg)
+{
+    static const char *names[32] = {"x0", "ra", "sp", "gp", "tp", "t0", "t1", "t2", "s0", "s1",  "a0",
+                                    "a1", "a2", "a3", "a4", "a5", "a6", "a7", "s2", "s3", "s4",  "s5",
+                                    "s6", "s7", "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6"};
+    return names[reg];
+}
+
+static int32_t RVAsm_SignExtend(uint32_t value, int bits)
+{
+    return (int32_t)(value << (32 - bits)) >> (32 - bits);
+}
+
+static uint32_t RVAsm_Word(const RVObject &obj, uint32_t offset)
+{
+    return obj.text[offset] | obj.text[offset + 1] << 8 | obj.text[offset + 2] << 16 | (uint32_t)obj.text[offset + 3] << 24;
+}
+
+// 把 [offset, offset + size) 反汇编回后端写出的那种文本, 伪指令也还原回去.
+// 只用于校验, 认不出来的编码原样给出十六进制. reloc_at: 指令位置 -> 它的重定位
+static string RVAsm_Disassemble(const RVObject &obj, uint32_t offset, int size, const map<uint32_t, string> &label_at,
+                                const map<uint32_t, const RVReloc *> &reloc_at)
+{
+    auto reloc_it = reloc_at.find(offset);
+    const RVReloc *reloc = reloc_it == reloc_at.end() ? nullptr : reloc_it->second;
+    string reloc_sym = reloc ? obj.symbols[reloc->symbol].name : "";
+    auto label = [&](uint32_t address) {
+        auto it = label_at.find(address);
+        return it == label_at.end() ? "<" + to_string(address) + ">" : it->second;
+    };
+    uint32_t w = RVAsm_Word(obj, offset);
+    int opcode = w & 0x7f, rd = w >> 7 & 0x1f, funct3 = w >> 12 & 7, rs1 = w >> 15 & 0x1f, rs2 = w >> 20 & 0x1f,
+        funct7 = w >> 25;
+    int32_t imm_i = RVAsm_SignExtend(w >> 20, 12);
+    stringstream ss;
+    if (opcode == 0x33)
+    {
+        if (funct7 == 0 && funct3 == 3 && rs1 == 0)
+            ss << "snez " << RVAsm_RegName(rd) << ", " << RVAsm_RegName(rs2);
+        else
+        {
+            for (auto &kv : RVAsm_ROps())
+                if (kv.second.first == funct7 && kv.second.second == funct3)
+                    ss << kv.first << " " << RVAsm_RegName(rd) << ", " << RVAsm_RegName(rs1) << ", " << RVAsm_RegName(rs2);
+        }
+    }
+    else if (opcode == 0x13 && reloc && reloc->type == R_RISCV_LO12_I && funct3 == 0 && imm_i == 0)
+        ss << "addi " << RVAsm_RegName(rd) << ", " << RVAsm_RegName(rs1) << ", %lo(" << reloc_sym << ")";
+    else if (opcode == 0x13)
+    {
+        if (funct3 == 0 && rs1 == 0)
+            ss << "li " << RVAsm_RegName(rd) << ", " << imm_i;
+        else if (funct3 == 0 && imm_i == 0)
+            ss << "mv " << RVAsm_RegName(rd) << ", " << RVAsm_RegName(rs1);
+        else if (funct3 == 3 && imm_i == 1)
+            ss << "seqz " << RVAsm_RegName(rd) << ", " << RVAsm_RegName(rs1);
+        else
+        {
+            int shift_kind = funct3 == 1 || funct3 == 5 ? (w >> 30 & 1) << 5 : 0;
+            int32_t imm = funct3 == 1 || funct3 == 5 ? rs2 : imm_i;
+            for (auto &kv : RVAsm_IOps())
+                if (kv.second.first == shift_kind && kv.second.second == funct3)
+                    ss << kv.first << " " << RVAsm_RegName(rd) << ", " << RVAsm_RegName(rs1) << ", " << imm;
+        }
+    }
+    else if (opcode == 0x37 && reloc && reloc->type == R_RISCV_HI20 && (w & 0xfffff000) == 0)
+        ss << "lui " << RVAsm_RegName(rd) << ", %hi(" << reloc_sym << ")";
+    else if (opcode == 0x37)
+    {
+        int32_t value = (int32_t)(w & 0xfffff000);
+        if (size == 8)
+            value += RVAsm_SignExtend(RVAsm_Word(obj, offset + 4) >> 20, 12);
+        ss << "li " << RVAsm_RegName(rd) << ", " << value;
+    }
+    else if (opcode == 0x03 && funct3 == 2)
+    {
+        ss << "lw " << RVAsm_RegName(rd) << ", ";
+        if (reloc && reloc->type == R_RISCV_LO12_I && imm_i == 0)
+            ss << "%lo(" << reloc_sym << ")";
+        else
+            ss << imm_i;
+        ss << "(" << RVAsm_RegName(rs1) << ")";
+    }
+    else if (opcode == 0x23 && funct3 == 2)
+    {
+        int32_t imm_s = RVAsm_SignExtend(funct7 << 5 | rd, 12);
+        ss << "sw " << RVAsm_RegName(rs2) << ", ";
+        if (reloc && reloc->type == R_RISCV_LO12_S && imm_s == 0)
+            ss << "%lo(" << reloc_sym << ")";
+        else
+            ss << imm_s;
+        ss << "(" << RVAsm_RegName(rs1) << ")";
+    }
+    else if (opcode == 0x63 || opcode == 0x6f)
+    {
+        // bnez/beqz 的长形式是反过来的条件跳 +8 再接 j
+        uint32_t jw = opcode == 0x63 && size == 8 ? RVAsm_Word(obj, offset + 4) : w;
+        uint32_t at = opcode == 0x63 && size == 8 ? offset + 4 : offset;
+        int32_t imm_j = RVAsm_SignExtend((jw >> 31) << 20 | (jw >> 12 & 0xff) << 12 | (jw >> 20 & 1) << 11 | (jw >> 21 & 0x3ff) << 1, 21);
+        int32_t imm_b = RVAsm_SignExtend((w >> 31) << 12 | (w >> 7 & 1) << 11 | (w >> 25 & 0x3f) << 5 | (w >> 8 & 0xf) << 1, 13);
+        if (opcode == 0x6f && rd == 0)
+            ss << "j " << label(at + imm_j);
+        else if (opcode == 0x63 && size == 4 && funct3 <= 1 && rs2 == 0)
+            ss << (funct3 ? "bnez " : "beqz ") << RVAsm_RegName(rs1) << ", " << label(offset + imm_b);
+        else if (opcode == 0x63 && size == 8 && funct3 <= 1 && rs2 == 0 && imm_b == 8)
+            ss << (funct3 ? "beqz " : "bnez ") << RVAsm_RegName(rs1) << ", " << label(at + imm_j);
+    }
+    else if (opcode == 0x67 && w == RVAsm_I(0, 1, 0, 0, 0x67))
+        ss << "ret";
+    else if (opcode == 0x17 && size == 8 && reloc && reloc->type == R_RISCV_CALL_PLT)
+        ss << (rd == 6 ? "tail " : "call ") << reloc_sym;
+    if (ss.str().empty())
+    {
+        ss << hex << "0x" << w;
+    }
+    return ss.str();
+}
+
+// 源文本里和反汇编结果写法不同的等价形式
+static string RVAsm_Canonical(const RVAsmInst &inst)
+{
+    const vector<string> &a = inst.args;
+    if (inst.op == "sgt")
+        return "slt " + a[0] + ", " + a[2] + ", " + a[1];
+    if (inst.op == "mv" && a[1] == "x0")
+        return "li " + a[0] + ", 0";
+    string text = inst.op;
+    for (size_t i = 0; i < a.size(); ++i)
+        text += (i == 0 ? " " : ", ") + a[i];
+    return text;
+}
+
+// ---------------------------------------------------------------- 汇编
+
+static vector<string> RVAsm_SplitArgs(const string &text)
+{
+    vector<string> args;
+    stringstream ss(text);
+    string arg;
+    while (getline(ss, arg, ','))
+    {
+        size_t begin = arg.find_first_not_of(" \t"), end = arg.find_last_not_of(" \t");
+        if (begin != string::npos)
+            args.push_back(arg.substr(begin, end - begin + 1));
+    }
+    return args;
+}
+
+// 数据节的一条伪指令: .word, .zero, .p2align
+static void RVAsm_Data(RVObject &obj, int section, const string &directive, const vector<string> &args,
+                       const string &line)
+{
+    vector<uint8_t> *bytes = section == RV_DATA ? &obj.data : section == RV_RODATA ? &obj.rodata : nullptr;
+    uint32_t size = bytes ? bytes->size() : obj.bss_size;
+    auto grow = [&](uint32_t n, uint32_t value) {
+        if (bytes)
+            for (uint32_t i = 0; i < n; ++i)
+                bytes->push_back(value >> (8 * (i % 4)) & 0xff);
+        else if (value == 0)
+            obj.bss_size += n;
+        else
+            RVAsm_Error("nonzero data in .bss", line);
+    };
+    if (directive == ".word")
+    {
+        if (args.empty())
+            RVAsm_Error("expected operands", line);
+        for (auto &arg : args)
+            grow(4, (uint32_t)RVAsm_Imm(arg, line));
+    }
+    else if (directive == ".zero")
+    {
+        if (args.size() != 1 || RVAsm_Imm(args[0], line) < 0)
+            RVAsm_Error("bad size", line);
+        grow(RVAsm_Imm(args[0], line), 0);
+    }
+    else if (directive == ".p2align")
+    {
+        if (args.size() != 1 || RVAsm_Imm(args[0], line) < 0 || RVAsm_Imm(args[0], line) > 12)
+            RVAsm_Error("bad alignment", line);
+        uint32_t align = 1u << RVAsm_Imm(args[0], line);
+        grow((align - size % align) % align, 0);
+    }
+    else
+        RVAsm_Error("unknown directive", line);
+}
+
+// 把一段汇编追加进 obj. verify 时把每条指令反汇编回来和源文本比较, 不一致就报错退出
+static void RVAsm_Assemble(RVObject &obj, const string &asm_text, bool verify = false)
+{
+    // 第一遍: 拆成标号和指令, 定下每条指令的初始长度; 数据直接放进各自的节
+    vector<RVAsmInst> insts;
+    vector<pair<string, size_t> > label_defs; // (标号, 它前面有几条指令)
+    vector<int> data_labels;                  // 数据节里的标号, 按出现的顺序
+    int section = RV_TEXT;                    // 每段都从 .text 开始
+    auto section_size = [&](int sec) -> uint32_t {
+        return sec == RV_DATA ? obj.data.size() : sec == RV_RODATA ? obj.rodata.size() : obj.bss_size;
+    };
+    stringstream in(asm_text);
+    string line;
+    while (getline(in, line))
+    {
+        size_t begin = line.find_first_not_of(" \t");
+        if (begin == string::npos)
+            continue;
+        line = line.substr(begin);
+        if (line.back() == ':' && section != RV_TEXT)
+        {
+            int sym = RVAsm_Symbol(obj, line.substr(0, line.size() - 1));
+            if (obj.symbols[sym].defined)
+                RVAsm_Error("symbol defined twice", line);
+            obj.symbols[sym].defined = true;
+            obj.symbols[sym].section = section;
+            obj.symbols[sym].value = section_size(section);
+            data_labels.push_back(sym);
+            continue;
+        }
+        if (line.back() == ':')
+        {
+            label_defs.push_back({line.substr(0, line.size() - 1), insts.size()});
+            continue;
+        }
+        if (line[0] == '.')
+        {
+            // 所有函数和全局变量都是全局的, .globl 不用管
+            size_t space = line.find(' ');
+            string directive = line.substr(0, space);
+            vector<string> args = space == string::npos ? vector<string>() : RVAsm_SplitArgs(line.substr(space + 1));
+            if (directive == ".text" || directive == ".data" || directive == ".bss")
+                section = directive == ".text" ? RV_TEXT : directive == ".data" ? RV_DATA : RV_BSS;
+            else if (directive == ".section" && args.size() == 1 && args[0] == ".rodata")
+                section = RV_RODATA;
+            else if (directive == ".globl")
+                continue;
+            else if (section != RV_TEXT)
+                RVAsm_Data(obj, section, directive, args, line);
+            else
+                RVAsm_Error("unknown directive", line);
+            continue;
+        }
+        if (section != RV_TEXT)
+            RVAsm_Error("instruction outside .text", line);
+        RVAsmInst inst;
+        inst.line = line;
+        size_t space = line.find(' ');
+        inst.op = line.substr(0, space);
+        if (space != string::npos)
+            inst.args = RVAsm_SplitArgs(line.substr(space + 1));
+        if (inst.op == "call" || inst.op == "tail")
+            inst.size = 8;
+        else if (inst.op == "li" && inst.args.size() == 2)
+        {
+            int32_t imm = RVAsm_Imm(inst.args[1], line);
+            uint32_t hi;
+            int32_t lo;
+            RVAsm_SplitImm(imm, hi, lo);
+            inst.size = RVAsm_FitsImm12(imm) || lo == 0 ? 4 : 8;
+        }
+        insts.push_back(inst);
+    }
+
+    // 第二遍起: 排地址, 够不着目标的 bnez/beqz 换成 8 字节的长形式, 直到不再变化.
+    // 指令只会变长, 所以一定收敛
+    uint32_t base = obj.text.size();
+    map<string, uint32_t> labels;
+    for (bool changed = true; changed;)
+    {
+        changed = false;
+        uint32_t offset = base;
+        size_t next_label = 0;
+        labels.clear();
+        for (size_t i = 0; i <= insts.size(); ++i)
+        {
+            for (; next_label < label_defs.size() && label_defs[next_label].second == i; ++next_label)
+                labels[label_defs[next_label].first] = offset;
+            if (i < insts.size())
+            {
+                insts[i].offset = offset;
+                offset += insts[i].size;
+            }
+        }
+        for (auto &inst : insts)
+        {
+            bool branch = inst.op == "bnez" || inst.op == "beqz";
+            if (!branch || inst.size != 4 || inst.args.size() != 2 || !labels.count(inst.args[1]))
+                continue;
+            if (!RVAsm_InBranchRange((int32_t)(labels[inst.args[1]] - inst.offset)))
+            {
+                inst.size = 8;
+                changed = true;
+            }
+        }
+    }
+
+    obj.labels.insert(labels.begin(), labels.end());
+
+    // 函数符号: 不以 .L 开头的标号, 大小到下一个函数符号或这一段结束为止
+    int last_func = -1;
+    for (auto &def : label_defs)
+    {
+        if (def.first.compare(0, 2, ".L") == 0)
+            continue;
+        int sym = RVAsm_Symbol(obj, def.first);
+        if (obj.symbols[sym].defined)
+            RVAsm_Error("symbol defined twice", def.first);
+        obj.symbols[sym].defined = true;
+        obj.symbols[sym].value = labels[def.first];
+        if (last_func != -1)
+            obj.symbols[last_func].size = obj.symbols[sym].value - obj.symbols[last_func].value;
+        last_func = sym;
+    }
+
+    for (auto &inst : insts)
+    {
+        RVAsm_Encode(obj, inst, labels);
+        if (obj.text.size() != inst.offset + inst.size)
+            RVAsm_Error("encoded size does not match layout", inst.line);
+    }
+    if (last_func != -1)
+        obj.symbols[last_func].size = obj.text.size() - obj.symbols[last_func].value;
+    // 全局变量的大小: 到同一节里的下一个标号或这一段结束为止
+    for (size_t i = 0; i < data_labels.size(); ++i)
+    {
+        RVSymbol &sym = obj.symbols[data_labels[i]];
+        uint32_t end = section_size(sym.section);
+        for (size_t j = i + 1; j < data_labels.size(); ++j)
+            if (obj.symbols[data_labels[j]].section == sym.section)
+            {
+                end = obj.symbols[data_labels[j]].value;
+                break;
+            }
+        sym.size = end - sym.value;
+    }
+
+    if (verify)
+    {
+        map<uint32_t, string> label_at;
+        for (auto &kv : labels)
+            label_at[kv.second] = kv.first;
+        map<uint32_t, const RVReloc *> reloc_at;
+        for (auto &reloc : obj.relocs)
+            if (reloc.offset >= base)
+                reloc_at[reloc.offset] = &reloc;
+        for (auto &inst : insts)
+        {
+            string expect = RVAsm_Canonical(inst),
+                   got = RVAsm_Disassemble(obj, inst.offset, inst.size, label_at, reloc_at);
+            if (got != expect)
+            {
+                // 同一个地址上可能有好几个标号, 反汇编只认得其中一个
+                bool alias = false;
+                if (!inst.args.empty() && labels.count(inst.args.back()))
+                {
+                    size_t comma = got.rfind(' ');
+                    string other = got.substr(comma + 1);
+                    alias = labels.count(other) && labels[other] == labels[inst.args.back()] &&
+                            got.substr(0, comma) == expect.substr(0, expect.rfind(' '));
+                }
+                if (!alias)
+                    RVAsm_Error("round trip gives '" + got + "'", inst.line);
+            }
+        }
+    }
+}
+
+// ---------------------------------------------------------------- ELF
+
+static void RVAsm_Put16(vector<uint8_t> &out, uint32_t value)
+{
+    out.push_back(value & 0xff);
+    out.push_back(value >> 8 & 0xff);
+}
+
+static void RVAsm_Put32(vector<uint8_t> &out, uint32_t value)
+{
+    RVAsm_Put16(out, value & 0xffff);
+    RVAsm_Put16(out, value >> 16);
+}
+
+static void RVAsm_Align(vector<uint8_t> &out, size_t align)
+{
+    while (out.size() % align != 0)
+        out.push_back(0);
+}
+
+// ELF32 小端可重定位文件: .text, 非空的 .data / .rodata / .bss, .rela.text, .symtab, .strtab, .shstrtab.
+// 符号表里先是空符号和 .text 的节符号 (局部), 然后是所有函数和全局变量, 包括只被引用的外部符号
+static void RVAsm_WriteELF(const RVObject &obj, ostream &os)
+{
+    const int SHT_PROGBITS = 1, SHT_SYMTAB = 2, SHT_STRTAB = 3, SHT_RELA = 4, SHT_NOBITS = 8;
+    const int SHF_WRITE = 1, SHF_ALLOC = 2, SHF_EXECINSTR = 4, SHF_INFO_LINK = 0x40;
+    const int STB_LOCAL = 0, STB_GLOBAL = 1, STT_NOTYPE = 0, STT_OBJECT = 1, STT_FUNC = 2, STT_SECTION = 3;
+    const int EM_RISCV = 243, EHDR_SIZE = 52, SHDR_SIZE = 40;
+
+    // 各节的下标: 空节是 0, .text 是 1, 数据节只在非空时才有
+    int shndx[4] = {1, 0, 0, 0};
+    int next_index = 2;
+    if (!obj.data.empty())
+        shndx[RV_DATA] = next_index++;
+    if (!obj.rodata.empty())
+        shndx[RV_RODATA] = next_index++;
+    if (obj.bss_size > 0)
+        shndx[RV_BSS] = next_index++;
+    const int symtab_index = next_index + 1, strtab_index = next_index + 2;
+
+    string shstrtab("\0", 1), strtab("\0", 1);
+    auto add_name = [](string &table, const string &name) {
+        uint32_t offset = table.size();
+        table += name;
+        table += '\0';
+        return offset;
+    };
+
+    vector<uint8_t> symtab(16, 0); // 0 号空符号
+    RVAsm_Put32(symtab, 0);
+    RVAsm_Put32(symtab, 0);
+    RVAsm_Put32(symtab, 0);
+    symtab.push_back(STB_LOCAL << 4 | STT_SECTION);
+    symtab.push_back(0);
+    RVAsm_Put16(symtab, 1);
+    const int first_global = 2;
+    for (auto &sym : obj.symbols)
+    {
+        RVAsm_Put32(symtab, add_name(strtab, sym.name));
+        RVAsm_Put32(symtab, sym.defined ? sym.value : 0);
+        RVAsm_Put32(symtab, sym.defined ? sym.size : 0);
+        int type = !sym.defined ? STT_NOTYPE : sym.section == RV_TEXT ? STT_FUNC : STT_OBJECT;
+        symtab.push_back(STB_GLOBAL << 4 | type);
+        symtab.push_back(0);
+        RVAsm_Put16(symtab, sym.defined ? shndx[sym.section] : 0);
+    }
+
+    vector<uint8_t> rela;
+    for (auto &reloc : obj.relocs)
+    {
+        RVAsm_Put32(rela, reloc.offset);
+        RVAsm_Put32(rela, (uint32_t)(reloc.symbol + first_global) << 8 | reloc.type);
+        RVAsm_Put32(rela, 0);
+    }
+
+    struct Section
+    {
+        uint32_t name, type, flags, offset, size, link, info, align, entsize;
+    };
+    vector<Section> sections(1, Section{0, 0, 0, 0, 0, 0, 0, 0, 0});
+    vector<uint8_t> out(EHDR_SIZE, 0);
+    auto add_section = [&](const string &name, uint32_t type, uint32_t flags, const void *data, size_t size,
+                           uint32_t link, uint32_t info, uint32_t align, uint32_t entsize) {
+        RVAsm_Align(out, align);
+        sections.push_back({add_name(shstrtab, name), type, flags, (uint32_t)out.size(), (uint32_t)size, link, info,
+                            align, entsize});
+        out.insert(out.end(), (const uint8_t *)data, (const uint8_t *)data + size);
+    };
+    add_section(".text", SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR, obj.text.data(), obj.text.size(), 0, 0, 4, 0);
+    if (shndx[RV_DATA])
+        add_section(".data", SHT_PROGBITS, SHF_ALLOC | SHF_WRITE, obj.data.data(), obj.data.size(), 0, 0, 4, 0);
+    if (shndx[RV_RODATA])
+        add_section(".rodata", SHT_PROGBITS, SHF_ALLOC, obj.rodata.data(), obj.rodata.size(), 0, 0, 4, 0);
+    if (shndx[RV_BSS])
+    {
+        add_section(".bss", SHT_NOBITS, SHF_ALLOC | SHF_WRITE, nullptr, 0, 0, 0, 4, 0);
+        sections.back().size = obj.bss_size;
+    }
+    add_section(".rela.text", SHT_RELA, SHF_INFO_LINK, rela.data(), rela.size(), symtab_index, 1, 4, 12);
+    add_section(".symtab", SHT_SYMTAB, 0, symtab.data(), symtab.size(), strtab_index, first_global, 4, 16);
+    add_section(".strtab", SHT_STRTAB, 0, strtab.data(), strtab.size(), 0, 0, 1, 0);
+    uint32_t shstrtab_name = add_name(shstrtab, ".shstrtab");
+    sections.push_back({shstrtab_name, SHT_STRTAB, 0, (uint32_t)out.size(), (uint32_t)shstrtab.size(), 0, 0, 1, 0});
+    out.insert(out.end(), shstrtab.begin(), shstrtab.end());
+
+    RVAsm_Align(out, 4);
+    uint32_t shoff = out.size();
+    for (auto &sec : sections)
+    {
+        RVAsm_Put32(out, sec.name);
+        RVAsm_Put32(out, sec.type);
+        RVAsm_Put32(out, sec.flags);
+        RVAsm_Put32(out, 0); // sh_addr
+        RVAsm_Put32(out, sec.offset);
+        RVAsm_Put32(out, sec.size);
+        RVAsm_Put32(out, sec.link);
+        RVAsm_Put32(out, sec.info);
+        RVAsm_Put32(out, sec.align);
+        RVAsm_Put32(out, sec.entsize);
+    }
+
+    vector<uint8_t> ehdr;
+    const uint8_t ident[16] = {0x7f, 'E', 'L', 'F', 1 /* ELFCLASS32 */, 1 /* ELFDATA2LSB */, 1 /* EV_CURRENT */};
+    ehdr.insert(ehdr.end(), ident, ident + 16);
+    RVAsm_Put16(ehdr, 1); // ET_REL
+    RVAsm_Put16(ehdr, EM_RISCV);
+    RVAsm_Put32(ehdr, 1); // e_version
+    RVAsm_Put32(ehdr, 0); // e_entry
+    RVAsm_Put32(ehdr, 0); // e_phoff
+    RVAsm_Put32(ehdr, shoff);
+    RVAsm_Put32(ehdr, 0); // e_flags: 软浮点 ABI, 没有压缩指令
+    RVAsm_Put16(ehdr, EHDR_SIZE);
+    RVAsm_Put16(ehdr, 0); // e_phentsize
+    RVAsm_Put16(ehdr, 0); // e_phnum
+    RVAsm_Put16(ehdr, SHDR_SIZE);
+    RVAsm_Put16(ehdr, sections.size());
+    RVAsm_Put16(ehdr, sections.size() - 1); // .shstrtab 是最后一节
+    copy(ehdr.begin(), ehdr.end(), out.begin());
+
+    os.write((const char *)out.data(), out.size());
+}
@@ -0,0 +1,299 @@
+#pragma once
+
+// 寄存器分配之后的表调度 (list scheduling), 对象是一个函数体的汇编文本.
+// 标号, 跳转, call, ret 把代码切成一段段, 每段内部按依赖图重排:
+// 写后读按产生者的延迟算, 读后写和写后写只保序, 所以用到的寄存器和分配结果完全一样,
+// 不会增加寄存器压力. 访存按 sp 偏移区分地址, 别的基址当成可能和谁都重叠.
+// 收益用单发射顺序流水线估算: 一条指令要等它读的寄存器算好才能发射, 等的周期就是停顿
+
+#include <map>
+#include <queue>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// 各指令的结果过几个周期才能被用, 没列出来的是 1. -sched-latency=op:n,... 可以改
+static map<string, int> sched_latency = {{"lw", 3}, {"mul", 3}, {"mulh", 3}, {"div", 20}, {"rem", 20}};
+// 整个程序调度前后估计的停顿周期数, -sched-report 时输出
+static long sched_stalls_before = 0, sched_stalls_after = 0;
+
+struct SchedInst
+{
+    string line;
+    string op;
+    vector<int> defs, uses;
+    bool load = false, store = false;
+    bool known_addr = false; // sp + 常数偏移
+    int offset = 0;
+};
+
+static int RVSched_Reg(const string &name)
+{
+    static const char *names[] = {"ra", "sp", "a0", "a1", "a2", "a3", "a4", "a5", "a6", "a7", "t0", "t1", "t2", "t3",
+                                  "t4", "t5", "t6", "s0", "s1", "s2", "s3", "s4", "s5", "s6", "s7", "s8", "s9", "s10",
+                                  "s11"};
+    for (int i = 0; i < (int)(sizeof(names) / sizeof(names[0])); ++i)
+        if (name == names[i])
+            return i;
+    return -1; // x0 和立即数
+}
+
+static bool RVSched_ParseLatency(const string &spec)
+{
+    stringstream ss(spec);
+    string item;
+    while (getline(ss, item, ','))
+    {
+        size_t colon = item.find(':');
+        if (colon == string::npos || colon == 0 || colon + 1 == item.size())
+            return false;
+        sched_latency[item.substr(0, colon)] = atoi(item.c_str() + colon + 1);
+    }
+    return true;
+}
+
+static int RVSched_Latency(const string &op)
+{
+    auto it = sched_latency.find(op);
+    return it == sched_latency.end() ? 1 : max(it->second, 1);
+}
+
+// 能参与调度的指令返回 true; 标号, 控制流和 call / tail 是段的边界
+static bool RVSched_Parse(const string &line, SchedInst &inst)
+{
+    if (line.compare(0, 2, "  ") != 0)
+        return false;
+    stringstream ss(line);
+    ss >> inst.op;
+    static const char *barriers[] = {"j", "bnez", "beqz", "call", "tail", "ret", ".globl"};
+    for (auto barrier : barriers)
+        if (inst.op == barrier)
+            return false;
+    inst.line = line;
+    vector<string> args;
+    string rest;
+    getline(ss, rest);
+    stringstream as(rest);
+    string arg;
+    while (getline(as, arg, ','))
+    {
+        size_t begin = arg.find_first_not_of(" \t"), end = arg.find_last_not_of(" \t");
+        if (begin != string::npos)
+            args.push_back(arg.substr(begin, end - begin + 1));
+    }
+    if (args.empty())
+        return false;
+    if (inst.op == "lw" || inst.op == "sw")
+    {
+        if (args.size() != 2)
+            return false;
+        size_t paren = args[1].rfind('(');
+        string base = args[1].substr(paren + 1, args[1].size() - paren - 2);
+        inst.offset = atoi(args[1].substr(0, paren).c_str());
+        inst.known_addr = base == "sp";
+        inst.uses.push_back(RVSched_Reg(base));
+        if (inst.op == "lw")
+        {
+            inst.load = true;
+            inst.defs.push_back(RVSched_Reg(args[0]));
+        }
+        else
+        {
+            inst.store = true;
+            inst.uses.push_back(RVSched_Reg(args[0]));
+        }
+    }
+    else
+    {
+        inst.defs.push_back(RVSched_Reg(args[0]));
+        for (size_t i = 1; i < args.size(); ++i)
+            inst.uses.push_back(RVSched_Reg(args[i]));
+    }
+    auto drop_zero = [](vector<int> &regs) {
+        vector<int> kept;
+        for (int r : regs)
+            if (r != -1)
+                kept.push_back(r);
+        regs = kept;
+    };
+    drop_zero(inst.defs);
+    drop_zero(inst.uses);
+    return true;
+}
+
+// 按给定顺序在单发射顺序流水线上跑一遍, 返回停顿的周期数
+static long RVSched_Stalls(const vector<SchedInst> &insts, const vector<int> &order)
+{
+    map<int, long> ready;
+    long cycle = 0, stalls = 0;
+    for (int i : order)
+    {
+        long issue = cycle;
+        for (int r : insts[i].uses)
+            if (ready.count(r))
+                issue = max(issue, ready[r]);
+        stalls += issue - cycle;
+        for (int r : insts[i].defs)
+            ready[r] = issue + RVSched_Latency(insts[i].op);
+        cycle = issue + 1;
+    }
+    return stalls;
+}
+
+// 一段指令的依赖图: succs[i] 里是 (后继, 至少隔几个周期)
+static vector<vector<pair<int, int> > > RVSched_Graph(const vector<SchedInst> &insts)
+{
+    int n = insts.size();
+    vector<vector<pair<int, int> > > succs(n);
+    map<int, int> last_def;
+    map<int, vector<int> > uses_since_def;
+    map<int, int> last_store;                 // sp 偏移 -> 最后一个写它的 sw
+    map<int, vector<int> > loads_since_store; // sp 偏移 -> 之后读它的 lw
+    vector<int> mem_since_barrier;            // 上一个地址未知的访存之后的所有访存
+    int mem_barrier = -1;
+    for (int i = 0; i < n; ++i)
+    {
+        const SchedInst &inst = insts[i];
+        for (int r : inst.uses)
+            if (last_def.count(r))
+                succs[last_def[r]].push_back({i, RVSched_Latency(insts[last_def[r]].op)});
+        for (int r : inst.defs)
+        {
+            for (int u : uses_since_def[r])
+                if (u != i)
+                    succs[u].push_back({i, 0});
+            if (last_def.count(r))
+                succs[last_def[r]].push_back({i, 1});
+        }
+        for (int r : inst.uses)
+            uses_since_def[r].push_back(i);
+        for (int r : inst.defs)
+        {
+            last_def[r] = i;
+            uses_since_def[r].clear();
+        }
+
+        if (!inst.load && !inst.store)
+            continue;
+        if (mem_barrier != -1)
+            succs[mem_barrier].push_back({i, inst.load && insts[mem_barrier].store ? 1 : 0});
+        if (!inst.known_addr)
+        {
+            // 地址不知道: 和前面所有访存保序, 后面的访存都排在它后面
+            for (int m : mem_since_barrier)
+                succs[m].push_back({i, inst.load && insts[m].store ? 1 : 0});
+            mem_since_barrier.clear();
+            last_store.clear();
+            loads_since_store.clear();
+            mem_barrier = i;
+            continue;
+        }
+        mem_since_barrier.push_back(i);
+        if (last_store.count(inst.offset))
+            succs[last_store[inst.offset]].push_back({i, 1});
+        if (inst.load)
+            loads_since_store[inst.offset].push_back(i);
+        else
+        {
+            for (int l : loads_since_store[inst.offset])
+                succs[l].push_back({i, 0});
+            loads_since_store[inst.offset].clear();
+            last_store[inst.offset] = i;
+        }
+    }
+    return succs;
+}
+
+// 关键路径优先的表调度, 返回新的顺序
+static vector<int> RVSched_Region(const vector<SchedInst> &insts)
+{
+    int n = insts.size();
+    vector<vector<pair<int, int> > > succs = RVSched_Graph(insts);
+    // 边总是从前往后, 倒着扫一遍就是到出口的最长路径
+    vector<long> height(n, 0);
+    vector<int> npreds(n, 0);
+    for (int i = n - 1; i >= 0; --i)
+    {
+        height[i] = RVSched_Latency(insts[i].op);
+        for (auto &edge : succs[i])
+            height[i] = max(height[i], edge.second + height[edge.first]);
+    }
+    for (int i = 0; i < n; ++i)
+        for (auto &edge : succs[i])
+            npreds[edge.first]++;
+
+    // available: 已经可以发射的, 按关键路径长度; pending: 还要等操作数的, 按最早周期
+    typedef pair<long, int> Entry;
+    auto by_height = [&](int a, int b) { return height[a] != height[b] ? height[a] < height[b] : a > b; };
+    priority_queue<int, vector<int>, decltype(by_height)> available(by_height);
+    priority_queue<Entry, vector<Entry>, greater<Entry> > pending;
+    vector<long> earliest(n, 0);
+    for (int i = 0; i < n; ++i)
+        if (npreds[i] == 0)
+            pending.push({0, i});
+    vector<int> order;
+    long cycle = 0;
+    while ((int)order.size() < n)
+    {
+        while (!pending.empty() && pending.top().first <= cycle)
+        {
+            available.push(pending.top().second);
+            pending.pop();
+        }
+        if (available.empty())
+        {
+            cycle = pending.top().first;
+            continue;
+        }
+        int i = available.top();
+        available.pop();
+        order.push_back(i);
+        for (auto &edge : succs[i])
+        {
+            earliest[edge.first] = max(earliest[edge.first], cycle + edge.second);
+            if (--npreds[edge.first] == 0)
+                pending.push({earliest[edge.first], edge.first});
+        }
+        cycle++;
+    }
+    return order;
+}
+
+// 调度一个函数体, 顺便累计调度前后的停顿估计
+static string RVSched_Function(const string &text)
+{
+    stringstream in(text), out;
+    vector<SchedInst> region;
+    auto flush = [&]() {
+        if (region.empty())
+            return;
+        vector<int> identity(region.size());
+        for (size_t i = 0; i < region.size(); ++i)
+            identity[i] = i;
+        vector<int> order = RVSched_Region(region);
+        long before = RVSched_Stalls(region, identity), after = RVSched_Stalls(region, order);
+        if (after > before)
+            order = identity; // 启发式偶尔会更差, 那就保持原样
+        sched_stalls_before += before;
+        sched_stalls_after += min(before, after);
+        for (int i : order)
+            out << region[i].line << "\n";
+        region.clear();
+    };
+    string line;
+    while (getline(in, line))
+    {
+        SchedInst inst;
+        if (RVSched_Parse(line, inst))
+        {
+            region.push_back(inst);
+            continue;
+        }
+        flush();
+        out << line << "\n";
+    }
+    flush();
+    return out.str();
+}
@@ -0,0 +1,340 @@
+// 手写的词法分析器 (-hand-lex), 和 sysy.l 给 parser 的 token 完全一样.
+// 整个输入读进内存一次扫完: 空白, 注释和标识符用 SSE2 一次看 16 个字节,
+// 关键字查一张完美哈希表, 整数字面量直接在缓冲区上算, 不再调 strtol.
+// 读到哪里记在 LexState 里, 查找表只读, 所以几个线程可以同时各扫各的.
+// flex 的扫描器不可重入, 只用来从头分析整个文件
+
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <climits>
+#include <string>
+#include <vector>
+#include "lexer.h"
+#include "sysy.tab.hpp"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+extern FILE *yyin;
+extern void yyrestart(FILE *file);
+
+bool use_hand_lexer = false;
+YYSTYPE yylval;
+
+// 顺便给 parser 算这个 token 的哈希 (sysy.y 的位置类型): 种类加上名字或数值
+int yylex(YYSTYPE *lval, YYLTYPE *lloc, LexState &lex)
+{
+    int token = lex.hand ? hand_lex(lval, lex) : flex_lex();
+    if (!lex.hand)
+        *lval = yylval;
+    uint64_t h = HashMix(0, token);
+    if (token == IDENT || token == RELOP || token == EQOP || token == ANDOP || token == OROP)
+        h = HashMix(h, HashString(*lval->str_val));
+    else if (token == INT_CONST)
+        h = HashMix(h, (uint32_t)lval->int_val);
+    lloc->value = h;
+    return token;
+}
+
+static const int LEX_PAD = 16; // 末尾补 0, SIMD 读 16 字节不会越界
+
+static void hand_lex_pad(LexState &lex)
+{
+    lex.size = lex.buf.size();
+    lex.buf.resize(lex.size + LEX_PAD, 0);
+    lex.pos = 0;
+}
+
+void Lex_Open(LexState &lex, FILE *file)
+{
+    Lex_Close(lex);
+    lex.hand = use_hand_lexer;
+    if (!lex.hand)
+    {
+        // 文件可能已经分析过一遍又 rewind 了 (-bench-lex), 丢掉 flex 缓冲区里剩下的内容
+        yyin = file;
+        yyrestart(file);
+        return;
+    }
+    char chunk[1 << 16];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0)
+        lex.buf.insert(lex.buf.end(), chunk, chunk + n);
+    hand_lex_pad(lex);
+}
+
+void Lex_Open(LexState &lex, const char *data, size_t len)
+{
+    Lex_Close(lex);
+    lex.hand = true;
+    lex.buf.assign(data, data + len);
+    hand_lex_pad(lex);
+}
+
+void Lex_Close(LexState &lex)
+{
+    vector<char>().swap(lex.buf);
+    lex.size = lex.pos = 0;
+}
+
+// ---------------------------------------------------------------- 字符分类
+
+enum
+{
+    CC_SPACE = 1, // [ \t\n\r], 和 sysy.l 的 WhiteSpace 一致
+    CC_IDENT = 2, // [a-zA-Z0-9_]
+    CC_DIGIT = 4,
+};
+
+static unsigned char char_class[256];
+
+static void init_char_class()
+{
+    for (int c = 0; c < 256; ++c)
+    {
+        unsigned char cc = 0;
+        if (c == ' ' || c == '\t' || c == '\n' || c == '\r')
+            cc |= CC_SPACE;
+        if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_')
+            cc |= CC_IDENT;
+        if (c >= '0' && c <= '9')
+            cc |= CC_DIGIT;
+        char_class[c] = cc;
+    }
+}
+
+static inline bool in_class(char c, int cc)
+{
+    return char_class[(unsigned char)c] & cc;
+}
+
+#ifdef __SSE2__
+// 16 个字节里哪些落在 [lo, hi]; 只用于 ASCII, 高位字节按有符号比较不会命中
+static inline __m128i in_range(__m128i x, char lo, char hi)
+{
+    return _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8(lo - 1)), _mm_cmplt_epi8(x, _mm_set1_epi8(hi + 1)));
+}
+
+static inline int space_mask(const char *p)
+{
+    __m128i x = _mm_loadu_si128((const __m128i *)p);
+    __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(x, _mm_set1_epi8('\n'))),
+                             _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('\t')), _mm_cmpeq_epi8(x, _mm_set1_epi8('\r'))));
+    return _mm_movemask_epi8(m);
+}
+
+static inline int ident_mask(const char *p)
+{
+    __m128i x = _mm_loadu_si128((const __m128i *)p);
+    __m128i lower = _mm_or_si128(x, _mm_set1_epi8(0x20)); // 大写字母变小写
+    __m128i m = _mm_or_si128(in_range(lower, 'a', 'z'), in_range(x, '0', '9'));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(x, _mm_set1_epi8('_')));
+    return _mm_movemask_epi8(m);
+}
+
+static inline int char_mask(const char *p, char c)
+{
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)p), _mm_set1_epi8(c)));
+}
+#endif
+
+// 从 pos 开始第一个不是 cc 类的字符. 补的 0 不属于任何一类, 所以一定会停下
+static size_t skip_class(const char *p, size_t pos, int cc)
+{
+#ifdef __SSE2__
+    for (;;)
+    {
+        int mask = cc == CC_SPACE ? space_mask(p + pos) : ident_mask(p + pos);
+        if (mask != 0xFFFF)
+            return pos + __builtin_ctz(~mask);
+        pos += 16;
+    }
+#else
+    while (in_class(p[pos], cc))
+        pos++;
+    return pos;
+#endif
+}
+
+// 从 pos 开始第一个 c 的位置, 没有就是 size
+static size_t find_char(const char *p, size_t size, size_t pos, char c)
+{
+#ifdef __SSE2__
+    while (pos < size)
+    {
+        int mask = char_mask(p + pos, c);
+        if (mask != 0)
+            return min(pos + __builtin_ctz(mask), size);
+        pos += 16;
+    }
+    return size;
+#else
+    while (pos < size && p[pos] != c)
+        pos++;
+    return pos;
+#endif
+}
+
+// ---------------------------------------------------------------- 关键字
+
+// (长度, 首字母, 尾字母) 的哈希对这 9 个关键字没有冲突
+static inline unsigned keyword_hash(const char *s, size_t len)
+{
+    return (len * 2 + (unsigned char)s[0] + (unsigned char)s[len - 1] * 3) & 15;
+}
+
+struct Keyword
+{
+    const char *text;
+    size_t len;
+    int token;
+};
+static Keyword keyword_table[16];
+
+static void init_keywords()
+{
+    static const Keyword keywords[] = {
+        {"int", 3, INT}, {"void", 4, VOID}, {"return", 6, RETURN}, {"const", 5, CONST}, {"if", 2, IF},
+        {"else", 4, ELSE}, {"while", 5, WHILE}, {"break", 5, BREAK}, {"continue", 8, CONTINUE},
+    };
+    for (auto &kw : keywords)
+    {
+        Keyword &slot = keyword_table[keyword_hash(kw.text, kw.len)];
+        if (slot.text != nullptr)
+        {
+            fprintf(stderr, "keyword hash collision: %s %s\n", slot.text, kw.text);
+            abort();
+        }
+        slot = kw;
+    }
+}
+
+// ---------------------------------------------------------------- 整数
+
+static inline int digit_value(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    return (c | 0x20) - 'a' + 10;
+}
+
+// 和 sysy.l 里 strtol(yytext, nullptr, 0) 再截成 int 的结果一样,
+// 包括超过 LONG_MAX 时饱和
+static int parse_int(const char *p, size_t begin, size_t end, int base)
+{
+    unsigned long value = 0;
+    for (size_t i = begin; i < end; ++i)
+    {
+        unsigned long next = value * base + digit_value(p[i]);
+        if (value > (unsigned long)LONG_MAX / base || next > (unsigned long)LONG_MAX)
+            value = LONG_MAX;
+        else
+            value = next;
+    }
+    return (int)(long)value;
+}
+
+// ---------------------------------------------------------------- 主循环
+
+int hand_lex(YYSTYPE *lval, LexState &lex)
+{
+    // 查找表只建一次; 局部静态变量的初始化是线程安全的
+    static const bool tables_ready = (init_char_class(), init_keywords(), true);
+    (void)tables_ready;
+    const char *p = lex.buf.data();
+    size_t pos = lex.pos, lex_size = lex.size;
+    for (;;)
+    {
+        pos = skip_class(p, pos, CC_SPACE);
+        if (pos >= lex_size)
+        {
+            lex.pos = lex_size;
+            return 0;
+        }
+        if (p[pos] == '/' && p[pos + 1] == '/')
+        {
+            pos = find_char(p, lex_size, pos + 2, '\n');
+            continue;
+        }
+        if (p[pos] == '/' && p[pos + 1] == '*')
+        {
+            // 找 "*/"; 没有结束的注释和 flex 一样退回成普通的 '/'
+            size_t star = pos + 2;
+            while ((star = find_char(p, lex_size, star, '*')) < lex_size && p[star + 1] != '/')
+                star++;
+            if (star >= lex_size)
+                break;
+            pos = star + 2;
+            continue;
+        }
+        break;
+    }
+
+    char c = p[pos];
+    if (in_class(c, CC_IDENT) && !in_class(c, CC_DIGIT))
+    {
+        size_t end = skip_class(p, pos + 1, CC_IDENT), len = end - pos;
+        lex.pos = end;
+        if (len >= 2 && len <= 8)
+        {
+            const Keyword &kw = keyword_table[keyword_hash(p + pos, len)];
+            if (kw.len == len && memcmp(kw.text, p + pos, len) == 0)
+                return kw.token;
+        }
+        lval->str_val = new string(p + pos, len);
+        return IDENT;
+    }
+    if (in_class(c, CC_DIGIT))
+    {
+        size_t end = pos + 1;
+        if (c != '0')
+        {
+            while (in_class(p[end], CC_DIGIT))
+                end++;
+            lval->int_val = parse_int(p, pos, end, 10);
+        }
+        else if ((p[pos + 1] | 0x20) == 'x' && isxdigit((unsigned char)p[pos + 2]))
+        {
+            end = pos + 2;
+            while (isxdigit((unsigned char)p[end]))
+                end++;
+            lval->int_val = parse_int(p, pos + 2, end, 16);
+        }
+        else
+        {
+            while (p[end] >= '0' && p[end] <= '7')
+                end++;
+            lval->int_val = parse_int(p, pos, end, 8);
+        }
+        lex.pos = end;
+        return INT_CONST;
+    }
+
+    char d = p[pos + 1];
+    lex.pos = pos + 1;
+    int token = 0;
+    // sysy.l 的 RelOP 是 [<|>][=]?, 字符类里带着 '|'
+    if ((c == '<' || c == '>' || c == '|') && d == '=')
+        token = RELOP;
+    else if ((c == '=' || c == '!') && d == '=')
+        token = EQOP;
+    else if (c == '&' && d == '&')
+        token = ANDOP;
+    else if (c == '|' && d == '|')
+        token = OROP;
+    if (token != 0)
+    {
+        lex.pos = pos + 2;
+        lval->str_val = new string(p + pos, 2);
+        return token;
+    }
+    if (c == '<' || c == '>' || c == '|')
+    {
+        lval->str_val = new string(1, c);
+        return RELOP;
+    }
+    return c;
+}
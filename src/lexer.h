@@ -0,0 +1,34 @@
+#pragma once
+
+// 两个词法分析器产生同样的 token 流: flex 生成的 (sysy.l) 和手写的 (lexer.cpp).
+// parser 调用 yylex, 由 LexState::hand 决定转给哪一个.
+// 手写的可重入, 一次分析的状态全在 LexState 里, -parse-threads 时每个线程各用一个.
+// flex 的扫描器用它自己的全局状态 (yyin, yylval), 同一时间只能分析一个文件
+
+#include <cstddef>
+#include <cstdio>
+#include <vector>
+#include "sysy.tab.hpp"
+
+struct LexState
+{
+    bool hand = false;
+    std::vector<char> buf; // 手写的: 整段输入, 末尾补 0
+    size_t size = 0, pos = 0;
+};
+
+// 新建的 LexState 用哪一个 (-hand-lex)
+extern bool use_hand_lexer;
+
+// 从头分析整个文件, 或者内存里的一段 [data, data + len). 后者总是用手写的, 可以在几个线程里同时用
+void Lex_Open(LexState &lex, FILE *file);
+void Lex_Open(LexState &lex, const char *data, size_t len);
+void Lex_Close(LexState &lex);
+
+int yylex(YYSTYPE *lval, YYLTYPE *lloc, LexState &lex);
+
+// sysy.l 里定义, 从 yyin 读, 值写进 yylval. parser 是纯的, 不提供 yylval, 由 lexer.cpp 定义
+extern YYSTYPE yylval;
+int flex_lex();
+
+int hand_lex(YYSTYPE *lval, LexState &lex);
@@ -1,79 +1,498 @@
 #define _SUB_MODE
 
 #include <cassert>
+#include <chrono>
 #include <cstdio>
 #include <iostream>
 #include <memory>
 #include <sstream>
+#include <set>
 #include <string>
+#include <thread>
 #include "AST.h"
-#include "koopa.h"
-// #include "KIR.h"
+#include "Dataflow.h"
+#include "Incremental.h"
+#include "Interp.h"
+#include "KIR.h"
+#include "lexer.h"
+#include "sysy.tab.hpp"
+#include "PassManager.h"
 #include "RISCV.h"
+#include "RVAsm.h"
 
 
 
 using namespace std;
 
-// 声明 lexer 的输入, 以及 parser 函数
-// 为什么不引用 sysy.tab.h 呢? 因为首先里面没有 yyin 的定义
-// 其次, 因为这个文件不是我们自己写的, 而是被 Bison 生成出来的
-// 你的代码编辑器/IDE 很可能找不到这个文件, 然后会给你报错 (虽然编译不会出错)
-// 看起来会很烦人, 于是干脆采用这种看起来 dirty 但实际很有效的手段
-extern FILE *yyin;
-extern int yyparse(unique_ptr<BaseAST> &ast);
+// -bench-lex: 两个词法分析器各把输入扫几遍, 取最快的一遍报告 token/s
+static void BenchLexers(FILE *input)
+{
+    bool old_hand = use_hand_lexer;
+    for (int hand = 0; hand < 2; ++hand)
+    {
+        use_hand_lexer = hand;
+        double best = 1e30;
+        long tokens = 0;
+        for (int round = 0; round < 5; ++round)
+        {
+            rewind(input);
+            tokens = 0;
+            auto start = chrono::steady_clock::now();
+            LexState lex;
+            Lex_Open(lex, input);
+            YYSTYPE lval;
+            YYLTYPE lloc;
+            int token;
+            while ((token = yylex(&lval, &lloc, lex)) != 0)
+            {
+                if (token == IDENT || token == RELOP || token == EQOP || token == ANDOP || token == OROP)
+                    delete lval.str_val;
+                tokens++;
+            }
+            Lex_Close(lex);
+            best = min(best, chrono::duration<double>(chrono::steady_clock::now() - start).count());
+        }
+        fprintf(stderr, "%-5s %10ld tokens %10.3f ms %12.0f tokens/s\n", hand ? "hand" : "flex", tokens, best * 1000,
+                tokens / best);
+    }
+    use_hand_lexer = old_hand;
+}
+
+// 顶层各项 (函数定义和全局声明) 的结束位置. 只数花括号和跳过注释, 不做词法分析:
+// 深度 0 的 ';' 结束一个声明; 回到深度 0 的 '}' 如果对应的 '{' 紧跟在 ')' 后面, 就结束一个函数
+static vector<size_t> ScanTopLevel(const string &src)
+{
+    vector<size_t> ends;
+    int depth = 0;
+    bool body = false; // 深度 0 的 '{' 是不是函数体
+    char last = 0;     // 上一个不是空白和注释的字符
+    for (size_t i = 0; i < src.size(); ++i)
+    {
+        char c = src[i];
+        if (c == '/' && i + 1 < src.size() && (src[i + 1] == '/' || src[i + 1] == '*'))
+        {
+            size_t end = src[i + 1] == '/' ? src.find('\n', i + 2) : src.find("*/", i + 2);
+            if (end == string::npos)
+                break; // 剩下的都归最后一段, 有错也由 parser 报
+            i = src[i + 1] == '/' ? end : end + 1;
+            continue;
+        }
+        if (c == ' ' || c == '\t' || c == '\n' || c == '\r')
+            continue;
+        if (c == '{' && depth++ == 0)
+            body = last == ')';
+        else if (c == '}' && depth > 0 && --depth == 0 && body)
+            ends.push_back(i + 1);
+        else if (c == ';' && depth == 0)
+            ends.push_back(i + 1);
+        last = c;
+    }
+    return ends;
+}
+
+// -parse-threads=N: 输入在顶层项之间切成至多 N 段, 每段在自己的线程里用自己的 lexer 和 parser
+// 分析成一个 CompUnit, 再按原来的顺序拼成一个. flex 的扫描器不可重入, 各段总是用手写的 lexer,
+// 两者的 token 流一样. 函数的 fingerprint 只看它自己的 token,
+// 所以结果和整个文件一起分析的一样
+static unique_ptr<BaseAST> ParseParallel(FILE *input, int threads)
+{
+    string src;
+    char chunk[1 << 16];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), input)) > 0)
+        src.append(chunk, n);
+
+    // 最后一项之后不切, 免得最后一段只剩空白
+    vector<size_t> ends = ScanTopLevel(src);
+    if (!ends.empty())
+        ends.pop_back();
+    vector<pair<size_t, size_t> > ranges;
+    size_t begin = 0, target = src.size() / threads + 1;
+    for (size_t end : ends)
+        if (end - begin >= target && (int)ranges.size() < threads - 1)
+        {
+            ranges.push_back({begin, end});
+            begin = end;
+        }
+    ranges.push_back({begin, src.size()});
+
+    vector<unique_ptr<BaseAST> > parts(ranges.size());
+    vector<int> rets(ranges.size());
+    vector<thread> workers;
+    for (size_t i = 0; i < ranges.size(); ++i)
+        workers.emplace_back([&, i]() {
+            LexState lex;
+            Lex_Open(lex, src.data() + ranges[i].first, ranges[i].second - ranges[i].first);
+            FuncDefSink no_sink;
+            rets[i] = yyparse(parts[i], no_sink, lex);
+            Lex_Close(lex);
+        });
+    for (auto &worker : workers)
+        worker.join();
+
+    auto comp_unit = make_unique<CompUnitAST>();
+    for (size_t i = 0; i < ranges.size(); ++i)
+    {
+        assert(!rets[i]);
+        for (auto &item : ((CompUnitAST *)(parts[i].get()))->item_list)
+            comp_unit->item_list.push_back(move(item));
+    }
+    return comp_unit;
+}
+
+// 循环深度和 profile 里的执行次数交给后端, 用来给溢出加权
+static void SetBlockWeights(const KProgram &kir_program)
+{
+    for (auto &func : kir_program.funcs)
+    {
+        KLoopNest nest = KIR_LoopNest(func);
+        for (size_t i = 0; i < func.bbs.size(); ++i)
+        {
+            block_loop_depth[func.name + " " + func.bbs[i].name] = nest.Depth(i);
+            if (opt_profile.Count(func, i) >= 0)
+                block_count[func.name + " " + func.bbs[i].name] = opt_profile.Count(func, i);
+        }
+    }
+}
+
+// -sched-report: 静态估计, 每条指令只算一次, 不乘执行次数
+static void ReportSchedule()
+{
+    fprintf(stderr, "scheduler: estimated stall cycles %ld -> %ld (saved %ld)\n", sched_stalls_before,
+            sched_stalls_after, sched_stalls_before - sched_stalls_after);
+}
+
+// -bench-dataflow: 生成代码前先对每个函数跑一遍 Dataflow.h 的分析, 报告写到 stderr
+static bool bench_dataflow = false;
+
+// 优化后的 KIR -> RISC-V, 写到 stdout. 后端直接读 KIR, Koopa 文本只有 -koopa 才生成
+static void EmitRISCV(const KProgram &kir_program)
+{
+    if (bench_dataflow)
+        for (auto &func : kir_program.funcs)
+            DF_Bench(func);
+    RISC_Visit(kir_program);
+}
+
+// -obj: 汇编文本先收进字符串, 再交给内置汇编器追加进 obj
+static void EmitObject(const KProgram &kir_program, RVObject &obj, bool verify_obj)
+{
+    stringstream asm_ss;
+    streambuf *old_buf = cout.rdbuf(asm_ss.rdbuf());
+    EmitRISCV(kir_program);
+    cout.rdbuf(old_buf);
+    RVAsm_Assemble(obj, asm_ss.str(), verify_obj);
+}
+
+// 流式模式里编译一个函数: -koopa 时是 IR, 否则是汇编, 连同它依赖的签名一起交给增量编译存下
+static IncEntry CompileFunction(const FuncDefAST *func_def, const string &mode, const PassOptions &pass_opts,
+                                const map<string, string> &signatures)
+{
+    IncEntry entry;
+    KProgram kir_program;
+    ir_global_refs.clear();
+    kir_program.funcs.push_back(DumpIR(func_def));
+    // 局部常量数组和数组初值模板, 跟着函数一起输出
+    kir_program.globals = move(ir_globals);
+    ir_globals.clear();
+    // 生成 IR 时查过的是所有被调用的函数和用到的全局符号 (优化可能删掉一些调用, 所以在 PM_Run 之前收集)
+    const KFunc &func = kir_program.funcs[0];
+    set<string> callees;
+    for (auto &bb : func.bbs)
+        for (auto &inst : bb.insts)
+            if (inst.kind == KI_CALL && inst.callee != func.name && callees.insert(inst.callee).second)
+            {
+                auto it = signatures.find(inst.callee);
+                entry.deps.push_back({inst.callee, it == signatures.end() ? string() : it->second});
+            }
+    for (auto &name : ir_global_refs)
+    {
+        auto it = signatures.find(name);
+        entry.deps.push_back({name, it == signatures.end() ? string() : it->second});
+    }
+    entry.signature = KIR_Signature(func);
+
+    PM_Run(kir_program, pass_opts);
+    block_loop_depth.clear();
+    block_count.clear();
+    SetBlockWeights(kir_program);
+    if (mode == "-koopa")
+    {
+        stringstream opt_ss;
+        for (auto &global : kir_program.globals)
+            KIR_Dump(global, opt_ss);
+        if (!kir_program.globals.empty())
+            opt_ss << "\n";
+        for (auto &func : kir_program.funcs)
+        {
+            KIR_Dump(func, opt_ss);
+            opt_ss << "\n";
+        }
+        entry.ir = opt_ss.str();
+        return entry;
+    }
+
+    // 前面输出过的函数和全局变量只按名字引用, 后端不需要它们的声明
+    long stalls_before = sched_stalls_before, stalls_after = sched_stalls_after;
+    stringstream asm_ss;
+    streambuf *old_buf = cout.rdbuf(asm_ss.rdbuf());
+    EmitRISCV(kir_program);
+    cout.rdbuf(old_buf);
+    entry.has_asm = true;
+    entry.asm_text = asm_ss.str();
+    entry.stalls_before = sched_stalls_before - stalls_before;
+    entry.stalls_after = sched_stalls_after - stalls_after;
+    return entry;
+}
+
+// 流式模式里的全局声明: 马上输出它定义的全局变量, 记下签名. 很便宜, 不进增量编译的缓存
+static void CompileGlobalDecl(const DeclAST *decl, const string &mode, RVObject &obj, bool verify_obj,
+                              map<string, string> &signatures)
+{
+    DumpIR(decl);
+    KProgram kir_program;
+    kir_program.globals = move(ir_globals);
+    ir_globals.clear();
+    for (auto &sig : ir_global_sigs)
+        signatures[sig.first] = sig.second;
+    ir_global_sigs.clear();
+    if (kir_program.globals.empty())
+        return; // 只有常量标量
+    if (mode == "-koopa")
+        KIR_Dump(kir_program, cout);
+    else if (mode == "-obj")
+        EmitObject(kir_program, obj, verify_obj);
+    else
+        EmitRISCV(kir_program);
+}
+
+// 流式模式: 每个函数一归约出来就生成 IR, 优化, 输出, 然后释放, 峰值内存只和
+// 最大的那个函数有关. 看不到整个程序, 所以内联之类的整程序 pass 没有东西可做
+static void CompileStreaming(FILE *input, const string &mode, const PassOptions &pass_opts, bool verify_obj)
+{
+    RVObject obj;
+    vector<string> lib_decls = DumpLibDecls();
+    if (mode == "-koopa")
+    {
+        for (auto &decl : lib_decls)
+            cout << decl << "\n";
+        cout << "\n";
+    }
+    // 已经输出过的函数和全局变量的声明, 后面的函数用到它们时要用; 增量编译靠它判断依赖变没变
+    map<string, string> signatures;
+    symbol_tables.push_back(map<string, Symbol>()); // 全局作用域
+
+    FuncDefSink on_func_def = [&](unique_ptr<BaseAST> func_def_ast) {
+        if (auto decl = dynamic_cast<DeclAST *>(func_def_ast.get()))
+        {
+            CompileGlobalDecl(decl, mode, obj, verify_obj, signatures);
+            return;
+        }
+        auto func_def = (FuncDefAST *)(func_def_ast.get());
+        IncEntry entry;
+        bool reuse = !inc_dir.empty() && Inc_Load(func_def->fingerprint, entry) &&
+                     Inc_DepsMatch(entry, signatures) && (mode == "-koopa" || entry.has_asm);
+        if (reuse)
+        {
+            // 没有重新生成 IR, 返回类型得自己登记, 后面的函数调用它时要查
+            func_ret_int[func_def->ident] = ((FuncTypeAST *)(func_def->func_type.get()))->functype == "int";
+            sched_stalls_before += entry.stalls_before;
+            sched_stalls_after += entry.stalls_after;
+            inc_reused++;
+        }
+        else
+            entry = CompileFunction(func_def, mode, pass_opts, signatures);
+        if (!inc_dir.empty() && !reuse)
+        {
+            Inc_Store(func_def->fingerprint, entry);
+            inc_compiled++;
+        }
+        string name = "@" + func_def->ident;
+        func_def_ast.reset();
+
+        if (mode == "-koopa")
+            cout << entry.ir;
+        else if (mode == "-obj")
+            RVAsm_Assemble(obj, entry.asm_text, verify_obj);
+        else
+            cout << entry.asm_text;
+        signatures[name] = entry.signature;
+    };
+    unique_ptr<BaseAST> ast;
+    LexState lex;
+    Lex_Open(lex, input);
+    auto ret = yyparse(ast, on_func_def, lex);
+    assert(!ret);
+    Lex_Close(lex);
+    if (mode == "-obj")
+        RVAsm_WriteELF(obj, cout);
+}
 
 
 
 int main(int argc, const char *argv[]) {
   // 解析命令行参数. 测试脚本/评测平台要求你的编译器能接收如下参数:
-  // compiler 模式 输入文件 -o 输出文件
-  assert(argc == 5);
+  // compiler 模式 输入文件 -o 输出文件 [-O0|-O1|-O2] [-f<pass>|-fno-<pass>] [-time-passes] [-verify-ir] [-stream] [-hand-lex] [-bench-lex] [-verify-obj]
+  //   [-fprofile-generate] [-fprofile-use=文件] [-fsched|-fno-sched] [-sched-latency=op:周期,...] [-sched-report]
+  //   [-bench-dataflow] [-incremental=目录] [-incremental-report] [-parse-threads=N]
+  // -incremental 按函数缓存 IR 和汇编, 没改的函数直接复用; 它按流式模式一个函数一个函数地编译,
+  // 输出和不带 -incremental 的 -stream 逐字节相同
+  // -parse-threads=N 把输入按顶层的函数和声明切开, 用 N 个线程同时做词法和语法分析 (用手写的 lexer)
+  // -fprofile-generate 的输出用 rvsim 跑一遍得到块的执行次数, 再用 -fprofile-use 重新编译
+  // 模式是 -koopa, -riscv, -obj (内置汇编器直接输出 ELF 目标文件)
+  // 或者 -run (直接解释执行 KIR, 程序输出写到输出文件, 返回值和指令统计写到 stderr)
+  assert(argc >= 5);
   auto mode = argv[1];
   auto input = argv[2];
-  auto output = argv[4];
+  const char *output = nullptr;
+  bool stream = false, bench_lex = false, verify_obj = false, sched_report = false, inc_report = false;
+  int parse_threads = 1;
+  int sched = -1; // -fsched / -fno-sched, 不指定时显式给了 -O1 或 -O2 才开启
+  PassOptions pass_opts;
+  for (int i = 3; i < argc; ++i)
+  {
+      string arg = argv[i];
+      if (arg == "-o" && i + 1 < argc)
+          output = argv[++i];
+      else if (arg == "-stream")
+          stream = true;
+      else if (arg == "-hand-lex")
+          use_hand_lexer = true;
+      else if (arg == "-bench-lex")
+          bench_lex = true;
+      else if (arg == "-verify-obj")
+          verify_obj = true;
+      else if (arg == "-fprofile-generate")
+          profile_generate = true;
+      else if (arg == "-fsched" || arg == "-fno-sched")
+          sched = arg == "-fsched";
+      else if (arg == "-sched-report")
+          sched_report = true;
+      else if (arg == "-bench-dataflow")
+          bench_dataflow = true;
+      else if (arg.compare(0, 13, "-incremental=") == 0)
+      {
+          if (!Inc_Open(arg.substr(13)))
+          {
+              cerr << "cannot use incremental store: " << arg.substr(13) << endl;
+              return 1;
+          }
+          stream = true;
+      }
+      else if (arg == "-incremental-report")
+          inc_report = true;
+      else if (arg.compare(0, 15, "-parse-threads=") == 0)
+      {
+          parse_threads = atoi(arg.c_str() + 15);
+          if (parse_threads < 1)
+          {
+              cerr << "bad thread count: " << arg.substr(15) << endl;
+              return 1;
+          }
+      }
+      else if (arg.compare(0, 15, "-sched-latency=") == 0)
+      {
+          if (!RVSched_ParseLatency(arg.substr(15)))
+          {
+              cerr << "bad latency table: " << arg.substr(15) << endl;
+              return 1;
+          }
+      }
+      else if (!PM_ParseOption(pass_opts, arg))
+      {
+          cerr << "unknown option: " << arg << endl;
+          return 1;
+      }
+  }
+  assert(output);
+  sched_enabled = sched == -1 ? pass_opts.opt_level >= 1 : sched;
+  if (!inc_dir.empty())
+      Inc_SetOptions(argc, argv);
 
-  // 打开输入文件, 并且指定 lexer 在解析的时候读取这个文件
-  yyin = fopen(input, "r");
+  // 打开输入文件, lexer 在解析的时候读取这个文件
+  FILE *input_file = fopen(input, "r");
   #ifdef  _SUB_MODE
   freopen(output, "w", stdout); 
   #endif
-  assert(yyin);
+  assert(input_file);
 
   // 调用 parser 函数, parser 函数会进一步调用 lexer 解析输入文件的
 //   unique_ptr<string> ast;
 //   auto ret = yyparse(ast);
 //   assert(!ret);
 
+    if (bench_lex)
+    {
+        BenchLexers(input_file);
+        return 0;
+    }
+    if (stream && string(mode) == "-run")
+    {
+        cerr << "-run cannot be combined with -stream or -incremental" << endl;
+        return 1;
+    }
+    if (stream && parse_threads > 1)
+    {
+        cerr << "-parse-threads cannot be combined with -stream or -incremental" << endl;
+        return 1;
+    }
+    if (stream)
+    {
+        CompileStreaming(input_file, mode, pass_opts, verify_obj);
+        if (sched_report)
+            ReportSchedule();
+        if (inc_report)
+            fprintf(stderr, "incremental: %ld functions reused, %ld recompiled\n", inc_reused, inc_compiled);
+        return 0;
+    }
+
+    auto parse_start = chrono::steady_clock::now();
     unique_ptr<BaseAST> ast;
-    auto ret = yyparse(ast);
-    assert(!ret);
+    if (parse_threads > 1)
+        ast = ParseParallel(input_file, parse_threads);
+    else
+    {
+        LexState lex;
+        Lex_Open(lex, input_file);
+        FuncDefSink no_sink;
+        auto ret = yyparse(ast, no_sink, lex);
+        assert(!ret);
+        Lex_Close(lex);
+    }
+    if (pass_opts.time_passes)
+        fprintf(stderr, "parse: %.3f ms (%d threads)\n",
+                chrono::duration<double>(chrono::steady_clock::now() - parse_start).count() * 1000, parse_threads);
+
+    // AST 直接生成 KIR, 优化之后再输出成文本
+    KProgram kir_program = DumpIR((CompUnitAST*)(ast.get()));
+    ast.reset();
+    PM_Run(kir_program, pass_opts);
+    if (string(mode) == "-run")
+    {
+        InterpProgram program = Interp_Decode(kir_program);
+        InterpResult result = Interp_Run(program);
+        fflush(stdout);
+        Interp_Report(result, cerr);
+        return result.exit_value & 0xff;
+    }
+    SetBlockWeights(kir_program);
 
-    // dump AST, save KoopaIR into irstr
     if (string(mode) == "-koopa")
     {//输出为koopa模式
-         DumpIR((CompUnitAST*)(ast.get()));
+        KIR_Dump(kir_program, cout);
     }
     else if(string(mode) == "-riscv")
     {
-        //改变输出流到缓冲区，再存到字符串里
-        stringstream ss;
-        streambuf* cout_buf = cout.rdbuf();
-        cout.rdbuf(ss.rdbuf());
-        DumpIR((CompUnitAST*)(ast.get()));
-        string ir_str = ss.str();
-        const char *ir = ir_str.data();
-        cout.rdbuf(cout_buf);
-
-        koopa_program_t program;
-        koopa_error_code_t ret = koopa_parse_from_string(ir, &program);
-        assert(ret == KOOPA_EC_SUCCESS);  // 确保解析时没有出错
-        koopa_raw_program_builder_t builder = koopa_new_raw_program_builder();
-        koopa_raw_program_t raw = koopa_build_raw_program(builder, program);
-        koopa_delete_program(program);
         freopen(output, "w", stdout);
-        RISC_Visit(raw);
-        koopa_delete_raw_program_builder(builder);
+        EmitRISCV(kir_program);
+    }
+    else if (string(mode) == "-obj")
+    {
+        RVObject obj;
+        EmitObject(kir_program, obj, verify_obj);
+        RVAsm_WriteELF(obj, cout);
     }
+    if (sched_report)
+        ReportSchedule();
   return 0;
 }
\ No newline at end of file
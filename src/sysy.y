@@ -2,6 +2,7 @@
   #include <memory>
   #include <string>
     #include "AST.h"
+  struct LexState;
 }
 
 %{
@@ -12,63 +13,150 @@
 #include <vector>
 #include "AST.h"
 
-// 声明 lexer 函数和错误处理函数
-int yylex();
-void yyerror(std::unique_ptr<BaseAST> &ast, const char *s);
-
 using namespace std;
 
+// 一段的哈希 = 右部各符号的哈希依次混合, 空产生式是个常数
+#define YYLLOC_DEFAULT(Current, Rhs, N)                                  \
+  do {                                                                  \
+    uint64_t h = 0x5bd1e995;                                            \
+    for (int i = 1; i <= (N); ++i)                                      \
+      h = HashMix(h, YYRHSLOC(Rhs, i).value);                           \
+    (Current).value = h;                                                \
+  } while (0)
+
 %}
 
+// 位置只用来给 token 流算哈希, 见 AST.h 的 TokenHash
+%define api.location.type {TokenHash}
+%locations
+
+// 可重入: 没有全局状态, lexer 的状态在 LexState 里, 几个线程可以同时各分析一段 (-parse-threads)
+%define api.pure full
+
 %parse-param { std::unique_ptr<BaseAST> &ast }
+// 非空时每个函数和全局声明一归约就交出去 (流式模式), CompUnit 里不留它们
+%parse-param { FuncDefSink &on_func_def }
+%param { LexState &lex }
 
 %union {
   std::string *str_val;
   int int_val;
   BaseAST *ast_val;
+  ExpAST *exp_val;
   std::vector<std::unique_ptr<BaseAST> > *vec_val;
 }
 
+%code {
+// 声明 lexer 函数和错误处理函数
+int yylex(YYSTYPE *lval, YYLTYPE *lloc, LexState &lex);
+void yyerror(YYLTYPE *lloc, unique_ptr<BaseAST> &ast, FuncDefSink &on_func_def, LexState &lex, const char *s);
+}
+
 // lexer 返回的所有 token 种类的声明
 // 注意 IDENT 和 INT_CONST 会返回 token 的值, 分别对应 str_val 和 int_val
-%token INT RETURN CONST IF ELSE WHILE BREAK CONTINUE
+%token INT VOID RETURN CONST IF ELSE WHILE BREAK CONTINUE
 %token <str_val> IDENT
 %token <int_val> INT_CONST
 %token <str_val> RELOP EQOP ANDOP OROP
 
 // 非终结符的类型定义
-%type <ast_val> FuncDef FuncType Block Stmt Exp PrimaryExp UnaryExp AddExp MulExp
-%type <ast_val> RelExp EqExp LAndExp LOrExp Decl ConstDecl ConstDef ConstInitVal BlockItem ConstExp
-%type <ast_val> VarDecl VarDef InitVal OpenStmt ClosedStmt SimpleStmt
-%type <vec_val> BlockItem_List ConstDef_List VarDef_List
+%type <ast_val> CompUnitItem FuncDef FuncHead Block Stmt Decl ConstDecl ConstDef ConstInitVal BlockItem ConstExp
+%type <exp_val> Exp PrimaryExp UnaryExp LVal
+%type <ast_val> VarDecl VarDef InitVal OpenStmt ClosedStmt SimpleStmt FuncFParam
+%type <vec_val> BlockItem_List ConstDef_List VarDef_List CompUnitItem_List FuncFParams FuncRParams
+%type <vec_val> ArrayDims InitVal_List ConstInitVal_List
 %type <int_val> Number
-%type <str_val> UnaryOp BType LVal
+%type <str_val> BType
+
+// 二元运算符的优先级和结合性, 从低到高. bison 按它们解决 Exp 规则里的冲突,
+// 所以一个二元表达式只归约出一个 BinaryExpAST, 中间没有逐级包装的结点
+%left OROP
+%left ANDOP
+%left EQOP
+%left RELOP
+%left '+' '-'
+%left '*' '/' '%'
 
 %%
 
 CompUnit
-  : FuncDef {
+  : CompUnitItem_List {
     auto comp_unit = make_unique<CompUnitAST>();
-    comp_unit->func_def = unique_ptr<BaseAST>($1);
+    vector<unique_ptr<BaseAST> > *v_ptr = ($1);
+    for (auto iter = v_ptr->begin(); iter != v_ptr->end(); iter++)
+      comp_unit->item_list.push_back(move(*iter));
     ast = move(comp_unit);
   }
   ;
 
+CompUnitItem
+  : FuncDef {
+    $$ = ($1);
+  }
+  | Decl {
+    $$ = ($1);
+  }
+  ;
+
 FuncDef
-  : FuncType IDENT '(' ')' Block {
+  : FuncHead ')' Block {
+    auto func_def = (FuncDefAST *)($1);
+    func_def->block = unique_ptr<BaseAST>($3);
+    func_def->fingerprint = @$.value;
+    $$ = func_def;
+  }
+  | FuncHead FuncFParams ')' Block {
+    auto func_def = (FuncDefAST *)($1);
+    vector<unique_ptr<BaseAST> > *v_ptr = ($2);
+    for (auto iter = v_ptr->begin(); iter != v_ptr->end(); iter++)
+      func_def->func_f_param_list.push_back(move(*iter));
+    func_def->block = unique_ptr<BaseAST>($4);
+    func_def->fingerprint = @$.value;
+    $$ = func_def;
+  }
+  ;
+
+// 返回类型写成 BType 而不是单独的 FuncType, 这样 "int x" 后面是 '(' 还是别的再区分函数和全局变量
+FuncHead
+  : BType IDENT '(' {
+    auto func_type = new FuncTypeAST();
+    func_type->functype = *unique_ptr<string>($1);
+    auto func_def = new FuncDefAST();
+    func_def->func_type = unique_ptr<BaseAST>(func_type);
+    func_def->ident = *unique_ptr<string>($2);
+    $$ = func_def;
+  }
+  | VOID IDENT '(' {
+    auto func_type = new FuncTypeAST();
+    func_type->functype = "void";
     auto func_def = new FuncDefAST();
-    func_def->func_type = unique_ptr<BaseAST>($1);
+    func_def->func_type = unique_ptr<BaseAST>(func_type);
     func_def->ident = *unique_ptr<string>($2);
-    func_def->block = unique_ptr<BaseAST>($5);
     $$ = func_def;
   }
   ;
 
-FuncType
-  : INT {
-    auto func_type = new FuncTypeAST();
-    func_type->functype = "int";
-    $$ = func_type;
+FuncFParam
+  : BType IDENT {
+    auto func_f_param = new FuncFParamAST();
+    func_f_param->b_type = *unique_ptr<string>($1);
+    func_f_param->ident = *unique_ptr<string>($2);
+    $$ = func_f_param;
+  }
+  | BType IDENT '[' ']' {
+    auto func_f_param = new FuncFParamAST();
+    func_f_param->b_type = *unique_ptr<string>($1);
+    func_f_param->ident = *unique_ptr<string>($2);
+    func_f_param->is_array = true;
+    $$ = func_f_param;
+  }
+  | BType IDENT '[' ']' ArrayDims {
+    auto func_f_param = new FuncFParamAST();
+    func_f_param->b_type = *unique_ptr<string>($1);
+    func_f_param->ident = *unique_ptr<string>($2);
+    func_f_param->is_array = true;
+    func_f_param->dims = move(*unique_ptr<vector<unique_ptr<BaseAST> > >($5));
+    $$ = func_f_param;
   }
   ;
 
@@ -108,6 +196,13 @@ ClosedStmt
     stmt->else_stmt = unique_ptr<BaseAST>($7);
     $$ = stmt;
   }
+  | WHILE '(' Exp ')' ClosedStmt {
+    auto stmt = new StmtAST();
+    stmt->type = "while";
+    stmt->exp_simple = unique_ptr<BaseAST>($3);
+    stmt->while_stmt = unique_ptr<BaseAST>($5);
+    $$ = stmt;
+  }
   ;
 
 OpenStmt
@@ -126,6 +221,13 @@ OpenStmt
     stmt->else_stmt = unique_ptr<BaseAST>($7);
     $$ = stmt;
   }
+  | WHILE '(' Exp ')' OpenStmt {
+    auto stmt = new StmtAST();
+    stmt->type = "while";
+    stmt->exp_simple = unique_ptr<BaseAST>($3);
+    stmt->while_stmt = unique_ptr<BaseAST>($5);
+    $$ = stmt;
+  }
   ;
 
 SimpleStmt
@@ -144,7 +246,7 @@ SimpleStmt
   | LVal '=' Exp ';' {
     auto stmt = new SimpleStmtAST();
     stmt->type = "lval";
-    stmt->l_val = *unique_ptr<string>($1);
+    stmt->l_val = unique_ptr<BaseAST>($1);
     stmt->block_exp = unique_ptr<BaseAST>($3);
     $$ = stmt;
   }
@@ -166,34 +268,68 @@ SimpleStmt
     stmt->block_exp = nullptr;
     $$ = stmt;
   }
+  | BREAK ';' {
+    auto stmt = new SimpleStmtAST();
+    stmt->type = "break";
+    stmt->block_exp = nullptr;
+    $$ = stmt;
+  }
+  | CONTINUE ';' {
+    auto stmt = new SimpleStmtAST();
+    stmt->type = "continue";
+    stmt->block_exp = nullptr;
+    $$ = stmt;
+  }
   ;
 
 Exp
-  : LOrExp {
-    auto exp = new ExpAST();
-    exp->lor_exp = unique_ptr<BaseAST>($1);
-    $$ = exp;
+  : UnaryExp {
+    $$ = ($1);
+  }
+  | Exp '*' Exp {
+    $$ = NewBinaryExp(EXP_MUL, $1, $3);
+  }
+  | Exp '/' Exp {
+    $$ = NewBinaryExp(EXP_DIV, $1, $3);
+  }
+  | Exp '%' Exp {
+    $$ = NewBinaryExp(EXP_MOD, $1, $3);
+  }
+  | Exp '+' Exp {
+    $$ = NewBinaryExp(EXP_ADD, $1, $3);
+  }
+  | Exp '-' Exp {
+    $$ = NewBinaryExp(EXP_SUB, $1, $3);
+  }
+  | Exp RELOP Exp {
+    $$ = NewBinaryExp(ExpOpFromString(*unique_ptr<string>($2)), $1, $3);
+  }
+  | Exp EQOP Exp {
+    $$ = NewBinaryExp(ExpOpFromString(*unique_ptr<string>($2)), $1, $3);
+  }
+  | Exp ANDOP Exp {
+    delete $2;
+    $$ = NewBinaryExp(EXP_AND, $1, $3);
+  }
+  | Exp OROP Exp {
+    delete $2;
+    $$ = NewBinaryExp(EXP_OR, $1, $3);
   }
   ;
 
+// 括号里的表达式直接往上交, 不包一层
 PrimaryExp
   : '(' Exp ')' {
-    auto primary_exp = new PrimaryExpAST();
-    primary_exp->type = "exp";
-    primary_exp->exp = unique_ptr<BaseAST>($2);
-    $$ = primary_exp;
+    $$ = ($2);
   }
   | Number {
-    auto primary_exp = new PrimaryExpAST();
-    primary_exp->type = "number";
-    primary_exp->number = ($1);
-    $$ = primary_exp;
+    auto number = new NumberAST();
+    number->op = EXP_NUMBER;
+    number->number = ($1);
+    $$ = number;
   }
   | LVal {
-    auto primary_exp = new PrimaryExpAST();
-    primary_exp->type = "lval";
-    primary_exp->l_val = *unique_ptr<string>($1);
-    $$ = primary_exp;
+    $$ = ($1);
   }
   ;
 
@@ -205,149 +341,37 @@ Number
 
 UnaryExp
   : PrimaryExp {
+    $$ = ($1);
+  }
+  | '+' UnaryExp {
+    $$ = ($2);
+  }
+  | '-' UnaryExp {
     auto unary_exp = new UnaryExpAST();
-    unary_exp->type = "primary";
-    unary_exp->exp = unique_ptr<BaseAST>($1);
+    unary_exp->op = EXP_NEG;
+    unary_exp->exp = unique_ptr<ExpAST>($2);
     $$ = unary_exp;
   }
-  | UnaryOp UnaryExp {
+  | '!' UnaryExp {
     auto unary_exp = new UnaryExpAST();
-    unary_exp->type = "unary";
-    unary_exp->op = *unique_ptr<string>($1);
-    unary_exp->exp = unique_ptr<BaseAST>($2);
+    unary_exp->op = EXP_NOT;
+    unary_exp->exp = unique_ptr<ExpAST>($2);
     $$ = unary_exp;
   }
-  ;
-
-UnaryOp
-  : '+' {
-    string *op = new string("+");
-    $$ = op;
-  }
-  | '-' {
-    string *op = new string("-");
-    $$ = op;
+  | IDENT '(' ')' {
+    auto call_exp = new CallExpAST();
+    call_exp->op = EXP_CALL;
+    call_exp->ident = *unique_ptr<string>($1);
+    $$ = call_exp;
   }
-  | '!' {
-    string *op = new string("!");
-    $$ = op;
-  }
-  ;
-
-MulExp
-  : UnaryExp {
-    auto mul_exp = new MulExpAST();
-    mul_exp->op = "";
-    mul_exp->unary_exp = unique_ptr<BaseAST>($1);
-    $$ = mul_exp;
-  }
-  | MulExp '*' UnaryExp {
-    auto mul_exp = new MulExpAST();
-    mul_exp->mul_exp = unique_ptr<BaseAST>($1);
-    mul_exp->op = "*";
-    mul_exp->unary_exp = unique_ptr<BaseAST>($3);
-    $$ = mul_exp;
-  }
-  | MulExp '/' UnaryExp {
-    auto mul_exp = new MulExpAST();
-    mul_exp->mul_exp = unique_ptr<BaseAST>($1);
-    mul_exp->op = "/";
-    mul_exp->unary_exp = unique_ptr<BaseAST>($3);
-    $$ = mul_exp;
-  }
-  | MulExp '%' UnaryExp {
-    auto mul_exp = new MulExpAST();
-    mul_exp->mul_exp = unique_ptr<BaseAST>($1);
-    mul_exp->op = "%";
-    mul_exp->unary_exp = unique_ptr<BaseAST>($3);
-    $$ = mul_exp;
-  }
-  ;
-
-AddExp
-  : MulExp {
-    auto add_exp = new AddExpAST();
-    add_exp->op = "";
-    add_exp->mul_exp = unique_ptr<BaseAST>($1);
-    $$ = add_exp;
-  }
-  | AddExp '+' MulExp {
-    auto add_exp = new AddExpAST();
-    add_exp->op = "+";
-    add_exp->add_exp = unique_ptr<BaseAST>($1);
-    add_exp->mul_exp = unique_ptr<BaseAST>($3);
-    $$ = add_exp;
-  }
-  | AddExp '-' MulExp {
-    auto add_exp = new AddExpAST();
-    add_exp->op = "-";
-    add_exp->add_exp = unique_ptr<BaseAST>($1);
-    add_exp->mul_exp = unique_ptr<BaseAST>($3);
-    $$ = add_exp;
-  }
-  ;
-
-RelExp
-  : AddExp {
-    auto rel_exp = new RelExpAST();
-    rel_exp->op = "";
-    rel_exp->add_exp = unique_ptr<BaseAST>($1);
-    $$ = rel_exp;
-  }
-  | RelExp RELOP AddExp {
-    auto rel_exp = new RelExpAST();
-    rel_exp->rel_exp = unique_ptr<BaseAST>($1);
-    rel_exp->op = *unique_ptr<string>($2);
-    rel_exp->add_exp = unique_ptr<BaseAST>($3);
-    $$ = rel_exp;
-  }
-  ;
-
-EqExp
-  : RelExp {
-    auto eq_exp = new EqExpAST();
-    eq_exp->op = "";
-    eq_exp->rel_exp = unique_ptr<BaseAST>($1);
-    $$ = eq_exp;
-  }
-  | EqExp EQOP RelExp {
-    auto eq_exp = new EqExpAST();
-    eq_exp->eq_exp = unique_ptr<BaseAST>($1);
-    eq_exp->op = *unique_ptr<string>($2);
-    eq_exp->rel_exp = unique_ptr<BaseAST>($3);
-    $$ = eq_exp;
-  }
-  ;
-
-LAndExp
-  : EqExp {
-    auto land_exp = new LAndExpAST();
-    land_exp->op = "";
-    land_exp->eq_exp = unique_ptr<BaseAST>($1);
-    $$ = land_exp;
-  }
-  | LAndExp ANDOP EqExp {
-    auto land_exp = new LAndExpAST();
-    land_exp->land_exp = unique_ptr<BaseAST>($1);
-    land_exp->op = *unique_ptr<string>($2);
-    land_exp->eq_exp = unique_ptr<BaseAST>($3);
-    $$ = land_exp;
-  }
-  ;
-
-LOrExp
-  : LAndExp {
-    auto lor_exp = new LOrExpAST();
-    lor_exp->op = "";
-    lor_exp->land_exp = unique_ptr<BaseAST>($1);
-    $$ = lor_exp;
-  }
-  | LOrExp OROP LAndExp {
-    auto lor_exp = new LOrExpAST();
-    lor_exp->lor_exp = unique_ptr<BaseAST>($1);
-    lor_exp->op = *unique_ptr<string>($2);
-    lor_exp->land_exp = unique_ptr<BaseAST>($3);
-    $$ = lor_exp;
+  | IDENT '(' FuncRParams ')' {
+    auto call_exp = new CallExpAST();
+    call_exp->op = EXP_CALL;
+    call_exp->ident = *unique_ptr<string>($1);
+    vector<unique_ptr<BaseAST> > *v_ptr = ($3);
+    for (auto iter = v_ptr->begin(); iter != v_ptr->end(); iter++)
+      call_exp->func_r_param_list.push_back(move(*iter));
+    $$ = call_exp;
   }
   ;
 
@@ -391,6 +415,13 @@ ConstDef
     const_def->const_init_val = unique_ptr<BaseAST>($3);
     $$ = const_def;
   }
+  | IDENT ArrayDims '=' ConstInitVal {
+    auto const_def = new ConstDefAST();
+    const_def->ident = *unique_ptr<string>($1);
+    const_def->dims = move(*unique_ptr<vector<unique_ptr<BaseAST> > >($2));
+    const_def->const_init_val = unique_ptr<BaseAST>($4);
+    $$ = const_def;
+  }
   ;
 
 ConstInitVal
@@ -399,6 +430,31 @@ ConstInitVal
     const_init_val->const_exp = unique_ptr<BaseAST>($1);
     $$ = const_init_val;
   }
+  | '{' '}' {
+    auto const_init_val = new ConstInitValAST();
+    const_init_val->is_list = true;
+    $$ = const_init_val;
+  }
+  | '{' ConstInitVal_List '}' {
+    auto const_init_val = new ConstInitValAST();
+    const_init_val->is_list = true;
+    const_init_val->list = move(*unique_ptr<vector<unique_ptr<BaseAST> > >($2));
+    $$ = const_init_val;
+  }
+  ;
+
+// 数组定义和数组形参里的 [ConstExp] ...
+ArrayDims
+  : '[' ConstExp ']' {
+    vector<unique_ptr<BaseAST> > *v = new vector<unique_ptr<BaseAST> >;
+    v->push_back(unique_ptr<BaseAST>($2));
+    $$ = v;
+  }
+  | ArrayDims '[' ConstExp ']' {
+    vector<unique_ptr<BaseAST> > *v = ($1);
+    v->push_back(unique_ptr<BaseAST>($3));
+    $$ = v;
+  }
   ;
 
 BlockItem
@@ -418,9 +474,15 @@ BlockItem
 
 LVal
   : IDENT {
-    string *l_val = new string(*unique_ptr<string>($1));
+    auto l_val = new LValAST();
+    l_val->op = EXP_LVAL;
+    l_val->l_val = *unique_ptr<string>($1);
     $$ = l_val;
   }
+  | LVal '[' Exp ']' {
+    ((LValAST *)($1))->indices.push_back(unique_ptr<ExpAST>($3));
+    $$ = ($1);
+  }
   ;
   
 ConstExp
@@ -456,6 +518,21 @@ VarDef
     var_def->init_val = unique_ptr<BaseAST>($3);
     $$ = var_def;
   }
+  | IDENT ArrayDims {
+    auto var_def = new VarDefAST();
+    var_def->ident = *unique_ptr<string>($1);
+    var_def->dims = move(*unique_ptr<vector<unique_ptr<BaseAST> > >($2));
+    var_def->has_init_val = false;
+    $$ = var_def;
+  }
+  | IDENT ArrayDims '=' InitVal {
+    auto var_def = new VarDefAST();
+    var_def->ident = *unique_ptr<string>($1);
+    var_def->dims = move(*unique_ptr<vector<unique_ptr<BaseAST> > >($2));
+    var_def->has_init_val = true;
+    var_def->init_val = unique_ptr<BaseAST>($4);
+    $$ = var_def;
+  }
   ;
 
 InitVal
@@ -464,6 +541,17 @@ InitVal
     init_val->exp = unique_ptr<BaseAST>($1);
     $$ = init_val;
   }
+  | '{' '}' {
+    auto init_val = new InitValAST();
+    init_val->is_list = true;
+    $$ = init_val;
+  }
+  | '{' InitVal_List '}' {
+    auto init_val = new InitValAST();
+    init_val->is_list = true;
+    init_val->list = move(*unique_ptr<vector<unique_ptr<BaseAST> > >($2));
+    $$ = init_val;
+  }
   ;
 
 BlockItem_List
@@ -502,12 +590,83 @@ VarDef_List
     v->push_back(unique_ptr<BaseAST>($3));
     $$ = v;
   }
+  ;
+
+InitVal_List
+  : InitVal {
+    vector<unique_ptr<BaseAST> > *v = new vector<unique_ptr<BaseAST> >;
+    v->push_back(unique_ptr<BaseAST>($1));
+    $$ = v;
+  }
+  | InitVal_List ',' InitVal {
+    vector<unique_ptr<BaseAST> > *v = ($1);
+    v->push_back(unique_ptr<BaseAST>($3));
+    $$ = v;
+  }
+  ;
+
+ConstInitVal_List
+  : ConstInitVal {
+    vector<unique_ptr<BaseAST> > *v = new vector<unique_ptr<BaseAST> >;
+    v->push_back(unique_ptr<BaseAST>($1));
+    $$ = v;
+  }
+  | ConstInitVal_List ',' ConstInitVal {
+    vector<unique_ptr<BaseAST> > *v = ($1);
+    v->push_back(unique_ptr<BaseAST>($3));
+    $$ = v;
+  }
+  ;
+
+CompUnitItem_List
+  : CompUnitItem {
+    vector<unique_ptr<BaseAST> > *v = new vector<unique_ptr<BaseAST> >;
+    if (on_func_def)
+      on_func_def(unique_ptr<BaseAST>($1));
+    else
+      v->push_back(unique_ptr<BaseAST>($1));
+    $$ = v;
+  }
+  | CompUnitItem_List CompUnitItem {
+    vector<unique_ptr<BaseAST> > *v = ($1);
+    if (on_func_def)
+      on_func_def(unique_ptr<BaseAST>($2));
+    else
+      v->push_back(unique_ptr<BaseAST>($2));
+    $$ = v;
+  }
+  ;
+
+FuncFParams
+  : FuncFParam {
+    vector<unique_ptr<BaseAST> > *v = new vector<unique_ptr<BaseAST> >;
+    v->push_back(unique_ptr<BaseAST>($1));
+    $$ = v;
+  }
+  | FuncFParams ',' FuncFParam {
+    vector<unique_ptr<BaseAST> > *v = ($1);
+    v->push_back(unique_ptr<BaseAST>($3));
+    $$ = v;
+  }
+  ;
+
+FuncRParams
+  : Exp {
+    vector<unique_ptr<BaseAST> > *v = new vector<unique_ptr<BaseAST> >;
+    v->push_back(unique_ptr<BaseAST>($1));
+    $$ = v;
+  }
+  | FuncRParams ',' Exp {
+    vector<unique_ptr<BaseAST> > *v = ($1);
+    v->push_back(unique_ptr<BaseAST>($3));
+    $$ = v;
+  }
 
 
 %%
 
 // 定义错误处理函数, 其中第二个参数是错误信息
 // parser 如果发生错误 (例如输入的程序出现了语法错误), 就会调用这个函数
-void yyerror(unique_ptr<BaseAST> &ast, const char *s) {
+void yyerror(YYLTYPE *lloc, unique_ptr<BaseAST> &ast, FuncDefSink &on_func_def, LexState &lex, const char *s) {
   cerr << "error: " << s << endl;
 }
\ No newline at end of file
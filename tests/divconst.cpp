@@ -0,0 +1,89 @@
+// 常数除法和取模 (RISCV.h 的 div_by_const) 的随机等价测试的生成器.
+// 生成一个 SysY 程序: 被除数运行时从输入读, 对每个常数除数各跑一遍 x / d 和 x % d 并输出;
+// 同时用 C 的 / 和 % 算出期望的输出. divconst.sh 编译这个程序, 在 rvsim 上跑, 和期望比对.
+//
+// 用法: divconst 种子 程序.c 输入.in 期望.out
+// 除数: 所有 ±2^k (含 INT_MIN), ±1, ±3, ±7, INT_MAX, 2^k ± 1 和一批随机数.
+// 被除数: 0, ±1, INT_MIN, INT_MAX 及其邻居, 除数的倍数附近的值和一批随机数.
+// INT_MIN / -1 在 C 里没有定义, 不测
+
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+int main(int argc, const char *argv[])
+{
+    if (argc != 5)
+    {
+        fprintf(stderr, "usage: divconst seed program.c input.in expected.out\n");
+        return 1;
+    }
+    mt19937 rng(atoi(argv[1]));
+
+    vector<int32_t> divisors = {1, -1, 3, -3, 7, -7, INT_MAX, INT_MIN + 1};
+    for (int k = 1; k < 31; ++k)
+    {
+        divisors.push_back(1 << k);
+        divisors.push_back(-(1 << k));
+        divisors.push_back((1 << k) + 1);
+        divisors.push_back((1 << k) - 1);
+    }
+    divisors.push_back(INT_MIN);
+    for (int i = 0; i < 100; ++i)
+    {
+        // 一半是小的, 一半是整个 32 位范围里的
+        int32_t d = i % 2 ? (int32_t)rng() : (int32_t)(rng() % 20001) - 10000;
+        if (d != 0)
+            divisors.push_back(d);
+    }
+
+    vector<int32_t> dividends = {0, 1, -1, 2, -2, 3, -3, 7, -7, INT_MAX, INT_MAX - 1, INT_MIN + 1, INT_MIN + 2};
+    for (int i = 0; i < 40; ++i)
+        dividends.push_back((int32_t)(rng() | 1));
+    for (int i = 0; i < 20; ++i)
+    {
+        // 随机除数的倍数和它两边的值, 商在这里跳变
+        int64_t q = (int32_t)(rng() % 2001) - 1000, d = divisors[rng() % divisors.size()];
+        for (int64_t x = q * d - 1; x <= q * d + 1; ++x)
+            if (x > INT_MIN && x <= INT_MAX)
+                dividends.push_back((int32_t)x);
+    }
+    dividends.push_back(INT_MIN); // 放在最后, 除以 -1 时跳过它
+
+    ofstream program(argv[2]), input(argv[3]), expected(argv[4]);
+    input << dividends.size() << "\n";
+    for (int32_t x : dividends)
+        input << x << "\n";
+
+    // 除数写成常量, 前端直接给出立即数, 不管优化级别都走 div_by_const
+    program << "int x[" << dividends.size() << "];\n";
+    for (size_t i = 0; i < divisors.size(); ++i)
+    {
+        if (divisors[i] == INT_MIN)
+            program << "const int d" << i << " = -2147483647 - 1;\n";
+        else
+            program << "const int d" << i << " = " << divisors[i] << ";\n";
+    }
+    program << "void show(int v)\n{\n  putint(v);\n  putch(10);\n}\n";
+    program << "int main()\n{\n  int n = getint();\n  int i = 0;\n";
+    program << "  while (i < n) {\n    x[i] = getint();\n    i = i + 1;\n  }\n";
+    for (size_t i = 0; i < divisors.size(); ++i)
+    {
+        int32_t d = divisors[i];
+        size_t count = d == -1 ? dividends.size() - 1 : dividends.size();
+        program << "  i = 0;\n  while (i < " << (d == -1 ? "n - 1" : "n") << ") {\n";
+        program << "    show(x[i] / d" << i << ");\n    show(x[i] % d" << i << ");\n";
+        program << "    i = i + 1;\n  }\n";
+        for (size_t j = 0; j < count; ++j)
+            expected << dividends[j] / d << "\n" << dividends[j] % d << "\n";
+    }
+    program << "  return 0;\n}\n";
+    return program && input && expected ? 0 : 1;
+}
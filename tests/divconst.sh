@@ -0,0 +1,29 @@
+#!/bin/bash
+# 常数除法的等价测试: 用 divconst 生成程序和期望输出, 在 -O0/-O1/-O2 下编译,
+# 确认没有留下 div/rem 指令, 再用 rvsim 跑, 和 C 的 / 与 % 的结果逐行比对.
+# 用法: tests/divconst.sh 构建目录 [种子]  (构建目录里要有 compiler, rvsim 和 divconst)
+set -e
+B=${1:?usage: divconst.sh build-dir [seed]}
+SEED=${2:-1}
+W=$(mktemp -d)
+trap 'rm -rf "$W"' EXIT
+
+"$B/divconst" "$SEED" "$W/t.c" "$W/t.in" "$W/t.expected"
+status=0
+for opt in -O0 -O1 -O2; do
+    "$B/compiler" -riscv "$W/t.c" -o "$W/t$opt.S" $opt
+    if grep -Eq '^\s*(div|divu|rem|remu)\s' "$W/t$opt.S"; then
+        echo "divconst $opt: division by a constant was not expanded"
+        status=1
+        continue
+    fi
+    "$B/rvsim" "$W/t$opt.S" < "$W/t.in" > "$W/t$opt.out" 2> /dev/null || true
+    if cmp -s "$W/t.expected" "$W/t$opt.out"; then
+        echo "divconst $opt: ok"
+    else
+        echo "divconst $opt: mismatch (seed $SEED)"
+        diff "$W/t.expected" "$W/t$opt.out" | head -n 10
+        status=1
+    fi
+done
+exit $status
@@ -0,0 +1,458 @@
+// rvsim: 在进程里执行编译器输出的 RISC-V 汇编, 不需要任何外部工具链.
+// 汇编文本先交给内置汇编器 (src/RVAsm.h) 编码成机器码, 再从 main 开始解释执行,
+// 最后报告 main 的返回值, 动态指令数, 访存次数和跳转情况, 用来量化后端优化的效果.
+//
+// 用法: rvsim file.s [-limit=N] [-profile=FILE] [-sched-latency=op:n,...] < input
+// 程序的输出写到 stdout, 统计写到 stderr, 退出码是 main 返回值的低 8 位.
+// SysY 运行时库 (getint, putint, ...) 由模拟器直接实现.
+// 用 -fprofile-generate 编译的程序自己在 .bss 里给每个块计数, 模拟器结束时把计数器读出来,
+// 写成 -fprofile-use 读的 profile (默认 default.profile)
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "RVAsm.h"
+#include "RVSched.h"
+
+using namespace std;
+
+const uint32_t MEM_SIZE = 1 << 25;          // 栈在最上面往下长
+const uint32_t DATA_BASE = 0x10000;         // .data, .rodata, .bss 依次从这里开始放
+const uint32_t RETURN_ADDRESS = 0xfffffff0; // main 返回到这里时停机
+
+// 预先解码好的指令
+enum
+{
+    SIM_LUI, SIM_JAL, SIM_JALR, SIM_BRANCH, SIM_LW, SIM_SW, SIM_OP_IMM, SIM_OP, SIM_CALL, SIM_ILLEGAL,
+};
+
+struct SimInst
+{
+    int kind;
+    int rd, rs1, rs2, funct3, funct7;
+    int32_t imm;
+    int symbol; // SIM_CALL: 被调函数在 RVObject::symbols 里的下标
+};
+
+struct SimStats
+{
+    long insts = 0;
+    long loads = 0;
+    long stores = 0;
+    long branches = 0;
+    long taken = 0;
+    long jumps = 0;
+    long calls = 0;
+    long stalls = 0; // 单发射顺序流水线等操作数的周期, 延迟表和 -sched-latency 的一样
+};
+
+static int32_t regs[32];
+static vector<uint8_t> mem(MEM_SIZE);
+static SimStats stats;
+
+[[noreturn]] static void Sim_Error(const string &msg, uint32_t pc)
+{
+    cerr << "rvsim: " << msg << " at pc 0x" << hex << pc << endl;
+    exit(1);
+}
+
+static uint32_t Sim_Addr(uint32_t addr, uint32_t pc)
+{
+    if (addr > MEM_SIZE - 4)
+    {
+        stringstream ss;
+        ss << "memory access out of range (0x" << hex << addr << ")";
+        Sim_Error(ss.str(), pc);
+    }
+    return addr;
+}
+
+static int32_t Sim_Load(uint32_t addr, uint32_t pc)
+{
+    int32_t value;
+    memcpy(&value, &mem[Sim_Addr(addr, pc)], 4);
+    return value;
+}
+
+static void Sim_Store(uint32_t addr, int32_t value, uint32_t pc)
+{
+    memcpy(&mem[Sim_Addr(addr, pc)], &value, 4);
+}
+
+// 把数据节依次放进内存, 返回各节的起始地址 (下标是 RVSection)
+static vector<uint32_t> Sim_LoadData(const RVObject &obj)
+{
+    vector<uint32_t> base(4, 0);
+    uint32_t addr = DATA_BASE;
+    base[RV_DATA] = addr;
+    memcpy(&mem[addr], obj.data.data(), obj.data.size());
+    addr = (addr + obj.data.size() + 3) & ~3u;
+    base[RV_RODATA] = addr;
+    memcpy(&mem[addr], obj.rodata.data(), obj.rodata.size());
+    addr = (addr + obj.rodata.size() + 3) & ~3u;
+    base[RV_BSS] = addr;
+    if (addr + obj.bss_size > MEM_SIZE / 2)
+        Sim_Error("global data too large", 0);
+    return base;
+}
+
+static vector<SimInst> Sim_Decode(const RVObject &obj, const vector<uint32_t> &section_base)
+{
+    vector<SimInst> code(obj.text.size() / 4);
+    for (size_t i = 0; i < code.size(); ++i)
+    {
+        uint32_t w = RVAsm_Word(obj, i * 4);
+        SimInst &inst = code[i];
+        int opcode = w & 0x7f;
+        inst.rd = w >> 7 & 0x1f;
+        inst.funct3 = w >> 12 & 7;
+        inst.rs1 = w >> 15 & 0x1f;
+        inst.rs2 = w >> 20 & 0x1f;
+        inst.funct7 = w >> 25;
+        inst.imm = RVAsm_SignExtend(w >> 20, 12);
+        inst.symbol = -1;
+        switch (opcode)
+        {
+        case 0x37:
+            inst.kind = SIM_LUI;
+            inst.imm = (int32_t)(w & 0xfffff000);
+            break;
+        case 0x6f:
+            inst.kind = SIM_JAL;
+            inst.imm = RVAsm_SignExtend((w >> 31) << 20 | (w >> 12 & 0xff) << 12 | (w >> 20 & 1) << 11 | (w >> 21 & 0x3ff) << 1, 21);
+            break;
+        case 0x67:
+            inst.kind = SIM_JALR;
+            break;
+        case 0x63:
+            inst.kind = SIM_BRANCH;
+            inst.imm = RVAsm_SignExtend((w >> 31) << 12 | (w >> 7 & 1) << 11 | (w >> 25 & 0x3f) << 5 | (w >> 8 & 0xf) << 1, 13);
+            break;
+        case 0x03:
+            inst.kind = inst.funct3 == 2 ? SIM_LW : SIM_ILLEGAL;
+            break;
+        case 0x23:
+            inst.kind = inst.funct3 == 2 ? SIM_SW : SIM_ILLEGAL;
+            inst.imm = RVAsm_SignExtend(inst.funct7 << 5 | inst.rd, 12);
+            break;
+        case 0x13:
+            inst.kind = SIM_OP_IMM;
+            break;
+        case 0x33:
+            inst.kind = SIM_OP;
+            break;
+        default:
+            // auipc 只出现在 call / tail 里, 下面按重定位换成 SIM_CALL
+            inst.kind = SIM_ILLEGAL;
+        }
+    }
+    for (auto &reloc : obj.relocs)
+    {
+        SimInst &inst = code[reloc.offset / 4];
+        const RVSymbol &sym = obj.symbols[reloc.symbol];
+        if (reloc.type == R_RISCV_CALL_PLT)
+        {
+            inst.kind = SIM_CALL;
+            inst.symbol = reloc.symbol;
+            continue;
+        }
+        // 全局变量的地址: 按 %hi / %lo 填进 lui 和 addi / lw / sw 的立即数
+        if (!sym.defined || sym.section == RV_TEXT)
+            Sim_Error("reference to undefined variable " + sym.name, reloc.offset);
+        uint32_t addr = section_base[sym.section] + sym.value;
+        if (reloc.type == R_RISCV_HI20)
+            inst.imm = (int32_t)((addr + 0x800) & 0xfffff000);
+        else
+            inst.imm = RVAsm_SignExtend(addr & 0xfff, 12);
+    }
+    return code;
+}
+
+static int32_t Sim_Alu(int funct3, int funct7, int32_t a, int32_t b, bool is_imm)
+{
+    uint32_t ua = a, ub = b;
+    if (!is_imm && funct7 == 0x01)
+    {
+        // M 扩展, 除零和溢出按规范给结果, 不产生异常
+        switch (funct3)
+        {
+        case 0: return (int32_t)(ua * ub);
+        case 1: return (int32_t)(((int64_t)a * b) >> 32);
+        case 4: return b == 0 ? -1 : (a == INT32_MIN && b == -1) ? a : a / b;
+        case 6: return b == 0 ? a : (a == INT32_MIN && b == -1) ? 0 : a % b;
+        }
+        return 0;
+    }
+    switch (funct3)
+    {
+    case 0: return !is_imm && funct7 == 0x20 ? (int32_t)(ua - ub) : (int32_t)(ua + ub);
+    case 1: return (int32_t)(ua << (ub & 31));
+    case 2: return a < b;
+    case 3: return ua < ub;
+    case 4: return a ^ b;
+    case 5: return (funct7 & 0x20) ? a >> (ub & 31) : (int32_t)(ua >> (ub & 31));
+    case 6: return a | b;
+    case 7: return a & b;
+    }
+    return 0;
+}
+
+// SysY 运行时库, 参数和返回值都按调用约定走 a0/a1
+static bool Sim_Library(const string &name, uint32_t pc)
+{
+    if (name == "getint")
+    {
+        int value = 0;
+        if (scanf("%d", &value) != 1)
+            value = 0;
+        regs[10] = value;
+    }
+    else if (name == "getch")
+        regs[10] = getchar();
+    else if (name == "getarray")
+    {
+        int n = 0;
+        if (scanf("%d", &n) != 1)
+            n = 0;
+        for (int i = 0; i < n; ++i)
+        {
+            int value = 0;
+            if (scanf("%d", &value) != 1)
+                value = 0;
+            Sim_Store(regs[10] + 4 * i, value, pc);
+        }
+        regs[10] = n;
+    }
+    else if (name == "putint")
+        printf("%d", regs[10]);
+    else if (name == "putch")
+        putchar(regs[10]);
+    else if (name == "putarray")
+    {
+        printf("%d:", regs[10]);
+        for (int i = 0; i < regs[10]; ++i)
+            printf(" %d", Sim_Load(regs[11] + 4 * i, pc));
+        printf("\n");
+    }
+    else if (name != "starttime" && name != "stoptime")
+        return false;
+    return true;
+}
+
+static int32_t Sim_Run(const RVObject &obj, const vector<SimInst> &code, uint32_t entry, long limit)
+{
+    const int lat_lw = RVSched_Latency("lw"), lat_mul = RVSched_Latency("mul"), lat_mulh = RVSched_Latency("mulh"),
+              lat_div = RVSched_Latency("div"), lat_rem = RVSched_Latency("rem");
+    long cycle = 0, reg_ready[32] = {0};
+    regs[2] = MEM_SIZE;
+    regs[1] = RETURN_ADDRESS;
+    uint32_t pc = entry;
+    while (pc != RETURN_ADDRESS)
+    {
+        if (pc % 4 != 0 || pc / 4 >= code.size())
+            Sim_Error("jump to invalid address", pc);
+        if (limit >= 0 && stats.insts >= limit)
+            Sim_Error("instruction limit reached", pc);
+        const SimInst &inst = code[pc / 4];
+        uint32_t next = pc + 4;
+        int32_t result = 0;
+        bool write = true;
+        stats.insts++;
+        bool use1 = inst.kind != SIM_LUI && inst.kind != SIM_JAL && inst.kind != SIM_CALL;
+        bool use2 = inst.kind == SIM_OP || inst.kind == SIM_SW || inst.kind == SIM_BRANCH;
+        long issue = max(cycle, max(use1 ? reg_ready[inst.rs1] : 0, use2 ? reg_ready[inst.rs2] : 0));
+        stats.stalls += issue - cycle;
+        cycle = issue + 1;
+        int latency = 1;
+        if (inst.kind == SIM_LW)
+            latency = lat_lw;
+        else if (inst.kind == SIM_OP && inst.funct7 == 0x01)
+            latency = inst.funct3 == 0 ? lat_mul : inst.funct3 == 1 ? lat_mulh : inst.funct3 == 4 ? lat_div : lat_rem;
+        switch (inst.kind)
+        {
+        case SIM_LUI:
+            result = inst.imm;
+            break;
+        case SIM_JAL:
+            result = next;
+            next = pc + inst.imm;
+            stats.jumps++;
+            break;
+        case SIM_JALR:
+            result = next;
+            next = (uint32_t)(regs[inst.rs1] + inst.imm) & ~1u;
+            stats.jumps++;
+            break;
+        case SIM_BRANCH:
+        {
+            int32_t a = regs[inst.rs1], b = regs[inst.rs2];
+            bool taken;
+            switch (inst.funct3)
+            {
+            case 0: taken = a == b; break;
+            case 1: taken = a != b; break;
+            case 4: taken = a < b; break;
+            case 5: taken = a >= b; break;
+            case 6: taken = (uint32_t)a < (uint32_t)b; break;
+            case 7: taken = (uint32_t)a >= (uint32_t)b; break;
+            default: Sim_Error("illegal branch", pc);
+            }
+            stats.branches++;
+            if (taken)
+            {
+                stats.taken++;
+                next = pc + inst.imm;
+            }
+            write = false;
+            break;
+        }
+        case SIM_LW:
+            result = Sim_Load(regs[inst.rs1] + inst.imm, pc);
+            stats.loads++;
+            break;
+        case SIM_SW:
+            Sim_Store(regs[inst.rs1] + inst.imm, regs[inst.rs2], pc);
+            stats.stores++;
+            write = false;
+            break;
+        case SIM_OP_IMM:
+            result = Sim_Alu(inst.funct3, inst.funct3 == 5 ? inst.funct7 : 0, regs[inst.rs1],
+                             inst.funct3 == 1 || inst.funct3 == 5 ? inst.rs2 : inst.imm, true);
+            break;
+        case SIM_OP:
+            result = Sim_Alu(inst.funct3, inst.funct7, regs[inst.rs1], regs[inst.rs2], false);
+            break;
+        case SIM_CALL:
+        {
+            // auipc ra + jalr ra 两条; tail 是 auipc t1 + jalr zero, 不写 ra
+            stats.insts++;
+            stats.calls++;
+            const RVSymbol &callee = obj.symbols[inst.symbol];
+            write = false;
+            bool tail = inst.rd != 1;
+            if (!tail)
+                regs[1] = pc + 8;
+            uint32_t back = tail ? (uint32_t)regs[1] : pc + 8;
+            if (callee.defined)
+                next = callee.value;
+            else if (Sim_Library(callee.name, pc))
+                next = back;
+            else
+                Sim_Error("call to undefined function " + callee.name, pc);
+            break;
+        }
+        default:
+            Sim_Error("illegal instruction", pc);
+        }
+        if (write && inst.rd != 0)
+        {
+            regs[inst.rd] = result;
+            reg_ready[inst.rd] = issue + latency;
+        }
+        pc = next;
+    }
+    return regs[10];
+}
+
+// 计数器数组 __profile.<函数> 里一块一个字, 按块在代码里的顺序排, 也就是标号 .L<函数>.<块>
+// 按地址排的顺序. 没执行到的块也写出来, 次数为 0. 没有插桩的程序不写文件
+static void Sim_WriteProfile(const RVObject &obj, const vector<uint32_t> &section_base, const string &path)
+{
+    const string prefix = "__profile.";
+    bool instrumented = false;
+    ofstream out;
+    for (auto &sym : obj.symbols)
+    {
+        if (!sym.defined || sym.section != RV_BSS || sym.name.compare(0, prefix.size(), prefix) != 0)
+            continue;
+        if (!instrumented)
+        {
+            instrumented = true;
+            out.open(path);
+            if (!out)
+            {
+                cerr << "rvsim: cannot write " << path << endl;
+                exit(1);
+            }
+        }
+        string func = sym.name.substr(prefix.size()), label_prefix = ".L" + func + ".";
+        map<uint32_t, string> blocks; // 块的位置 -> 块名
+        for (auto &kv : obj.labels)
+            if (kv.first.compare(0, label_prefix.size(), label_prefix) == 0)
+                blocks[kv.second] = kv.first.substr(label_prefix.size());
+        uint32_t addr = section_base[RV_BSS] + sym.value;
+        for (auto &kv : blocks)
+        {
+            out << "@" << func << " %" << kv.second << " " << (uint32_t)Sim_Load(addr, 0) << "\n";
+            addr += 4;
+        }
+    }
+}
+
+int main(int argc, const char *argv[])
+{
+    const char *input = nullptr;
+    long limit = -1;
+    string profile = "default.profile";
+    for (int i = 1; i < argc; ++i)
+    {
+        string arg = argv[i];
+        if (arg.compare(0, 7, "-limit=") == 0)
+            limit = atol(arg.c_str() + 7);
+        else if (arg.compare(0, 9, "-profile=") == 0)
+            profile = arg.substr(9);
+        else if (arg.compare(0, 15, "-sched-latency=") == 0 && RVSched_ParseLatency(arg.substr(15)))
+            continue;
+        else if (input == nullptr && arg[0] != '-')
+            input = argv[i];
+        else
+        {
+            cerr << "usage: rvsim file.s [-limit=N] [-profile=FILE] [-sched-latency=op:n,...] < input" << endl;
+            return 1;
+        }
+    }
+    if (input == nullptr)
+    {
+        cerr << "usage: rvsim file.s [-limit=N] [-profile=FILE] [-sched-latency=op:n,...] < input" << endl;
+        return 1;
+    }
+    ifstream in(input);
+    if (!in)
+    {
+        cerr << "rvsim: cannot open " << input << endl;
+        return 1;
+    }
+    stringstream text;
+    text << in.rdbuf();
+
+    RVObject obj;
+    RVAsm_Assemble(obj, text.str());
+    if (!obj.symbol_index.count("main") || !obj.symbols[obj.symbol_index["main"]].defined)
+    {
+        cerr << "rvsim: no main function" << endl;
+        return 1;
+    }
+    vector<uint32_t> section_base = Sim_LoadData(obj);
+    vector<SimInst> code = Sim_Decode(obj, section_base);
+    int32_t ret = Sim_Run(obj, code, obj.symbols[obj.symbol_index["main"]].value, limit);
+    fflush(stdout);
+    Sim_WriteProfile(obj, section_base, profile);
+
+    fprintf(stderr, "%-16s %12d\n", "return value", ret);
+    fprintf(stderr, "%-16s %12ld\n", "instructions", stats.insts);
+    fprintf(stderr, "%-16s %12ld\n", "loads", stats.loads);
+    fprintf(stderr, "%-16s %12ld\n", "stores", stats.stores);
+    fprintf(stderr, "%-16s %12ld\n", "branches", stats.branches);
+    fprintf(stderr, "%-16s %12ld\n", "taken branches", stats.taken);
+    fprintf(stderr, "%-16s %12ld\n", "jumps", stats.jumps);
+    fprintf(stderr, "%-16s %12ld\n", "calls", stats.calls);
+    fprintf(stderr, "%-16s %12ld\n", "stall cycles", stats.stalls);
+    return ret & 0xff;
+}